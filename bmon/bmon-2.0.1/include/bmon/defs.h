@@ -40,6 +40,9 @@
 /* have libnl */
 /* #undef HAVE_NL */
 
+/* have pthread */
+#define HAVE_PTHREAD "1"
+
 /* have redrawwin */
 #define HAVE_REDRAWWIN "1"
 
@@ -30,7 +30,8 @@
 #include <bmon/bmon.h>
 
 #define BMON_MAGIC 0xFA
-#define BMON_VERSION 0x01
+#define BMON_VERSION_1 0x01
+#define BMON_VERSION 0x02
 
 enum {
 	BMON_GRP_IF
@@ -55,10 +56,84 @@ enum {
  * .                                                               .
  * +---------------------------------------------------------------+
  * .                                                               .
+ * .                    Header Options (optional)                  .
+ * .                                                               .
+ * +---------------------------------------------------------------+
+ * .                                                               .
  * .                        List of Groups                         .
  * .                                                               .
  * +---------------------------------------------------------------+
  *
+ * The offset points to the first group, header options are located
+ * between the padded node name and the first group. Receivers not
+ * knowing about header options skip them.
+ *
+ *                          HEADER OPTION
+ *   0                   1                   2                   3
+ *   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *  +---------------+---------------+-------------------------------+
+ *  |     Type      |     Length    |            Padding            |
+ *  +---------------+---------------+-------------------------------+
+ *  .                                                               .
+ *  .                               Data                            .
+ *  .                                                               .
+ *  +---------------------------------------------------------------+
+ *
+ *                      DEFINED HEADER OPTIONS
+ *
+ *          +----------------+--------+---------------------+
+ *          | Type           | Length |   Description       |
+ *          +----------------+--------+---------------------+
+ *          | HDROPT_FRAG    | 8      | Fragment            |
+ *          | HDROPT_SEQ     | 12     | Sequence            |
+ *          | HDROPT_RELAY   | 0      | Aggregate of relay  |
+ *          | HDROPT_DRILL   | 0      | Drill-down request  |
+ *          +----------------+--------+---------------------+
+ *
+ *                             FRAGMENT
+ *   0                   1                   2                   3
+ *   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *  +---------------------------------------------------------------+
+ *  |                           Sequence                            |
+ *  +-------------------------------+-----------------------------+-+
+ *  |             Index             |                             |L|
+ *  +-------------------------------+-----------------------------+-+
+ *
+ * Nodes not fitting into a single datagram are split into several
+ * messages, each carrying a complete header and a subset of the
+ * interfaces. All fragments share the sequence number, the last one
+ * is flagged. Every fragment can be applied on its own.
+ *
+ *                             SEQUENCE
+ *   0                   1                   2                   3
+ *   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *  +---------------------------------------------------------------+
+ *  |                            Origin                             |
+ *  +---------------------------------------------------------------+
+ *  |                           Sequence                            |
+ *  +---------------------------------------------------------------+
+ *  |                            Sender                             |
+ *  +---------------------------------------------------------------+
+ *
+ * Origin identifies the instance which sampled the node, Sequence is
+ * incremented with every sample taken there. Both are kept as they are
+ * when a node is forwarded, Sender identifies the instance which sent
+ * the message. Receivers discard samples older than or equal to the
+ * one last applied (per fragment index) and messages originating from
+ * or sent by themselves.
+ *
+ * A relay sends the nodes it collects as a single aggregate node
+ * flagged with HDROPT_RELAY instead of forwarding them. Collectors
+ * may ask a relay for the full detail of a node by sending it a
+ * message carrying the name of the node, HDROPT_DRILL and an empty
+ * interface group. The relay then forwards that node for a while,
+ * requests are repeated to keep it coming.
+ *
+ * Over a stream (TCP, unix domain socket), every message is preceded
+ * by its length as 32 bit integer in network byte order. A sender
+ * sends everything in full once connected and pure deltas from then
+ * on, messages may be as large as the length field allows.
+ *
  * 
  *                          GROUP MESSAGE
  *  0                   1                   2                   3
@@ -132,6 +207,36 @@ enum {
  *  |                            TX Value                           |
  *  |                                                               |
  *  +---------------------------------------------------------------+
+ *
+ *
+ *                     INTERFACE MESSAGE (VERSION 2)
+ *
+ * Version 2 shares header, header options and groups with version 1,
+ * interfaces are encoded as compact records instead. Numbers are
+ * unsigned LEB128 varints, deltas are zigzag encoded.
+ *
+ *  +-------------------------------+
+ *  | Index                (varint) |  interface index of the sender
+ *  +---------------+---------------+
+ *  |     Flags     |   Generation  |  IF2_CHILD, IF2_BASE
+ *  +---------------+---------------+
+ *  | Base only:                    |
+ *  |   Name Length (u8), Name      |  not terminated
+ *  |   Handle, Parent, Link, Level |  varints
+ *  +-------------------------------+
+ *  | Attribute Bitmap     (varint) |  bit n set: attribute n follows
+ *  +-------------------------------+
+ *  | Per attribute, ascending:     |
+ *  |   Flags (u8)        base only |  ATTR_*_PROVIDED
+ *  |   RX Value, TX Value          |  varints, absolute in base
+ *  |                               |  records, deltas otherwise
+ *  +-------------------------------+
+ *
+ * A base record carries the complete state of an interface and starts
+ * a new generation. Other records carry the attributes changed since
+ * the previous message as delta against the base of their generation
+ * and are ignored by receivers not holding that base. Bytes and
+ * packets are attributes 0 and 1, their values include overflows.
  */
 
 struct distr_msg_hdr
@@ -146,6 +251,37 @@ struct distr_msg_hdr
 	uint32_t   h_ts_usec;
 };
 
+enum {
+	HDROPT_END,
+	HDROPT_FRAG,
+	HDROPT_SEQ,
+	HDROPT_RELAY,
+	HDROPT_DRILL,
+};
+
+struct distr_msg_hdropt
+{
+	uint8_t    ho_type;
+	uint8_t    ho_len;
+	uint16_t   ho_pad;
+};
+
+#define FRAG_LAST (1<<0)
+
+struct distr_msg_frag
+{
+	uint32_t   f_seq;
+	uint16_t   f_index;
+	uint16_t   f_flags;
+};
+
+struct distr_msg_seq
+{
+	uint32_t   s_origin;
+	uint32_t   s_seq;
+	uint32_t   s_sender;
+};
+
 struct distr_msg_grp
 {
 	uint16_t  g_type;
@@ -180,6 +316,7 @@ struct distr_msg_ifopt
 
 #define ATTR_TX_PROVIDED (1<<0)
 #define ATTR_RX_PROVIDED (1<<1)
+#define ATTR_RATE_PROVIDED (1<<2)
 
 struct distr_msg_attr
 {
@@ -191,4 +328,56 @@ struct distr_msg_attr
 	uint64_t  a_tx;
 };
 
+#define IF2_CHILD	(1<<0)
+#define IF2_BASE	(1<<1)
+
+/* longest encoding of a 64 bit varint */
+#define VARINT_MAX	10
+
+static inline int
+varint_put(uint8_t *p, uint64_t v)
+{
+	int n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+
+	return n;
+}
+
+static inline int
+varint_get(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	const uint8_t *s = *p;
+	int shift = 0;
+
+	*v = 0;
+
+	while (s < end && shift < 64) {
+		*v |= (uint64_t) (*s & 0x7f) << shift;
+		if (!(*s++ & 0x80)) {
+			*p = s;
+			return 0;
+		}
+		shift += 7;
+	}
+
+	return -1;
+}
+
+static inline uint64_t
+zigzag_encode(int64_t v)
+{
+	return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t
+zigzag_decode(uint64_t v)
+{
+	return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
 #endif
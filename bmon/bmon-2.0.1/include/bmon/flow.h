@@ -0,0 +1,96 @@
+/*
+ * flow.h              Flow accounting
+ *
+ * Copyright (c) 2001-2004 Thomas Graf <tgraf@suug.ch>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __BMON_FLOW_H_
+#define __BMON_FLOW_H_
+
+#include <bmon/bmon.h>
+#include <bmon/intf.h>
+
+/* pcap link types understood by flow_parse() */
+#define FLOW_LINK_NULL		0
+#define FLOW_LINK_ETHER		1
+#define FLOW_LINK_RAW		101
+#define FLOW_LINK_SLL		113
+
+struct flow_key
+{
+	uint8_t		fk_family;
+	uint8_t		fk_proto;
+	uint16_t	fk_sport;
+	uint16_t	fk_dport;
+	uint8_t		fk_src[16];
+	uint8_t		fk_dst[16];
+};
+
+/*
+ * Both directions of a conversation share one flow, the key is stored
+ * with the lower endpoint as source. Bytes sent by the source are
+ * accounted as tx, bytes sent by the destination as rx.
+ */
+struct flow
+{
+	struct flow_key	f_key;
+	uint32_t	f_hash;
+	uint32_t	f_seen;
+	b_cnt_t		f_rx_bytes;
+	b_cnt_t		f_tx_bytes;
+	b_cnt_t		f_rx_packets;
+	b_cnt_t		f_tx_packets;
+	b_cnt_t		f_delta;
+};
+
+/*
+ * Open addressing table of bounded size. Once ft_max flows are known,
+ * a new flow replaces the least active flow on its probe sequence.
+ */
+typedef struct flow_table_s
+{
+	struct flow *	ft_flows;
+	struct flow *	ft_spare;
+	size_t		ft_size;
+	size_t		ft_used;
+	size_t		ft_max;
+	uint32_t	ft_gen;
+	b_cnt_t		ft_evicted;
+} flow_table_t;
+
+extern void flow_table_init(flow_table_t *ft, size_t max);
+extern void flow_table_free(flow_table_t *ft);
+
+extern int flow_parse(const uint8_t *pkt, size_t len, int link,
+		      struct flow_key *key);
+extern int flow_parse_ip(const uint8_t *pkt, size_t len,
+			 struct flow_key *key);
+extern int flow_key_canon(struct flow_key *key);
+extern void flow_key_hosts(struct flow_key *key);
+
+extern void flow_account(flow_table_t *ft, struct flow_key *key, int tx,
+			 b_cnt_t bytes, b_cnt_t packets);
+extern int flow_top(flow_table_t *ft, struct flow **top, int n);
+extern void flow_expire(flow_table_t *ft, uint32_t idle);
+extern void flow_name(struct flow *f, char *buf, size_t len);
+extern void flow_update_intf(struct flow *f, intf_t *intf);
+
+#endif
@@ -53,6 +53,9 @@ struct input_module
 	int                 (*im_probe)(void);
 	void                (*im_init)(void);
 	void                (*im_shutdown)(void);
+	/* inputs replaying recorded data provide the clock */
+	void                (*im_clock)(timestamp_t *ts);
+	unsigned long       (*im_sleep)(unsigned long usec);
 	int                   im_no_default;
 	int                   im_enable;
 	struct input_module * im_next;
@@ -65,6 +68,12 @@ extern void register_secondary_input_module(struct input_module *ops);
 extern void input_init(void);
 extern void input_shutdown(void);
 extern void input_read(void);
+extern void input_clock(timestamp_t *ts);
+extern unsigned long input_sleep(unsigned long usec);
 extern const char * get_preferred_input_name(void);
 
+struct node_s;
+extern void proc_net_dev_parse(struct node_s *node, char *buf,
+			       int (*accept)(const char *name));
+
 #endif
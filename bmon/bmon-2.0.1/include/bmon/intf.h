@@ -72,6 +72,7 @@ typedef struct rate_s
 
 #define RX_PROVIDED 1
 #define TX_PROVIDED 2
+#define RATE_PROVIDED 4	/* attribute is a counter, keep rate & history */
 
 typedef struct intf_attr_s
 {
@@ -82,6 +83,9 @@ typedef struct intf_attr_s
 	b_cnt_t       a_tx;
 	timestamp_t   a_last_distribution;
 	timestamp_t   a_updated;
+	rate_t        a_rx_rate;
+	rate_t        a_tx_rate;
+	history_t *   a_hist;
 	struct intf_attr_s *a_next;
 } intf_attr_t;
 
@@ -109,6 +113,7 @@ typedef struct intf_s
 	history_t       i_packets_hist;
 	int             i_updated;
 	int             i_lifetime;
+	int             i_hash_next;
 
 } intf_t;
 
@@ -142,22 +147,50 @@ enum {
 	QLEN,
 	BACKLOG,
 	REQUEUES,
+	TIME_SQUEEZE,
+	CPU_COLLISION,
+	RECEIVED_RPS,
+	FLOW_LIMIT,
+	RETRANS,
+	RESETS,
+	CONN_OPENS,
+	ESTABLISHED,
+	LISTEN_OVERFLOWS,
+	LISTEN_DROPS,
+	TIMEOUTS,
+	NO_PORTS,
+	BUF_ERRORS,
+	CSUM_ERRORS,
+	FORWARDED,
+	NO_ROUTES,
+	FRAG_ERRORS,
+	UNREACHABLE,
+	STALE,
+	DUPLICATES,
+	LOOPS,
 	__ATTR_MAX,
 };
 
 #define ATTR_MAX (__ATTR_MAX - 1)
 	
 extern intf_t * lookup_intf(struct node_s *node, const char *name, uint32_t handle, int parent);
+extern intf_t * lookup_intf_sample(struct node_s *node, const char *name,
+				  uint32_t handle, int parent);
 extern void foreach_child(struct node_s *node, intf_t *parent, void (*cb)(intf_t *, void *), void *arg);
 extern void notify_update(intf_t *i);
+extern void notify_update_ts(intf_t *i, timestamp_t *ts);
 extern void increase_lifetime(intf_t *i, int l);
 extern void reset_intf(intf_t *i);
 extern void remove_unused_intf(intf_t *i);
+extern void remove_intf(intf_t *i);
+extern void rename_intf(intf_t *i, const char *name);
 
 extern void update_attr(intf_t *i, int type, b_cnt_t rx, b_cnt_t tx, int flags);
 extern void intf_parse_policy(const char *policy);
+extern int intf_policy_names(const char ***names);
 extern void foreach_attr(intf_t *i, void (*cb)(intf_attr_t *, void *), void *arg);
 extern const char * type2name(int type);
 extern intf_t * get_intf(struct node_s *node, int ifindex);
+extern intf_t * get_intf_by_name(struct node_s *node, const char *name);
 
 #endif
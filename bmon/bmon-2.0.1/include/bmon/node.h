@@ -33,15 +33,24 @@
 typedef struct node_s
 {
 	int           n_index;
+	int           n_hash_next;
 	char *        n_name;
 	char *        n_from;
 	intf_t *      n_intf;
 	size_t        n_nintf;
+	int *         n_intf_hash;
+	int           n_intf_free;
 	int           n_selected;
+	uint32_t      n_origin;	/* instance which sampled the node */
+	uint32_t      n_seq;	/* sequence of its last sample */
+	timestamp_t   n_sampled; /* time of its last sample if received */
+	uint32_t      n_serial;	/* tells nodes reusing a slot apart */
+	int           n_idle;	/* reads without any interface */
 } node_t;
 
 extern node_t * lookup_node(const char *name, int creat);
 extern node_t * get_local_node(void);
+extern uint32_t get_local_origin(void);
 extern int get_nnodes(void);
 extern void reset_nodes(void);
 extern void remove_unused_node_intfs(void);
@@ -37,6 +37,25 @@
 
 extern float read_delta;
 
+/*
+ * Statistic file kept open across reads, the whole file is read into a
+ * buffer which is only ever grown. Reading it does not allocate once the
+ * buffer has reached the size of the file.
+ */
+typedef struct stat_file_s
+{
+	const char *	sf_path;
+	int		sf_fd;
+	char *		sf_buf;
+	size_t		sf_size;
+	size_t		sf_len;
+} stat_file_t;
+
+#define STAT_FILE_INIT(path) { .sf_path = (path), .sf_fd = -1 }
+
+extern char * stat_file_read(stat_file_t *sf);
+extern void stat_file_close(stat_file_t *sf);
+
 extern void * xcalloc(size_t n, size_t s);
 extern void * xrealloc(void *p, size_t s);
 extern void xfree(void *d);
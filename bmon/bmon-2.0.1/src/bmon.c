@@ -67,9 +67,11 @@ static char *usage_text =
 "       -O html:help     # Shows a help text for html module\n" \
 "\n" \
 "Interface selection:\n" \
-"   policy  := [!]simple_regexp,[!]simple_regexp,...\n" \
+"   policy  := [!]pattern,[!]pattern,...\n" \
+"   pattern := glob (*, ?, [...]) | ~regexp\n" \
 "\n" \
 "   Example: -p 'eth*,lo*,!eth1'\n" \
+"            -p '~^(eth|wlan)[0-9]+$,!eth1'\n" \
 "\n" \
 "Please see the bmon(1) man pages for full documentation.\n";
 
@@ -238,7 +240,7 @@ main(int argc, char *argv[])
 		/*
 		 * E := NOW()
 		 */
-		update_ts(&e);
+		input_clock(&e);
 		
 		/*
 		 * NR := E
@@ -251,7 +253,7 @@ main(int argc, char *argv[])
 			/*
 			 * E := NOW()
 			 */
-			update_ts(&e);
+			input_clock(&e);
 
 			/*
 			 * IF NR <= E THEN
@@ -305,7 +307,7 @@ main(int argc, char *argv[])
 			/*
 			 * SLEEP(ST)
 			 */
-			usleep(st);
+			usleep(input_sleep(st));
 		}
 	}
 	
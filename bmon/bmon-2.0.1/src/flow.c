@@ -0,0 +1,391 @@
+/*
+ * flow.c              Flow accounting
+ *
+ * Copyright (c) 2001-2004 Thomas Graf <tgraf@suug.ch>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <bmon/bmon.h>
+#include <bmon/flow.h>
+#include <bmon/utils.h>
+
+/* number of slots looked at to find a flow to replace */
+#define FLOW_PROBE	8
+
+#define GET16(p)	((uint16_t) (((p)[0] << 8) | (p)[1]))
+
+void
+flow_table_init(flow_table_t *ft, size_t max)
+{
+	size_t size = 16;
+
+	while (size < 2 * max)
+		size <<= 1;
+
+	memset(ft, 0, sizeof(*ft));
+	ft->ft_size = size;
+	ft->ft_max = size / 2;
+	ft->ft_flows = xcalloc(size, sizeof(struct flow));
+	ft->ft_spare = xcalloc(size, sizeof(struct flow));
+}
+
+void
+flow_table_free(flow_table_t *ft)
+{
+	xfree(ft->ft_flows);
+	xfree(ft->ft_spare);
+	memset(ft, 0, sizeof(*ft));
+}
+
+static inline int
+has_ports(uint8_t proto)
+{
+	return IPPROTO_TCP == proto || IPPROTO_UDP == proto || 132 == proto;
+}
+
+/*
+ * Parses the IPv4 or IPv6 header at pkt in place. Ports are only
+ * available in the first fragment.
+ */
+int
+flow_parse_ip(const uint8_t *pkt, size_t len, struct flow_key *key)
+{
+	size_t off;
+	int first = 1, n;
+	uint8_t proto;
+
+	memset(key, 0, sizeof(*key));
+
+	if (len < 1)
+		return -1;
+
+	switch (pkt[0] >> 4) {
+	case 4:
+		if (len < 20 || (off = (pkt[0] & 0xf) * 4) < 20)
+			return -1;
+
+		key->fk_family = AF_INET;
+		memcpy(key->fk_src, pkt + 12, 4);
+		memcpy(key->fk_dst, pkt + 16, 4);
+		proto = pkt[9];
+		first = !(GET16(pkt + 6) & 0x1fff);
+		break;
+
+	case 6:
+		if (len < 40)
+			return -1;
+
+		key->fk_family = AF_INET6;
+		memcpy(key->fk_src, pkt + 8, 16);
+		memcpy(key->fk_dst, pkt + 24, 16);
+		proto = pkt[6];
+		off = 40;
+
+		/* skip extension headers, a few are enough in practice */
+		for (n = 0; n < 8 && off + 8 <= len; n++) {
+			const uint8_t *ext = pkt + off;
+
+			if (0 == proto || 43 == proto || 60 == proto)
+				off += (ext[1] + 1) * 8;
+			else if (44 == proto) {
+				first = !(GET16(ext + 2) & 0xfff8);
+				off += 8;
+			} else if (51 == proto)
+				off += (ext[1] + 2) * 4;
+			else
+				break;
+
+			proto = ext[0];
+		}
+		break;
+
+	default:
+		return -1;
+	}
+
+	key->fk_proto = proto;
+
+	if (first && has_ports(proto) && off + 4 <= len) {
+		key->fk_sport = GET16(pkt + off);
+		key->fk_dport = GET16(pkt + off + 2);
+	}
+
+	return 0;
+}
+
+int
+flow_parse(const uint8_t *pkt, size_t len, int link, struct flow_key *key)
+{
+	size_t off;
+	uint16_t type;
+
+	switch (link) {
+	case FLOW_LINK_RAW:
+		return flow_parse_ip(pkt, len, key);
+
+	case FLOW_LINK_NULL:
+		/* address family in host byte order of the capturing host */
+		return len < 4 ? -1 : flow_parse_ip(pkt + 4, len - 4, key);
+
+	case FLOW_LINK_SLL:
+		if (len < 16)
+			return -1;
+		off = 16;
+		type = GET16(pkt + 14);
+		break;
+
+	case FLOW_LINK_ETHER:
+		if (len < 14)
+			return -1;
+		off = 14;
+		type = GET16(pkt + 12);
+		while ((0x8100 == type || 0x88a8 == type) && off + 4 <= len) {
+			type = GET16(pkt + off + 2);
+			off += 4;
+		}
+		break;
+
+	default:
+		return -1;
+	}
+
+	if (0x0800 != type && 0x86dd != type)
+		return -1;
+
+	return flow_parse_ip(pkt + off, len - off, key);
+}
+
+/*
+ * Orders the endpoints so both directions map to the same key, returns
+ * 1 if the endpoints have been swapped.
+ */
+int
+flow_key_canon(struct flow_key *key)
+{
+	int cmp = memcmp(key->fk_src, key->fk_dst, sizeof(key->fk_src));
+	uint8_t addr[16];
+	uint16_t port;
+
+	if (cmp < 0 || (0 == cmp && key->fk_sport <= key->fk_dport))
+		return 0;
+
+	memcpy(addr, key->fk_src, sizeof(addr));
+	memcpy(key->fk_src, key->fk_dst, sizeof(addr));
+	memcpy(key->fk_dst, addr, sizeof(addr));
+
+	port = key->fk_sport;
+	key->fk_sport = key->fk_dport;
+	key->fk_dport = port;
+
+	return 1;
+}
+
+void
+flow_key_hosts(struct flow_key *key)
+{
+	key->fk_proto = 0;
+	key->fk_sport = 0;
+	key->fk_dport = 0;
+}
+
+static inline uint32_t
+flow_hash(struct flow_key *key)
+{
+	const uint8_t *p = (const uint8_t *) key;
+	uint32_t h = 2166136261U;
+	size_t n;
+
+	for (n = 0; n < sizeof(*key); n++)
+		h = (h ^ p[n]) * 16777619U;
+
+	return h ? h : 1;
+}
+
+static struct flow *
+flow_get(flow_table_t *ft, struct flow_key *key, uint32_t hash)
+{
+	size_t i, n, mask = ft->ft_size - 1;
+	struct flow *f, *victim = NULL;
+
+	for (i = hash & mask, n = 0; ; i = (i + 1) & mask, n++) {
+		f = &ft->ft_flows[i];
+
+		if (!f->f_hash)
+			break;
+
+		if (f->f_hash == hash && !memcmp(&f->f_key, key, sizeof(*key)))
+			return f;
+
+		if (n < FLOW_PROBE && (!victim || f->f_delta < victim->f_delta))
+			victim = f;
+	}
+
+	if (ft->ft_used < ft->ft_max)
+		ft->ft_used++;
+	else if (victim)
+		f = victim;
+	else
+		return NULL;
+
+	/*
+	 * The replaced flow is located before the first free slot on
+	 * the probe sequence of the new key, lookups still find it.
+	 */
+	if (f == victim)
+		ft->ft_evicted++;
+
+	memset(f, 0, sizeof(*f));
+	memcpy(&f->f_key, key, sizeof(*key));
+	f->f_hash = hash;
+
+	return f;
+}
+
+void
+flow_account(flow_table_t *ft, struct flow_key *key, int tx, b_cnt_t bytes,
+	     b_cnt_t packets)
+{
+	struct flow *f;
+
+	if (NULL == (f = flow_get(ft, key, flow_hash(key)))) {
+		ft->ft_evicted++;
+		return;
+	}
+
+	if (tx) {
+		f->f_tx_bytes += bytes;
+		f->f_tx_packets += packets;
+	} else {
+		f->f_rx_bytes += bytes;
+		f->f_rx_packets += packets;
+	}
+
+	f->f_delta += bytes;
+	f->f_seen = ft->ft_gen;
+}
+
+/*
+ * Returns the n flows with the most bytes since the previous call,
+ * ordered by bytes, and starts a new interval.
+ */
+int
+flow_top(flow_table_t *ft, struct flow **top, int n)
+{
+	size_t i;
+	int k, ntop = 0;
+
+	for (i = 0; i < ft->ft_size; i++) {
+		struct flow *f = &ft->ft_flows[i];
+
+		if (!f->f_hash || !f->f_delta)
+			continue;
+
+		if (ntop == n && f->f_delta <= top[ntop - 1]->f_delta)
+			continue;
+
+		if (ntop < n)
+			ntop++;
+
+		for (k = ntop - 1; k > 0 && top[k - 1]->f_delta < f->f_delta; k--)
+			top[k] = top[k - 1];
+		top[k] = f;
+	}
+
+	for (i = 0; i < ft->ft_size; i++)
+		ft->ft_flows[i].f_delta = 0;
+
+	ft->ft_gen++;
+
+	return ntop;
+}
+
+/*
+ * Drops flows not seen for more than idle intervals. The table is
+ * rebuilt into the spare array, this also gets rid of long probe
+ * sequences left behind by replaced flows.
+ */
+void
+flow_expire(flow_table_t *ft, uint32_t idle)
+{
+	struct flow *old = ft->ft_flows;
+	size_t i, mask = ft->ft_size - 1;
+
+	memset(ft->ft_spare, 0, ft->ft_size * sizeof(struct flow));
+	ft->ft_flows = ft->ft_spare;
+	ft->ft_spare = old;
+	ft->ft_used = 0;
+
+	for (i = 0; i < ft->ft_size; i++) {
+		size_t n;
+
+		if (!old[i].f_hash || ft->ft_gen - old[i].f_seen > idle)
+			continue;
+
+		for (n = old[i].f_hash & mask; ft->ft_flows[n].f_hash;
+		     n = (n + 1) & mask);
+
+		ft->ft_flows[n] = old[i];
+		ft->ft_used++;
+	}
+}
+
+void
+flow_name(struct flow *f, char *buf, size_t len)
+{
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+	struct flow_key *k = &f->f_key;
+
+	inet_ntop(k->fk_family, k->fk_src, src, sizeof(src));
+	inet_ntop(k->fk_family, k->fk_dst, dst, sizeof(dst));
+
+	if (!k->fk_sport && !k->fk_dport)
+		snprintf(buf, len, "%s-%s", src, dst);
+	else if (AF_INET6 == k->fk_family)
+		snprintf(buf, len, "[%s]:%u-[%s]:%u", src, k->fk_sport,
+			dst, k->fk_dport);
+	else
+		snprintf(buf, len, "%s:%u-%s:%u", src, k->fk_sport,
+			dst, k->fk_dport);
+}
+
+/*
+ * Flow counters are 64 bit and start over when a flow has been
+ * replaced by a new one of the same key. The rate of a counter
+ * which went backwards starts over too instead of being taken for
+ * an overflow.
+ */
+static void
+set_counter(rate_t *r, b_cnt_t value)
+{
+	if (value < r->r_total)
+		r->r_prev_total = 0;
+
+	r->r_total = value;
+	r->r_is64bit = 1;
+}
+
+void
+flow_update_intf(struct flow *f, intf_t *intf)
+{
+	set_counter(&intf->i_rx_bytes, f->f_rx_bytes);
+	set_counter(&intf->i_tx_bytes, f->f_tx_bytes);
+	set_counter(&intf->i_rx_packets, f->f_rx_packets);
+	set_counter(&intf->i_tx_packets, f->f_tx_packets);
+}
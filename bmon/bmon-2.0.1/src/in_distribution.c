@@ -24,6 +24,8 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE /* recvmmsg */
+
 #include <bmon/bmon.h>
 #include <bmon/input.h>
 #include <bmon/node.h>
@@ -36,23 +38,142 @@
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 
 #ifdef HAVE_SYS_SOCKIO_H
 #include <sys/sockio.h>
 #endif
 
+#if defined SYS_LINUX && defined HAVE_PTHREAD && defined SO_REUSEPORT
+#define RECV_THREADS
+#include <pthread.h>
+#endif
+
 static int recv_fd = -1;
 static char *c_port = "2048";
 static int c_port_int = 2048;
 static char *c_ip = NULL;
 static int c_ipv6 = 0;
-static int c_max_read = 10;
+static int c_max_read = 0;
 static int c_bufsize = 8192;
+static int c_batch = 16;
+static int c_rcvbuf = 0;
 static int c_debug = 0;
 static int c_multicast = 0;
 static int c_bind = 1;
 static char *c_iface = NULL;
-static char *buf;
+static char *c_stats = NULL;
+static int c_threads = 1;
+static int c_ring = 0;
+static char **c_drill;
+static int c_ndrill;
+static int c_tcp = 0;
+static char *c_unix = NULL;
+
+/*
+ * Every datagram of a batch gets its own buffer, address and control
+ * buffer, all allocated once on init.
+ */
+struct recv_slot
+{
+	struct sockaddr_storage	rs_addr;
+	struct iovec		rs_iov;
+	char			rs_ctl[CMSG_SPACE(sizeof(uint32_t)) +
+				       CMSG_SPACE(sizeof(struct timeval))];
+};
+
+/*
+ * A receive socket. With several receive threads, each one owns a
+ * socket of the SO_REUSEPORT group, the kernel hashes every sender to
+ * one of them. Datagrams are queued in a ring only written by the
+ * thread and only consumed by the main thread which keeps the node
+ * registry to itself.
+ */
+struct receiver
+{
+	int			r_fd;
+	char *			r_bufs;
+	struct recv_slot *	r_slots;
+#if defined SYS_LINUX
+	struct mmsghdr *	r_msgs;
+#endif
+	uint32_t		r_kernel_drops;
+
+	char *			r_ring;
+	size_t			r_ring_size;
+	size_t			r_head;		/* advanced by the thread */
+	size_t			r_tail;		/* advanced by the main thread */
+	b_cnt_t			r_ring_drops;
+#ifdef RECV_THREADS
+	pthread_t		r_thread;
+#endif
+};
+
+/* datagram queued in a ring, followed by its data */
+struct ring_entry
+{
+	uint32_t		re_size;	/* 0: continues at ring start */
+	uint32_t		re_len;
+	timestamp_t		re_recv;
+	struct sockaddr_storage	re_addr;
+};
+
+#define RING_ALIGN(x) (((x) + 7) & ~((size_t) 7))
+
+/* relays seen, drill-down requests are sent to all of them */
+struct relay
+{
+	struct sockaddr_storage	rl_addr;
+	socklen_t		rl_addrlen;
+	int			rl_age;
+};
+
+static struct relay *relays;
+static int nrelays;
+
+/* reads after which a silent relay is forgotten */
+#define RELAY_TIMEOUT 30
+
+static struct receiver *receivers;
+static int nreceivers;
+
+/*
+ * Senders connected over a stream, each with the frames received so
+ * far. A frame is processed once complete, the buffer holds the
+ * largest one possible.
+ */
+struct stream_conn
+{
+	int			sc_fd;
+	char			sc_from[INET6_ADDRSTRLEN];
+	char *			sc_buf;
+	size_t			sc_len;
+};
+
+#define STREAM_BUF (4 + 65535)
+
+static int listen_fd[2] = { -1, -1 };
+static struct stream_conn *conns;
+static int nconns;
+
+static b_cnt_t rx_datagrams, rx_bytes;
+static b_cnt_t stale_msgs, duplicate_msgs, loop_msgs;
+
+/* contents of the header options of a message */
+struct msg_info
+{
+	int		mi_has_frag;
+	uint32_t	mi_frag_seq;
+	int		mi_frag_index;
+	int		mi_has_seq;
+	uint32_t	mi_origin;
+	uint32_t	mi_seq;
+	uint32_t	mi_sender;
+	int		mi_relay;
+	timestamp_t	mi_recv;	/* time the datagram was received */
+	timestamp_t	mi_ts;		/* sampling time in local time */
+};
 
 static int
 join_multicast4(int fd, struct sockaddr_in *addr, const char *iface)
@@ -113,9 +234,91 @@ join_multicast(int fd, struct sockaddr *sa, const char *iface)
 	return -1;
 }
 
+static int
+new_socket(int family)
+{
+	int fd = socket(family, SOCK_DGRAM, 0);
+
+#ifdef RECV_THREADS
+	if (fd >= 0 && c_threads > 1) {
+		int on = 1;
+
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+			quit("Unable to set SO_REUSEPORT: %s\n", strerror(errno));
+	}
+#endif
+
+	return fd;
+}
+
+static void
+setup_socket(int fd)
+{
+	int flags, size;
+
+	/* receive threads block, the main thread must not */
+	if (c_threads <= 1) {
+		if ((flags = fcntl(fd, F_GETFL)) < 0)
+			quit("fcntl failed: %s\n", strerror(errno));
+
+		if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+			quit("fcntl failed: %s\n", strerror(errno));
+	}
+
+	/*
+	 * The socket is only drained once per read interval, the
+	 * queue must be able to hold everything received meanwhile.
+	 */
+	size = c_rcvbuf ? c_rcvbuf : 64 * c_bufsize;
+#ifdef SO_RCVBUFFORCE
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+		       sizeof(size)) < 0)
+#endif
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size,
+		       sizeof(size)) < 0 && c_debug)
+		fprintf(stderr, "Unable to set receive buffer size: %s\n",
+			strerror(errno));
+
+#ifdef SO_RXQ_OVFL
+	flags = 1;
+	setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &flags, sizeof(flags));
+#endif
+	flags = 1;
+	setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &flags, sizeof(flags));
+}
+
+static int
+stream_listen(struct sockaddr *sa, socklen_t len)
+{
+	int fd, one = 1;
+
+	if ((fd = socket(sa->sa_family, SOCK_STREAM, 0)) < 0)
+		quit("socket creation failed: %s\n", strerror(errno));
+
+	if (AF_UNIX != sa->sa_family)
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (bind(fd, sa, len) < 0 || listen(fd, 64) < 0)
+		quit("Unable to accept stream connections: %s\n", strerror(errno));
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	return fd;
+}
+
 static int
 distribution_probe(void)
 {
+#ifdef RECV_THREADS
+	/* multicast is delivered to every socket of the group */
+	if (c_threads > 1 && c_multicast) {
+		fprintf(stderr, "Multicast is received by a single thread\n");
+		c_threads = 1;
+	}
+#else
+	c_threads = 1;
+#endif
+
 	if (c_ip) {
 		int err;
 		char s[INET6_ADDRSTRLEN];
@@ -136,7 +339,7 @@ distribution_probe(void)
 				const char *x = xinet_ntop(t->ai_addr, s, sizeof(s));
 				fprintf(stderr, "Trying %s...", x ? x : "null");
 			}
-			recv_fd = socket(t->ai_family, t->ai_socktype, 0);
+			recv_fd = new_socket(t->ai_family);
 
 			if (recv_fd < 0) {
 				if (c_debug)
@@ -182,7 +385,7 @@ skip_bind:
 				.sin6_port = htons(c_port_int),
 			};
 
-			recv_fd = socket(AF_INET6, SOCK_DGRAM, 0);
+			recv_fd = new_socket(AF_INET6);
 
 			if (recv_fd < 0)
 				goto try_4;
@@ -193,7 +396,7 @@ skip_bind:
 			goto ok;
 		}
 try_4:
-		recv_fd = socket(AF_INET, SOCK_DGRAM, 0);
+		recv_fd = new_socket(AF_INET);
 
 		if (recv_fd < 0)
 			quit("socket creation failed: %s\n", strerror(errno));
@@ -217,23 +420,67 @@ try_4:
 	}
 
 ok:
-	{
-		int flags;
-		
-		if ((flags = fcntl(recv_fd, F_GETFL)) < 0)
-			quit("fcntl failed: %s\n", strerror(errno));
-		
-		if (fcntl(recv_fd, F_SETFL, flags | O_NONBLOCK) < 0)
-			quit("fcntl failed: %s\n", strerror(errno));
+	setup_socket(recv_fd);
+
+	if (c_tcp) {
+		struct sockaddr_in6 addr6 = {
+			.sin6_family = AF_INET6,
+			.sin6_addr = IN6ADDR_ANY_INIT,
+			.sin6_port = htons(c_port_int),
+		};
+		struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_port = htons(c_port_int),
+		};
+
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+		if (c_ipv6)
+			listen_fd[0] = stream_listen((struct sockaddr *) &addr6,
+						     sizeof(addr6));
+		else
+			listen_fd[0] = stream_listen((struct sockaddr *) &addr,
+						     sizeof(addr));
+	}
+
+	if (c_unix) {
+		struct sockaddr_un sun = {
+			.sun_family = AF_UNIX,
+		};
+		struct stat st;
+
+		if (strlen(c_unix) >= sizeof(sun.sun_path))
+			quit("Path of unix socket too long: %s\n", c_unix);
+
+		strcpy(sun.sun_path, c_unix);
+
+		/* only replace a stale socket, never an arbitrary file */
+		if (lstat(c_unix, &st) == 0) {
+			if (!S_ISSOCK(st.st_mode))
+				quit("%s exists and is not a socket\n", c_unix);
+			unlink(c_unix);
+		}
 
+		listen_fd[1] = stream_listen((struct sockaddr *) &sun, sizeof(sun));
 	}
 
 	return 1;
 }
 
+/* the address of a sender rarely changes, it is only copied if it does */
+static void
+set_from(node_t *node, const char *from)
+{
+	if (node->n_from && !strcmp(node->n_from, from))
+		return;
+
+	xfree(node->n_from);
+	node->n_from = strdup(from);
+}
+
 static int
-process_intf(struct distr_msg_hdr *hdr, const char *nodename,
-	struct distr_msg_intf *intf, char *from)
+process_intf(struct distr_msg_hdr *hdr, node_t *remote_node,
+	struct distr_msg_intf *intf, char *from, timestamp_t *ts)
 {
 	char *intfname;
 	int remaining, offset;
@@ -242,7 +489,6 @@ process_intf(struct distr_msg_hdr *hdr, const char *nodename,
 	int parent = 0, level = 0, link = 0, index = 0;
 
 	intf_t *local_intf;
-	node_t *remote_node;
 
 	intfname = ((char *) intf) + sizeof(*intf);
 
@@ -316,19 +562,7 @@ process_intf(struct distr_msg_hdr *hdr, const char *nodename,
 				fprintf(stderr, "Leftover from options: %d\n", abs(remaining));
 	}
 
-	remote_node = lookup_node(nodename, 1);
-
-	if (NULL == remote_node) {
-		if (c_debug)
-			fprintf(stderr, "Could not create node entry for remote node\n");
-		return -1;
-	}
-
-	if (remote_node->n_from)
-		xfree((void *) remote_node->n_from);
-	remote_node->n_from = strdup(from);
-
-	local_intf = lookup_intf(remote_node, intfname, handle, parent);
+	local_intf = lookup_intf_sample(remote_node, intfname, handle, parent);
 
 	if (NULL == local_intf) {
 		if (c_debug)
@@ -362,7 +596,8 @@ process_intf(struct distr_msg_hdr *hdr, const char *nodename,
 			local_intf->i_tx_packets.r_overflows = attr->a_tx_overflows;
 		} else {
 			int flags = (attr->a_flags & ATTR_RX_PROVIDED ? RX_PROVIDED : 0) |
-				(attr->a_flags & ATTR_TX_PROVIDED ? TX_PROVIDED : 0);
+				(attr->a_flags & ATTR_TX_PROVIDED ? TX_PROVIDED : 0) |
+				(attr->a_flags & ATTR_RATE_PROVIDED ? RATE_PROVIDED : 0);
 
 			update_attr(local_intf, attr->a_type, attr->a_rx, attr->a_tx,
 				flags);
@@ -378,7 +613,7 @@ skip:
 	local_intf->i_level = level;
 	local_intf->i_link = link;
 
-	notify_update(local_intf);
+	notify_update_ts(local_intf, ts);
 	increase_lifetime(local_intf, 1);
 
 	if (remaining < 0)
@@ -388,198 +623,1352 @@ skip:
 	return 0;
 }
 
-static void
-process_group(struct distr_msg_hdr *hdr, const char *nodename,
-	struct distr_msg_grp *grp, char *from)
+/*
+ * Version 2 state of a remote interface: its identity and the base
+ * values of the current generation, one per attribute in ri_attrs in
+ * ascending order. Kept per node and interface index of the sender.
+ */
+struct remote_attr
 {
-	int remaining, offset;
-	int grpoffset;
-	
-	if (c_debug)
-		fprintf(stderr, "Processing group (type:%d offset:%d)\n",
-			ntohs(grp->g_type), ntohs(grp->g_offset));
+	b_cnt_t		ra_base[2];
+	int		ra_flags;
+};
 
-	if (ntohs(grp->g_type) != BMON_GRP_IF) {
-		if (c_debug)
-			fprintf(stderr, "Discarding malformed packet (invalid group type)\n");
-		return;
-	}
+struct remote_intf
+{
+	int			ri_valid;
+	uint8_t			ri_gen;
+	uint32_t		ri_sender;
+	char			ri_name[IFNAME_MAX];
+	uint32_t		ri_handle;
+	int			ri_parent;
+	int			ri_link;
+	int			ri_level;
+	uint64_t		ri_attrs;
+	struct remote_attr *	ri_base;
+	int			ri_local;	/* local index + 1, 0 if none */
+};
 
-	grpoffset = ntohs(grp->g_offset);
+/*
+ * Clock of a sender relative to ours. Offsets are local minus sender
+ * time, the lowest offset seen is the one of a message that was not
+ * queued anywhere. Drift is estimated from the minimum offsets of
+ * successive windows.
+ */
+struct sender_clock
+{
+	int		c_valid;
+	double		c_offset;	/* offset at sender time c_ref */
+	double		c_ref;
+	double		c_drift;	/* seconds gained per sender second */
+	double		c_win_start;
+	double		c_win_min;
+	double		c_win_ref;
+	int		c_have_prev;
+	double		c_prev_min;
+	double		c_prev_ref;
+};
 
-	if (grpoffset < sizeof(*grp) || grpoffset > ntohs(hdr->h_len)) {
-		if (c_debug)
-			fprintf(stderr, "Discarding malformed packet (invalid group offset)\n");
-		return;
-	}
+struct sender
+{
+	uint32_t		s_serial;	/* node the state belongs to */
+	int			s_alive;
+	struct remote_intf *	s_intf;
+	int			s_nintf;
+	int			s_seen;
+	uint64_t		s_frags;
+	struct sender_clock	s_clock;
+};
 
-	offset = sizeof(*grp);
-	remaining = grpoffset - offset;
+static struct sender *senders;
+static int nsenders;
 
-	while (remaining > 0) {
-		struct distr_msg_intf *intf = (struct distr_msg_intf *) (((char *) grp) + offset);
-		int ioff = ntohs(intf->i_offset);
+/* bounds the memory a bogus index can make us allocate */
+#define REMOTE_INTF_MAX 65536
 
-		if (ioff < (sizeof(*intf) + 4) || ioff > ntohs(hdr->h_len)) {
-			if (c_debug)
-				fprintf(stderr, "Discarding malformed packet (interface offset too short)\n");
-			return;
-		}
+static void
+free_sender(struct sender *s)
+{
+	int i;
 
-		if (ioff > remaining) {
-			if (c_debug)
-				fprintf(stderr, "Discarding malformed packet (unexpected group end)\n");
-			return;
-		}
+	for (i = 0; i < s->s_nintf; i++)
+		xfree(s->s_intf[i].ri_base);
+	xfree(s->s_intf);
+	memset(s, 0, sizeof(*s));
+}
 
-		if (process_intf(hdr, nodename, intf, from) < 0)
-			return;
+/*
+ * Sender state is indexed like the node list, a slot taken over by
+ * another node starts over.
+ */
+static struct sender *
+get_sender(node_t *node)
+{
+	struct sender *s;
 
-		remaining -= ioff;
-		offset += ioff;
+	if (node->n_index >= nsenders) {
+		int n = node->n_index + 1;
+
+		senders = xrealloc(senders, n * sizeof(struct sender));
+		memset(senders + nsenders, 0, (n - nsenders) * sizeof(struct sender));
+		nsenders = n;
 	}
 
-	if (remaining < 0)
-		if (c_debug)
-			fprintf(stderr, "Leftover from group: %d\n", abs(remaining));
+	s = &senders[node->n_index];
+	if (s->s_serial != node->n_serial) {
+		free_sender(s);
+		s->s_serial = node->n_serial;
+	}
+
+	return s;
 }
 
+static void
+mark_sender(node_t *node, void *arg)
+{
+	if (node->n_index < nsenders &&
+	    senders[node->n_index].s_serial == node->n_serial)
+		senders[node->n_index].s_alive = 1;
+}
 
+/* returns the interface tables of nodes which have been removed */
 static void
-process_msg(struct distr_msg_hdr *hdr, char *from)
+release_senders(void)
 {
-	char *nodename;
-	struct distr_msg_grp *group;
-	
-	if (c_debug)
-		fprintf(stderr, "Processing message from %s (len=%d)\n",
-			from, ntohs(hdr->h_len));
+	int i;
 
-	nodename = ((char *) hdr) + sizeof(*hdr);
-	group = (struct distr_msg_grp *) (((char *) hdr) + hdr->h_offset);
+	for (i = 0; i < nsenders; i++)
+		senders[i].s_alive = 0;
 
-	if ('\0' == *nodename) {
-		if (c_debug)
-			fprintf(stderr, "Discarding malformed packet (empty nodename)\n");
-		return;
+	foreach_node(mark_sender, NULL);
+
+	for (i = 0; i < nsenders; i++)
+		if (senders[i].s_serial && !senders[i].s_alive)
+			free_sender(&senders[i]);
+}
+
+static struct remote_intf *
+get_remote_intf(node_t *node, uint64_t index)
+{
+	struct sender *s;
+
+	if (index >= REMOTE_INTF_MAX)
+		return NULL;
+
+	s = get_sender(node);
+
+	if (index >= s->s_nintf) {
+		int n = s->s_nintf ? s->s_nintf : 16;
+
+		while (n <= index)
+			n *= 2;
+
+		s->s_intf = xrealloc(s->s_intf, n * sizeof(struct remote_intf));
+		memset(s->s_intf + s->s_nintf, 0,
+			(n - s->s_nintf) * sizeof(struct remote_intf));
+		s->s_nintf = n;
 	}
-		
 
-	process_group(hdr, nodename, group, from);
+	return &s->s_intf[index];
+}
+
+/* offset change considered a clock step rather than queueing */
+#define CLOCK_STEP	2.0
+/* length of a minimum filter window in seconds */
+#define CLOCK_WINDOW	30.0
+/* larger drifts are bogus, NTP gives up at 500ppm */
+#define CLOCK_DRIFT_MAX	0.0005
+/* speed at which the offset follows a constantly higher delay */
+#define CLOCK_CREEP	1024
+
+static inline double
+ts_to_double(timestamp_t *ts)
+{
+	return (double) ts->tv_sec + (double) ts->tv_usec / 1000000.0;
 }
 
 static void
-process_data(char *buf, int len, char *from)
+clock_reset(struct sender_clock *c, double sent, double offset)
 {
-	struct distr_msg_hdr *hdr = (struct distr_msg_hdr *) buf;
+	memset(c, 0, sizeof(*c));
+	c->c_valid = 1;
+	c->c_offset = c->c_win_min = offset;
+	c->c_ref = c->c_win_start = c->c_win_ref = sent;
+}
 
-	if (len < sizeof(*hdr)) {
-		if (c_debug)
-			fprintf(stderr, "Discarding malformed packet (hdrcheck)\n");
-		return;
+static void
+clock_update_drift(struct sender_clock *c, double sent, double offset)
+{
+	if (offset < c->c_win_min) {
+		c->c_win_min = offset;
+		c->c_win_ref = sent;
 	}
 
-	if (hdr->h_magic != BMON_MAGIC) {
-		if (c_debug)
-			fprintf(stderr, "Discarding malformed packet (magic mismatch)\n");
+	if (sent - c->c_win_start < CLOCK_WINDOW)
 		return;
-	}
 
-	if (hdr->h_ver != BMON_VERSION) {
-		if (c_debug)
-			fprintf(stderr, "Discarding incompatible packet (version mismatch)\n");
-		return;
-	}
+	if (c->c_have_prev && c->c_win_ref - c->c_prev_ref >= CLOCK_WINDOW / 2) {
+		double slope = (c->c_win_min - c->c_prev_min) /
+			       (c->c_win_ref - c->c_prev_ref);
 
-	if (ntohs(hdr->h_len) < len) {
-		if (c_debug)
-			fprintf(stderr, "Discarding malformed packet (packet size mismatch)\n");
-		return;
-	}
+		if (slope > CLOCK_DRIFT_MAX)
+			slope = CLOCK_DRIFT_MAX;
+		else if (slope < -CLOCK_DRIFT_MAX)
+			slope = -CLOCK_DRIFT_MAX;
 
-	if (hdr->h_offset < (sizeof(*hdr) + 4)) {
-		if (c_debug)
-			fprintf(stderr, "Discarding malformed packet (offset too short)\n");
-		return;
+		c->c_drift += (slope - c->c_drift) / 4;
 	}
 
-	process_msg(hdr, from);
+	c->c_have_prev = 1;
+	c->c_prev_min = c->c_win_min;
+	c->c_prev_ref = c->c_win_ref;
+	c->c_win_start = c->c_win_ref = sent;
+	c->c_win_min = offset;
 }
 
+/*
+ * Maps the sampling time of a message to local time so rates and
+ * history reflect when the sender read its counters rather than when
+ * the datagram happened to be processed here.
+ */
 static void
-distribution_read(void)
+sender_time(node_t *node, struct distr_msg_hdr *hdr, struct msg_info *mi)
 {
-	int i, n;
-	struct sockaddr_in6 addr;
-	socklen_t len = sizeof(addr);
-	char addrstr[INET6_ADDRSTRLEN];
-
-	memset(&addr, 0, sizeof(addr));
-	memset(buf, 0, c_bufsize);
+	struct sender_clock *c = &get_sender(node)->s_clock;
+	double sent, offset, expect;
 
-	for (i = 0; i < c_max_read; i++) {
-		n = recvfrom(recv_fd, buf, c_bufsize, 0,
-			(struct sockaddr *) &addr, &len);
+	if (0 == hdr->h_ts_sec) {
+		mi->mi_ts = mi->mi_recv;
+		return;
+	}
 
-		if (n < 0) {
-			if (EAGAIN == errno)
-				return;
-			else
-				quit("recvfrom failed: %s\n", strerror(errno));
-		}
+	sent = (double) ntohl(hdr->h_ts_sec) +
+	       (double) ntohl(hdr->h_ts_usec) / 1000000.0;
+	offset = ts_to_double(&mi->mi_recv) - sent;
+	expect = c->c_offset + c->c_drift * (sent - c->c_ref);
+
+	if (!c->c_valid || offset - expect > CLOCK_STEP ||
+	    expect - offset > CLOCK_STEP) {
+		if (c_debug && c->c_valid)
+			fprintf(stderr, "Clock of %s stepped by %.3fs\n",
+				node->n_name, offset - expect);
+		clock_reset(c, sent, offset);
+		expect = offset;
+	}
 
-		if (addr.sin6_family == AF_INET) {
-			struct sockaddr_in *in4 = (struct sockaddr_in *) &addr;
-			inet_ntop(AF_INET, (void *) &in4->sin_addr,
-				addrstr, len);
-		} else if (addr.sin6_family == AF_INET6) {
-			inet_ntop(AF_INET6, (void *) &addr.sin6_addr,
-				addrstr, len);
-		}
+	/* never later than observed, slowly give in to longer delays */
+	if (offset < expect)
+		expect = offset;
+	else
+		expect += (offset - expect) / CLOCK_CREEP;
 
-		if (c_debug)
-			fprintf(stderr, "Read %d bytes from %s\n", n, addrstr);
+	c->c_offset = expect;
+	c->c_ref = sent;
+	clock_update_drift(c, sent, offset);
 
-		process_data(buf, n, addrstr);
-	}
+	sent += expect;
+	mi->mi_ts.tv_sec = (time_t) sent;
+	mi->mi_ts.tv_usec = (sent - (double) mi->mi_ts.tv_sec) * 1000000.0;
 }
 
-static void
-distribution_init(void)
+/*
+ * Parent and link of children are interface indices of the sender,
+ * the local interfaces may well have other ones.
+ */
+static int
+local_index(node_t *node, uint64_t index)
 {
-	buf = xcalloc(1, c_bufsize);
+	struct sender *s = get_sender(node);
+	struct remote_intf *ri;
+	intf_t *i;
+
+	if (index >= s->s_nintf)
+		return -1;
+
+	ri = &s->s_intf[index];
+	if (!ri->ri_valid || !ri->ri_local ||
+	    !(i = get_intf(node, ri->ri_local - 1)) ||
+	    strcmp(i->i_name, ri->ri_name))
+		return -1;
+
+	return ri->ri_local - 1;
 }
 
-static void
-print_help(void)
+static inline int
+attr_flags(int flags)
 {
-	printf(
-		"Distribution - Collects statistics from other nodes\n" \
-		"\n" \
-		"  Collects statistics from other nodes using the distribution\n" \
-		"  secondary output method (-O distribution).\n" \
-		"\n" \
-		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
-		"\n" \
-		"  Options:\n" \
-		"    ip=ADDR            Only process messages from this address (default: none)\n" \
-		"    port=NUM           Port the messages are comming from (default: 2048)\n" \
-		"    ipv6               Prefer IPv6 when creating sockets\n" \
-		"    multicast[=ADDR]   Use multicast to collect statistics\n" \
-		"    intf=NAME          Bind multicast socket to given interface\n" \
-		"    nobind             Don't bind, receive multicast and unicast messages\n" \
-		"    max_read=NUM       Max. reads during one read interval (default: 10)\n" \
-		"    bufsize=NUM        Size of receive buffer (default: 8192)\n" \
-		"    debug              Print verbose message for debugging\n" \
-		"    help               Print this help text\n");
+	return (flags & ATTR_RX_PROVIDED ? RX_PROVIDED : 0) |
+		(flags & ATTR_TX_PROVIDED ? TX_PROVIDED : 0) |
+		(flags & ATTR_RATE_PROVIDED ? RATE_PROVIDED : 0);
 }
 
-static void
-distribution_set_opts(tv_t *attrs)
+static int
+parse_base2(struct remote_intf *ri, const uint8_t **pp, const uint8_t *end)
 {
-	while (attrs) {
-		if (!strcasecmp(attrs->type, "port") && attrs->value) {
-			c_port = attrs->value;
+	const uint8_t *p = *pp;
+	uint64_t v[4], bitmap;
+	int i, n, namelen;
+
+	/* invalid until completely parsed */
+	ri->ri_valid = 0;
+
+	if (p >= end || (namelen = *p++) == 0 || namelen >= IFNAME_MAX ||
+	    end - p < namelen || memchr(p, '\0', namelen))
+		return -1;
+
+	memcpy(ri->ri_name, p, namelen);
+	ri->ri_name[namelen] = '\0';
+	p += namelen;
+
+	for (i = 0; i < 4; i++)
+		if (varint_get(&p, end, &v[i]) < 0)
+			return -1;
+
+	ri->ri_handle = v[0];
+	ri->ri_parent = v[1];
+	ri->ri_link = v[2];
+	ri->ri_level = v[3];
+
+	if (varint_get(&p, end, &bitmap) < 0)
+		return -1;
+
+	n = __builtin_popcountll(bitmap);
+	ri->ri_base = xrealloc(ri->ri_base, (n ? n : 1) * sizeof(struct remote_attr));
+	ri->ri_attrs = bitmap;
+
+	for (i = 0; i < n; i++) {
+		struct remote_attr *ra = &ri->ri_base[i];
+
+		if (p >= end)
+			return -1;
+
+		ra->ra_flags = *p++;
+
+		if (varint_get(&p, end, &ra->ra_base[0]) < 0 ||
+		    varint_get(&p, end, &ra->ra_base[1]) < 0)
+			return -1;
+	}
+
+	ri->ri_valid = 1;
+	*pp = p;
+
+	return 0;
+}
+
+static int
+process_intf2(node_t *node, const uint8_t **pp, const uint8_t *end,
+	      struct msg_info *mi)
+{
+	const uint8_t *p = *pp;
+	int64_t delta[64][2];
+	struct remote_intf *ri;
+	uint64_t index, bitmap;
+	intf_t *local_intf;
+	int i, k, flags, gen, parent, link;
+
+	if (varint_get(&p, end, &index) < 0 || end - p < 2)
+		return -1;
+
+	flags = *p++;
+	gen = *p++;
+
+	if (!(ri = get_remote_intf(node, index))) {
+		if (c_debug)
+			fprintf(stderr, "Discarding malformed packet (invalid index)\n");
+		return -1;
+	}
+
+	if (flags & IF2_BASE) {
+		if (parse_base2(ri, &p, end) < 0)
+			goto malformed;
+
+		ri->ri_gen = gen;
+		ri->ri_sender = mi->mi_sender;
+		bitmap = ri->ri_attrs;
+		memset(delta, 0, sizeof(delta));
+	} else {
+		if (varint_get(&p, end, &bitmap) < 0)
+			goto malformed;
+
+		for (i = 0; i < 64; i++) {
+			uint64_t rx, tx;
+
+			if (!(bitmap & (1ULL << i)))
+				continue;
+
+			if (varint_get(&p, end, &rx) < 0 ||
+			    varint_get(&p, end, &tx) < 0)
+				goto malformed;
+
+			delta[i][0] = zigzag_decode(rx);
+			delta[i][1] = zigzag_decode(tx);
+		}
+	}
+
+	*pp = p;
+
+	/*
+	 * The base of this generation was lost or the node is received via
+	 * several paths and the base belongs to another sender, wait for
+	 * the next one.
+	 */
+	if (!ri->ri_valid || ri->ri_gen != gen || ri->ri_sender != mi->mi_sender ||
+	    (bitmap & ~ri->ri_attrs)) {
+		if (c_debug)
+			fprintf(stderr, "Ignoring interface %llu (no base for " \
+				"generation %d)\n", (unsigned long long) index, gen);
+		return 0;
+	}
+
+	parent = ri->ri_parent;
+	link = ri->ri_link;
+
+	if (flags & IF2_CHILD) {
+		/* wait for the parent to be known */
+		if ((parent = local_index(node, ri->ri_parent)) < 0)
+			return 0;
+
+		if ((link = local_index(node, ri->ri_link)) < 0)
+			link = parent;
+	}
+
+	if (!(local_intf = lookup_intf_sample(node, ri->ri_name, ri->ri_handle,
+					      parent)))
+		return 0;
+
+	ri->ri_local = local_intf->i_index + 1;
+
+	for (i = 0, k = 0; i < 64; i++) {
+		struct remote_attr *ra;
+		b_cnt_t rx, tx;
+
+		if (!(ri->ri_attrs & (1ULL << i)))
+			continue;
+
+		ra = &ri->ri_base[k++];
+
+		if (!(bitmap & (1ULL << i)))
+			continue;
+
+		rx = ra->ra_base[0] + delta[i][0];
+		tx = ra->ra_base[1] + delta[i][1];
+
+		if (BYTES == i) {
+			local_intf->i_rx_bytes.r_total = rx;
+			local_intf->i_tx_bytes.r_total = tx;
+			local_intf->i_rx_bytes.r_is64bit = 1;
+			local_intf->i_tx_bytes.r_is64bit = 1;
+		} else if (PACKETS == i) {
+			local_intf->i_rx_packets.r_total = rx;
+			local_intf->i_tx_packets.r_total = tx;
+			local_intf->i_rx_packets.r_is64bit = 1;
+			local_intf->i_tx_packets.r_is64bit = 1;
+		} else if (i < __ATTR_MAX)
+			update_attr(local_intf, i, rx, tx, attr_flags(ra->ra_flags));
+	}
+
+	if (flags & IF2_CHILD)
+		local_intf->i_is_child = 1;
+	local_intf->i_level = ri->ri_level;
+	local_intf->i_link = link;
+
+	notify_update_ts(local_intf, &mi->mi_ts);
+	increase_lifetime(local_intf, 1);
+
+	return 0;
+
+malformed:
+	if (c_debug)
+		fprintf(stderr, "Discarding malformed packet (truncated interface)\n");
+	return -1;
+}
+
+/*
+ * Version 2 records are self delimiting, interfaces not accepted by
+ * the local policy are skipped without affecting the others.
+ */
+static void
+process_group2(struct distr_msg_hdr *hdr, node_t *remote_node,
+	struct distr_msg_grp *grp, char *from, struct msg_info *mi)
+{
+	const uint8_t *p, *end;
+
+	if (ntohs(grp->g_type) != BMON_GRP_IF ||
+	    ntohs(grp->g_offset) < sizeof(*grp) ||
+	    ((char *) grp - (char *) hdr) + ntohs(grp->g_offset) > ntohs(hdr->h_len)) {
+		if (c_debug)
+			fprintf(stderr, "Discarding malformed packet (invalid group)\n");
+		return;
+	}
+
+	set_from(remote_node, from);
+
+	p = (const uint8_t *) grp + sizeof(*grp);
+	end = (const uint8_t *) grp + ntohs(grp->g_offset);
+
+	while (p < end)
+		if (process_intf2(remote_node, &p, end, mi) < 0)
+			return;
+}
+
+static void
+process_group(struct distr_msg_hdr *hdr, node_t *remote_node,
+	struct distr_msg_grp *grp, char *from, timestamp_t *ts)
+{
+	int remaining, offset;
+	int grpoffset;
+	
+	if (c_debug)
+		fprintf(stderr, "Processing group (type:%d offset:%d)\n",
+			ntohs(grp->g_type), ntohs(grp->g_offset));
+
+	if (ntohs(grp->g_type) != BMON_GRP_IF) {
+		if (c_debug)
+			fprintf(stderr, "Discarding malformed packet (invalid group type)\n");
+		return;
+	}
+
+	grpoffset = ntohs(grp->g_offset);
+
+	if (grpoffset < sizeof(*grp) || grpoffset > ntohs(hdr->h_len)) {
+		if (c_debug)
+			fprintf(stderr, "Discarding malformed packet (invalid group offset)\n");
+		return;
+	}
+
+	set_from(remote_node, from);
+
+	offset = sizeof(*grp);
+	remaining = grpoffset - offset;
+
+	while (remaining > 0) {
+		struct distr_msg_intf *intf = (struct distr_msg_intf *) (((char *) grp) + offset);
+		int ioff = ntohs(intf->i_offset);
+
+		if (ioff < (sizeof(*intf) + 4) || ioff > ntohs(hdr->h_len)) {
+			if (c_debug)
+				fprintf(stderr, "Discarding malformed packet (interface offset too short)\n");
+			return;
+		}
+
+		if (ioff > remaining) {
+			if (c_debug)
+				fprintf(stderr, "Discarding malformed packet (unexpected group end)\n");
+			return;
+		}
+
+		if (process_intf(hdr, remote_node, intf, from, ts) < 0)
+			return;
+
+		remaining -= ioff;
+		offset += ioff;
+	}
+
+	if (remaining < 0)
+		if (c_debug)
+			fprintf(stderr, "Leftover from group: %d\n", abs(remaining));
+}
+
+
+/*
+ * Header options follow the padded node name up to the offset of
+ * the first group. Fragments carry complete interfaces and are
+ * applied as they arrive.
+ */
+static int
+process_hdropts(struct distr_msg_hdr *hdr, const char *nodename,
+		struct msg_info *mi)
+{
+	int off = sizeof(*hdr) + ((strlen(nodename) + 5) & ~3);
+
+	while (off + sizeof(struct distr_msg_hdropt) <= hdr->h_offset) {
+		struct distr_msg_hdropt *op;
+
+		op = (struct distr_msg_hdropt *) (((char *) hdr) + off);
+		off += sizeof(*op) + op->ho_len;
+
+		if (off > hdr->h_offset) {
+			if (c_debug)
+				fprintf(stderr, "Discarding malformed packet " \
+					"(invalid header opt len)\n");
+			return -1;
+		}
+
+		switch (op->ho_type) {
+			case HDROPT_FRAG: {
+				struct distr_msg_frag *frag;
+
+				if (op->ho_len != sizeof(*frag)) {
+					if (c_debug)
+						fprintf(stderr, "Discarding malformed packet " \
+							"(invalid opt len for fragment)\n");
+					return -1;
+				}
+
+				frag = (struct distr_msg_frag *) (op + 1);
+				mi->mi_has_frag = 1;
+				mi->mi_frag_seq = ntohl(frag->f_seq);
+				mi->mi_frag_index = ntohs(frag->f_index);
+
+				if (c_debug)
+					fprintf(stderr, "Fragment %u of message %u%s\n",
+						ntohs(frag->f_index), ntohl(frag->f_seq),
+						ntohs(frag->f_flags) & FRAG_LAST ? " (last)" : "");
+				break;
+			}
+
+			case HDROPT_SEQ: {
+				struct distr_msg_seq *seq;
+
+				if (op->ho_len != sizeof(*seq)) {
+					if (c_debug)
+						fprintf(stderr, "Discarding malformed packet " \
+							"(invalid opt len for sequence)\n");
+					return -1;
+				}
+
+				seq = (struct distr_msg_seq *) (op + 1);
+				mi->mi_has_seq = 1;
+				mi->mi_origin = ntohl(seq->s_origin);
+				mi->mi_seq = ntohl(seq->s_seq);
+				mi->mi_sender = ntohl(seq->s_sender);
+				break;
+			}
+
+			case HDROPT_RELAY:
+				mi->mi_relay = 1;
+				break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Late, duplicated (multiple paths) and looped messages must not reach
+ * the rate estimator. Sequences of the same origin only move forward,
+ * fragments of the current sample are accepted once per index. A new
+ * origin, e.g. a restarted sender, starts over.
+ */
+static int
+check_sequence(node_t *node, struct msg_info *mi)
+{
+	uint32_t self = get_local_origin();
+	struct sender *s;
+	uint64_t frag = 0;
+
+	if (!mi->mi_has_seq)
+		return 0;
+
+	if (mi->mi_origin == self || mi->mi_sender == self) {
+		if (c_debug)
+			fprintf(stderr, "Discarding looped message\n");
+		loop_msgs++;
+		return -1;
+	}
+
+	s = get_sender(node);
+
+	if (mi->mi_has_frag && mi->mi_frag_index < 64)
+		frag = 1ULL << mi->mi_frag_index;
+
+	if (s->s_seen && node->n_origin == mi->mi_origin) {
+		int32_t diff = mi->mi_seq - node->n_seq;
+
+		if (diff < 0) {
+			if (c_debug)
+				fprintf(stderr, "Discarding stale message (seq %u, " \
+					"last %u)\n", mi->mi_seq, node->n_seq);
+			stale_msgs++;
+			return -1;
+		}
+
+		if (0 == diff && (s->s_frags & frag)) {
+			if (c_debug)
+				fprintf(stderr, "Discarding duplicate message " \
+					"(seq %u)\n", mi->mi_seq);
+			duplicate_msgs++;
+			return -1;
+		}
+
+		if (diff > 0)
+			s->s_frags = 0;
+	} else
+		s->s_frags = 0;
+
+	s->s_seen = 1;
+	s->s_frags |= frag;
+	node->n_origin = mi->mi_origin;
+	node->n_seq = mi->mi_seq;
+
+	return 0;
+}
+
+static void
+note_relay(struct sockaddr *sa)
+{
+	socklen_t len = AF_INET6 == sa->sa_family ?
+		sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+	int i;
+
+	for (i = 0; i < nrelays; i++)
+		if (relays[i].rl_addrlen == len &&
+		    !memcmp(&relays[i].rl_addr, sa, len))
+			break;
+
+	if (i == nrelays) {
+		relays = xrealloc(relays, ++nrelays * sizeof(struct relay));
+		memset(&relays[i], 0, sizeof(struct relay));
+		memcpy(&relays[i].rl_addr, sa, len);
+		relays[i].rl_addrlen = len;
+	}
+
+	relays[i].rl_age = 0;
+}
+
+/*
+ * Asks every relay for the nodes to drill down to, the relay ignores
+ * nodes it does not know. Repeated every read to keep them coming.
+ */
+static void
+send_drill_requests(void)
+{
+	char buf[512];
+	int i, n;
+
+	for (i = 0; i < nrelays; ) {
+		if (++relays[i].rl_age > RELAY_TIMEOUT) {
+			relays[i] = relays[--nrelays];
+			continue;
+		}
+		i++;
+	}
+
+	for (n = 0; n < c_ndrill; n++) {
+		struct distr_msg_hdr *hdr = (struct distr_msg_hdr *) buf;
+		struct distr_msg_hdropt *op;
+		struct distr_msg_grp *grp;
+		size_t namelen = strlen(c_drill[n]);
+		size_t off = sizeof(*hdr) + ((namelen + 5) & ~3);
+
+		if (off + sizeof(*op) + sizeof(*grp) > sizeof(buf))
+			continue;
+
+		memset(buf, 0, sizeof(buf));
+		hdr->h_magic = BMON_MAGIC;
+		hdr->h_ver = BMON_VERSION;
+		memcpy(buf + sizeof(*hdr), c_drill[n], namelen);
+
+		op = (struct distr_msg_hdropt *) (buf + off);
+		op->ho_type = HDROPT_DRILL;
+		off += sizeof(*op);
+		hdr->h_offset = off;
+
+		grp = (struct distr_msg_grp *) (buf + off);
+		grp->g_type = htons(BMON_GRP_IF);
+		grp->g_offset = htons(sizeof(*grp));
+		off += sizeof(*grp);
+		hdr->h_len = htons(off);
+
+		for (i = 0; i < nrelays; i++)
+			if (sendto(recv_fd, buf, off, 0,
+				   (struct sockaddr *) &relays[i].rl_addr,
+				   relays[i].rl_addrlen) < 0 && c_debug)
+				fprintf(stderr, "Unable to send drill-down " \
+					"request: %s\n", strerror(errno));
+	}
+}
+
+static void
+process_msg(struct distr_msg_hdr *hdr, char *from, struct sockaddr *sa,
+	    timestamp_t *recv)
+{
+	char *nodename;
+	struct distr_msg_grp *group;
+	struct msg_info mi;
+	node_t *node;
+	
+	if (c_debug)
+		fprintf(stderr, "Processing message from %s (len=%d)\n",
+			from, ntohs(hdr->h_len));
+
+	nodename = ((char *) hdr) + sizeof(*hdr);
+	group = (struct distr_msg_grp *) (((char *) hdr) + hdr->h_offset);
+
+	if ('\0' == *nodename) {
+		if (c_debug)
+			fprintf(stderr, "Discarding malformed packet (empty nodename)\n");
+		return;
+	}
+
+	if (!memchr(nodename, '\0', hdr->h_offset - sizeof(*hdr))) {
+		if (c_debug)
+			fprintf(stderr, "Discarding malformed packet (unterminated nodename)\n");
+		return;
+	}
+
+	memset(&mi, 0, sizeof(mi));
+	mi.mi_recv = *recv;
+	if (process_hdropts(hdr, nodename, &mi) < 0)
+		return;
+
+	if (!(node = lookup_node(nodename, 1)) || check_sequence(node, &mi) < 0)
+		return;
+
+	if (mi.mi_relay && c_ndrill && sa)
+		note_relay(sa);
+
+	sender_time(node, hdr, &mi);
+	/* passed on as sampling time when forwarded */
+	node->n_sampled = mi.mi_ts;
+
+	if (BMON_VERSION_1 == hdr->h_ver)
+		process_group(hdr, node, group, from, &mi.mi_ts);
+	else
+		process_group2(hdr, node, group, from, &mi);
+}
+
+static void
+process_data(char *buf, int len, char *from, struct sockaddr *sa,
+	     timestamp_t *recv)
+{
+	struct distr_msg_hdr *hdr = (struct distr_msg_hdr *) buf;
+
+	if (len < sizeof(*hdr)) {
+		if (c_debug)
+			fprintf(stderr, "Discarding malformed packet (hdrcheck)\n");
+		return;
+	}
+
+	if (hdr->h_magic != BMON_MAGIC) {
+		if (c_debug)
+			fprintf(stderr, "Discarding malformed packet (magic mismatch)\n");
+		return;
+	}
+
+	if (hdr->h_ver != BMON_VERSION_1 && hdr->h_ver != BMON_VERSION) {
+		if (c_debug)
+			fprintf(stderr, "Discarding incompatible packet (version mismatch)\n");
+		return;
+	}
+
+	if (ntohs(hdr->h_len) < len) {
+		if (c_debug)
+			fprintf(stderr, "Discarding malformed packet (packet size mismatch)\n");
+		return;
+	}
+
+	if (ntohs(hdr->h_len) > len) {
+		if (c_debug)
+			fprintf(stderr, "Discarding truncated packet (bufsize too small)\n");
+		return;
+	}
+
+	if (hdr->h_offset < (sizeof(*hdr) + 4) ||
+	    hdr->h_offset + sizeof(struct distr_msg_grp) > len) {
+		if (c_debug)
+			fprintf(stderr, "Discarding malformed packet (offset too short)\n");
+		return;
+	}
+
+	process_msg(hdr, from, sa, recv);
+}
+
+static void
+deliver(char *buf, int len, struct sockaddr *addr, timestamp_t *recv)
+{
+	char addrstr[INET6_ADDRSTRLEN];
+
+	rx_datagrams++;
+	rx_bytes += len;
+
+	if (!xinet_ntop(addr, addrstr, sizeof(addrstr)))
+		return;
+
+	if (c_debug)
+		fprintf(stderr, "Read %d bytes from %s\n", len, addrstr);
+
+	process_data(buf, len, addrstr, addr, recv);
+}
+
+/*
+ * Called by the receive thread only, the entry becomes visible to the
+ * main thread once the head is advanced past it.
+ */
+static void
+ring_put(struct receiver *r, struct recv_slot *rs, int len, timestamp_t *recv)
+{
+	size_t need = RING_ALIGN(sizeof(struct ring_entry) + len);
+	size_t head = r->r_head, pos = head % r->r_ring_size;
+	size_t avail = r->r_ring_size -
+		(head - __atomic_load_n(&r->r_tail, __ATOMIC_ACQUIRE));
+	struct ring_entry *re;
+
+	/* entries are contiguous, skip the rest of the ring if too short */
+	if (r->r_ring_size - pos < need) {
+		if (avail < r->r_ring_size - pos + need)
+			goto full;
+
+		((struct ring_entry *) (r->r_ring + pos))->re_size = 0;
+		head += r->r_ring_size - pos;
+		pos = 0;
+	} else if (avail < need)
+		goto full;
+
+	re = (struct ring_entry *) (r->r_ring + pos);
+	re->re_size = need;
+	re->re_len = len;
+	re->re_recv = *recv;
+	memcpy(&re->re_addr, &rs->rs_addr, sizeof(re->re_addr));
+	memcpy(re + 1, rs->rs_iov.iov_base, len);
+
+	__atomic_store_n(&r->r_head, head + need, __ATOMIC_RELEASE);
+	return;
+
+full:
+	__atomic_add_fetch(&r->r_ring_drops, 1, __ATOMIC_RELAXED);
+}
+
+static int
+ring_drain(struct receiver *r, int max)
+{
+	size_t tail = r->r_tail;
+	size_t head = __atomic_load_n(&r->r_head, __ATOMIC_ACQUIRE);
+	int n = 0;
+
+	while (tail != head && (!max || n < max)) {
+		size_t pos = tail % r->r_ring_size;
+		struct ring_entry *re = (struct ring_entry *) (r->r_ring + pos);
+
+		if (0 == re->re_size) {
+			tail += r->r_ring_size - pos;
+			continue;
+		}
+
+		deliver((char *) (re + 1), re->re_len,
+			(struct sockaddr *) &re->re_addr, &re->re_recv);
+
+		tail += re->re_size;
+		__atomic_store_n(&r->r_tail, tail, __ATOMIC_RELEASE);
+		n++;
+	}
+
+	__atomic_store_n(&r->r_tail, tail, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+static void
+process_slot(struct receiver *r, struct recv_slot *rs, struct msghdr *mh,
+	     int len)
+{
+	struct cmsghdr *cmsg;
+	timestamp_t recv = { 0, 0 };
+
+	for (cmsg = CMSG_FIRSTHDR(mh); cmsg; cmsg = CMSG_NXTHDR(mh, cmsg)) {
+		if (SOL_SOCKET != cmsg->cmsg_level)
+			continue;
+#ifdef SO_RXQ_OVFL
+		/* number of datagrams the kernel dropped on this socket so far */
+		if (SO_RXQ_OVFL == cmsg->cmsg_type) {
+			uint32_t drops;
+
+			memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+			__atomic_store_n(&r->r_kernel_drops, drops,
+					 __ATOMIC_RELAXED);
+		}
+#endif
+		/* queueing in the receive buffer is not part of the transit time */
+		if (SO_TIMESTAMP == cmsg->cmsg_type) {
+			struct timeval tv;
+
+			memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+			recv.tv_sec = tv.tv_sec;
+			recv.tv_usec = tv.tv_usec;
+		}
+	}
+
+	if (0 == recv.tv_sec)
+		update_ts(&recv);
+
+	if (r->r_ring)
+		ring_put(r, rs, len, &recv);
+	else
+		deliver(rs->rs_iov.iov_base, len, (struct sockaddr *) &rs->rs_addr,
+			&recv);
+}
+
+static void
+prepare_slot(struct recv_slot *rs, struct msghdr *mh)
+{
+	memset(mh, 0, sizeof(*mh));
+	mh->msg_name = &rs->rs_addr;
+	mh->msg_namelen = sizeof(rs->rs_addr);
+	mh->msg_iov = &rs->rs_iov;
+	mh->msg_iovlen = 1;
+	mh->msg_control = rs->rs_ctl;
+	mh->msg_controllen = sizeof(rs->rs_ctl);
+}
+
+/*
+ * Receives up to c_batch datagrams at once, returns the number of
+ * datagrams received and 0 once the socket is drained.
+ */
+static int
+recv_batch(struct receiver *r, int flags)
+{
+	int i, n;
+
+#if defined SYS_LINUX
+	for (i = 0; i < c_batch; i++)
+		prepare_slot(&r->r_slots[i], &r->r_msgs[i].msg_hdr);
+
+	if ((n = recvmmsg(r->r_fd, r->r_msgs, c_batch, flags, NULL)) < 0)
+		goto errout;
+
+	for (i = 0; i < n; i++)
+		process_slot(r, &r->r_slots[i], &r->r_msgs[i].msg_hdr,
+			     r->r_msgs[i].msg_len);
+#else
+	struct msghdr mh;
+
+	prepare_slot(&r->r_slots[0], &mh);
+
+	if ((n = recvmsg(r->r_fd, &mh, flags)) < 0)
+		goto errout;
+
+	process_slot(r, &r->r_slots[0], &mh, n);
+	n = 1;
+#endif
+
+	return n;
+
+errout:
+	if (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno)
+		return 0;
+
+	quit("recvmmsg failed: %s\n", strerror(errno));
+	return 0;
+}
+
+#ifdef RECV_THREADS
+static void *
+recv_thread(void *arg)
+{
+	struct receiver *r = arg;
+
+	for (;;)
+		recv_batch(r, MSG_WAITFORONE);
+
+	return NULL;
+}
+
+static int
+clone_socket(void)
+{
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(ss);
+	int fd;
+
+	if (getsockname(recv_fd, (struct sockaddr *) &ss, &len) < 0)
+		quit("getsockname failed: %s\n", strerror(errno));
+
+	if ((fd = new_socket(ss.ss_family)) < 0 ||
+	    bind(fd, (struct sockaddr *) &ss, len) < 0)
+		quit("Unable to create receive socket: %s\n", strerror(errno));
+
+	setup_socket(fd);
+
+	return fd;
+}
+#endif
+
+static void
+accept_streams(int fd)
+{
+	struct sockaddr_storage ss;
+	struct stream_conn *sc;
+	socklen_t len;
+	int cfd;
+
+	for (;;) {
+		len = sizeof(ss);
+		if ((cfd = accept(fd, (struct sockaddr *) &ss, &len)) < 0)
+			return;
+
+		fcntl(cfd, F_SETFL, O_NONBLOCK);
+
+		conns = xrealloc(conns, (nconns + 1) * sizeof(struct stream_conn));
+		sc = &conns[nconns++];
+		memset(sc, 0, sizeof(*sc));
+		sc->sc_fd = cfd;
+		sc->sc_buf = xcalloc(1, STREAM_BUF);
+
+		/* peers of unix sockets are unnamed */
+		if (fd == listen_fd[1] ||
+		    !xinet_ntop((struct sockaddr *) &ss, sc->sc_from, sizeof(sc->sc_from)))
+			strcpy(sc->sc_from, "local");
+
+		if (c_debug)
+			fprintf(stderr, "Accepted stream connection from %s\n",
+				sc->sc_from);
+	}
+}
+
+/*
+ * Processes all complete frames, returns -1 if the connection is to
+ * be closed. Messages are parsed in place and must be aligned.
+ */
+static int
+read_stream(struct stream_conn *sc, timestamp_t *now)
+{
+	static char *aligned;
+	uint32_t flen;
+	size_t off;
+	ssize_t n;
+
+	if (!aligned)
+		aligned = xcalloc(1, STREAM_BUF);
+
+	for (;;) {
+		n = recv(sc->sc_fd, sc->sc_buf + sc->sc_len,
+			 STREAM_BUF - sc->sc_len, 0);
+		if (n < 0 && EINTR == errno)
+			continue;
+		if (n < 0)
+			return (EAGAIN == errno || EWOULDBLOCK == errno) ? 0 : -1;
+		if (0 == n)
+			return -1;
+
+		sc->sc_len += n;
+
+		for (off = 0; off + sizeof(flen) <= sc->sc_len; off += sizeof(flen) + flen) {
+			char *msg = sc->sc_buf + off + sizeof(flen);
+
+			memcpy(&flen, sc->sc_buf + off, sizeof(flen));
+			flen = ntohl(flen);
+
+			if (flen > STREAM_BUF - sizeof(flen)) {
+				if (c_debug)
+					fprintf(stderr, "Closing stream (frame too large)\n");
+				return -1;
+			}
+
+			if (off + sizeof(flen) + flen > sc->sc_len)
+				break;
+
+			if ((unsigned long) msg & 7) {
+				memcpy(aligned, msg, flen);
+				msg = aligned;
+			}
+
+			rx_datagrams++;
+			rx_bytes += flen;
+
+			if (c_debug)
+				fprintf(stderr, "Read %u bytes from %s\n",
+					flen, sc->sc_from);
+
+			/* drill-down requests are sent as datagrams only */
+			process_data(msg, flen, sc->sc_from, NULL, now);
+		}
+
+		memmove(sc->sc_buf, sc->sc_buf + off, sc->sc_len - off);
+		sc->sc_len -= off;
+	}
+}
+
+static void
+read_streams(void)
+{
+	timestamp_t now;
+	int i;
+
+	for (i = 0; i < 2; i++)
+		if (listen_fd[i] >= 0)
+			accept_streams(listen_fd[i]);
+
+	update_ts(&now);
+
+	for (i = 0; i < nconns; ) {
+		if (read_stream(&conns[i], &now) < 0) {
+			if (c_debug)
+				fprintf(stderr, "Stream connection closed\n");
+			close(conns[i].sc_fd);
+			xfree(conns[i].sc_buf);
+			conns[i] = conns[--nconns];
+			continue;
+		}
+		i++;
+	}
+}
+
+static void
+update_stats(void)
+{
+	b_cnt_t drops = 0;
+	intf_t *intf;
+	int i;
+
+	if (NULL == (intf = lookup_intf(get_local_node(), c_stats, 0, 0)))
+		return;
+
+	for (i = 0; i < nreceivers; i++)
+		drops += __atomic_load_n(&receivers[i].r_kernel_drops,
+					 __ATOMIC_RELAXED) +
+			 __atomic_load_n(&receivers[i].r_ring_drops,
+					 __ATOMIC_RELAXED);
+
+	intf->i_rx_packets.r_total = rx_datagrams;
+	intf->i_rx_bytes.r_total = rx_bytes;
+	intf->i_rx_packets.r_is64bit = intf->i_rx_bytes.r_is64bit = 1;
+
+	update_attr(intf, DROP, drops, 0, RX_PROVIDED);
+	update_attr(intf, STALE, stale_msgs, 0, RX_PROVIDED);
+	update_attr(intf, DUPLICATES, duplicate_msgs, 0, RX_PROVIDED);
+	update_attr(intf, LOOPS, loop_msgs, 0, RX_PROVIDED);
+
+	notify_update(intf);
+	increase_lifetime(intf, 1);
+}
+
+static void
+distribution_read(void)
+{
+	int i, n, total = 0;
+
+	/*
+	 * Drain the socket unless limited, the queue only grows otherwise.
+	 * Receive threads have done so already, only their rings are left.
+	 */
+	for (i = 0; i < nreceivers; i++) {
+		struct receiver *r = &receivers[i];
+
+		if (r->r_ring)
+			total += ring_drain(r, c_max_read ? c_max_read - total : 0);
+		else
+			while ((n = recv_batch(r, 0)) > 0) {
+				total += n;
+				if (c_max_read && total >= c_max_read)
+					break;
+			}
+
+		if (c_max_read && total >= c_max_read)
+			break;
+	}
+
+	if (listen_fd[0] >= 0 || listen_fd[1] >= 0)
+		read_streams();
+
+	release_senders();
+
+	if (c_stats)
+		update_stats();
+
+	if (c_ndrill)
+		send_drill_requests();
+}
+
+static void
+init_receiver(struct receiver *r, int fd)
+{
+	int i;
+
+	r->r_fd = fd;
+	r->r_bufs = xcalloc(c_batch, c_bufsize);
+	r->r_slots = xcalloc(c_batch, sizeof(struct recv_slot));
+#if defined SYS_LINUX
+	r->r_msgs = xcalloc(c_batch, sizeof(struct mmsghdr));
+#endif
+
+	for (i = 0; i < c_batch; i++) {
+		r->r_slots[i].rs_iov.iov_base = r->r_bufs + i * c_bufsize;
+		r->r_slots[i].rs_iov.iov_len = c_bufsize;
+	}
+}
+
+static void
+distribution_init(void)
+{
+	if (c_batch <= 0)
+		c_batch = 1;
+
+	nreceivers = c_threads > 1 ? c_threads : 1;
+	receivers = xcalloc(nreceivers, sizeof(struct receiver));
+
+	init_receiver(&receivers[0], recv_fd);
+
+#ifdef RECV_THREADS
+	if (c_threads > 1) {
+		size_t ring = c_ring ? c_ring : 256 * c_bufsize;
+		int i;
+
+		ring = RING_ALIGN(ring);
+		if (ring < 2 * RING_ALIGN(sizeof(struct ring_entry) + c_bufsize))
+			ring = 2 * RING_ALIGN(sizeof(struct ring_entry) + c_bufsize);
+
+		for (i = 0; i < nreceivers; i++) {
+			struct receiver *r = &receivers[i];
+
+			if (i > 0)
+				init_receiver(r, clone_socket());
+
+			r->r_ring = xcalloc(1, ring);
+			r->r_ring_size = ring;
+
+			if (pthread_create(&r->r_thread, NULL, recv_thread, r))
+				quit("Unable to start receive thread: %s\n",
+					strerror(errno));
+		}
+	}
+#endif
+}
+
+static void
+print_help(void)
+{
+	printf(
+		"Distribution - Collects statistics from other nodes\n" \
+		"\n" \
+		"  Collects statistics from other nodes using the distribution\n" \
+		"  secondary output method (-O distribution). Rates are based on\n" \
+		"  the sampling time of the sender, its clock offset and drift are\n" \
+		"  estimated per node.\n" \
+		"\n" \
+		"  Senders may also connect over TCP or a unix domain socket,\n" \
+		"  datagrams are received as well.\n" \
+		"\n" \
+		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
+		"\n" \
+		"  Options:\n" \
+		"    ip=ADDR            Only process messages from this address (default: none)\n" \
+		"    port=NUM           Port the messages are comming from (default: 2048)\n" \
+		"    ipv6               Prefer IPv6 when creating sockets\n" \
+		"    multicast[=ADDR]   Use multicast to collect statistics\n" \
+		"    intf=NAME          Bind multicast socket to given interface\n" \
+		"    nobind             Don't bind, receive multicast and unicast messages\n" \
+		"    max_read=NUM       Max. messages per read interval (default: 0=all)\n" \
+		"    bufsize=NUM        Max. size of a message (default: 8192)\n" \
+		"    batch=NUM          Messages received per system call (default: 16)\n" \
+		"    rcvbuf=NUM         Socket receive queue size (default: 64*bufsize)\n" \
+		"    threads=NUM        Receive threads with one socket each (default: 1)\n" \
+		"    ring=NUM           Queue size of a receive thread (default: 256*bufsize)\n" \
+		"    tcp                Accept TCP connections on port\n" \
+		"    unix=PATH          Accept connections on unix domain socket PATH\n" \
+		"    drilldown=NODE     Ask relays for the full detail of a node, may be\n" \
+		"                       given several times\n" \
+		"    stats[=NAME]       Provide collector statistics as local interface\n" \
+		"                       (default name: distribution)\n" \
+		"    debug              Print verbose message for debugging\n" \
+		"    help               Print this help text\n");
+}
+
+static void
+distribution_set_opts(tv_t *attrs)
+{
+	while (attrs) {
+		if (!strcasecmp(attrs->type, "port") && attrs->value) {
+			c_port = attrs->value;
 			c_port_int = strtol(c_port, NULL, 0);
 		} else if (!strcasecmp(attrs->type, "ip") && attrs->value)
 			c_ip = attrs->value;
@@ -589,6 +1978,24 @@ distribution_set_opts(tv_t *attrs)
 			c_max_read = strtol(attrs->value, NULL, 0);
 		else if (!strcasecmp(attrs->type, "bufsize") && attrs->value)
 			c_bufsize = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "batch") && attrs->value)
+			c_batch = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "rcvbuf") && attrs->value)
+			c_rcvbuf = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "threads") && attrs->value)
+			c_threads = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "ring") && attrs->value)
+			c_ring = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "tcp"))
+			c_tcp = 1;
+		else if (!strcasecmp(attrs->type, "unix") && attrs->value)
+			c_unix = attrs->value;
+		else if (!strcasecmp(attrs->type, "drilldown") && attrs->value) {
+			c_drill = xrealloc(c_drill, (c_ndrill + 1) * sizeof(char *));
+			c_drill[c_ndrill++] = attrs->value;
+		}
+		else if (!strcasecmp(attrs->type, "stats"))
+			c_stats = attrs->value ? attrs->value : "distribution";
 		else if (!strcasecmp(attrs->type, "debug"))
 			c_debug = 1;
 		else if (!strcasecmp(attrs->type, "multicast")) {
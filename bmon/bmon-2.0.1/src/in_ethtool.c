@@ -0,0 +1,737 @@
+/*
+ * in_ethtool.c          Per queue statistics via ethtool (Linux)
+ *
+ * Copyright (c) 2001-2004 Thomas Graf <tgraf@suug.ch>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <bmon/bmon.h>
+#include <bmon/input.h>
+#include <bmon/node.h>
+#include <bmon/intf.h>
+#include <bmon/utils.h>
+
+#if defined SYS_LINUX
+
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/sockios.h>
+#include <linux/ethtool.h>
+
+static int c_max_queues = 64;
+static int c_retry = 30;
+
+static int ethtool_fd = -1;
+
+/*
+ * Every driver names its per queue counters differently, the string
+ * set is therefore translated once into a map stat index -> slot. A
+ * slot is one (queue, direction, field) triple accumulating one or
+ * more driver counters. If a driver exports several counters for the
+ * same field, e.g. "packets" and "xdp_packets", only the ones of the
+ * best rank are used, counters of equal rank (ucast/mcast/bcast) are
+ * summed up.
+ */
+enum {
+	Q_BYTES,
+	Q_PACKETS,
+	Q_DROP,
+	Q_ERRORS,
+	__Q_MAX,
+};
+
+#define Q_RX 0
+#define Q_TX 1
+
+#define SLOT(q, dir, f)		((((q) * 2) + (dir)) * __Q_MAX + (f))
+#define NSLOTS(nq)		((nq) * 2 * __Q_MAX)
+
+static struct counter_map {
+	const char *	cm_name;
+	int		cm_field;
+	int		cm_rank;
+} counter_map[] = {
+	{ "bytes",		Q_BYTES,	0 },
+	{ "packets",		Q_PACKETS,	0 },
+	{ "pkts",		Q_PACKETS,	0 },
+	{ "cnt",		Q_PACKETS,	1 },
+	{ "ucast_bytes",	Q_BYTES,	1 },
+	{ "mcast_bytes",	Q_BYTES,	1 },
+	{ "bcast_bytes",	Q_BYTES,	1 },
+	{ "ucast_packets",	Q_PACKETS,	1 },
+	{ "mcast_packets",	Q_PACKETS,	1 },
+	{ "bcast_packets",	Q_PACKETS,	1 },
+	{ "xdp_bytes",		Q_BYTES,	2 },
+	{ "xdp_packets",	Q_PACKETS,	2 },
+	{ "drops",		Q_DROP,		0 },
+	{ "dropped",		Q_DROP,		0 },
+	{ "drop",		Q_DROP,		0 },
+	{ "errors",		Q_ERRORS,	0 },
+	{ "errs",		Q_ERRORS,	0 },
+	{ "csum_err",		Q_ERRORS,	1 },
+	{ NULL },
+};
+
+/*
+ * Counters of the driver not belonging to a queue. The ones with an
+ * equivalent attribute are provided by a "driver" child of the link,
+ * counters mapping to the same attribute are summed up.
+ */
+static struct driver_map {
+	const char *	dm_name;
+	int		dm_type;
+	int		dm_dir;
+} driver_map[] = {
+	{ "rx_missed_errors",		MISSED_ERRORS,	Q_RX },
+	{ "rx_missed",			MISSED_ERRORS,	Q_RX },
+	{ "rx_no_buffer_count",		BUF_ERRORS,	Q_RX },
+	{ "rx_no_buffer",		BUF_ERRORS,	Q_RX },
+	{ "rx_no_dma_resources",	BUF_ERRORS,	Q_RX },
+	{ "rx_out_of_buffer",		BUF_ERRORS,	Q_RX },
+	{ "rx_alloc_failed",		BUF_ERRORS,	Q_RX },
+	{ "tx_timeout_count",		TIMEOUTS,	Q_TX },
+	{ "tx_timeout",			TIMEOUTS,	Q_TX },
+	{ "tx_timeouts",		TIMEOUTS,	Q_TX },
+	{ "rx_crc_errors",		CRC_ERRORS,	Q_RX },
+	{ "rx_length_errors",		LENGTH_ERRORS,	Q_RX },
+	{ "rx_long_length_errors",	LENGTH_ERRORS,	Q_RX },
+	{ "rx_short_length_errors",	LENGTH_ERRORS,	Q_RX },
+	{ "rx_over_errors",		OVER_ERRORS,	Q_RX },
+	{ "rx_frame_errors",		FRAME,		Q_RX },
+	{ "rx_align_errors",		FRAME,		Q_RX },
+	{ "rx_fifo_errors",		FIFO,		Q_RX },
+	{ "tx_fifo_errors",		FIFO,		Q_TX },
+	{ "rx_csum_offload_errors",	CSUM_ERRORS,	Q_RX },
+	{ "rx_discards_phy",		DROP,		Q_RX },
+	{ "tx_discards_phy",		DROP,		Q_TX },
+	{ "tx_aborted_errors",		ABORTED_ERRORS,	Q_TX },
+	{ "tx_carrier_errors",		CARRIER_ERRORS,	Q_TX },
+	{ "tx_window_errors",		WINDOW_ERRORS,	Q_TX },
+	{ "tx_heartbeat_errors",	HEARTBEAT_ERRORS, Q_TX },
+	{ NULL },
+};
+
+#define DRIVER_HANDLE 0xffff
+
+struct eth_link
+{
+	char			el_name[IFNAME_MAX];
+	int			el_nstats;
+	int			el_nqueues;
+	int			el_failed;
+	unsigned int		el_gen;
+	int *			el_map;
+	b_cnt_t *		el_acc;
+	unsigned char *		el_have;
+	int *			el_dmap;
+	int			el_ndriver;
+	int			el_dflags[__ATTR_MAX];
+	b_cnt_t			el_dacc[__ATTR_MAX][2];
+	struct ethtool_stats *	el_stats;
+	size_t			el_stats_size;
+	struct eth_link *	el_next;
+};
+
+#define LINK_HTSIZE 64
+
+static struct eth_link *link_ht[LINK_HTSIZE];
+static unsigned int link_gen;
+
+static unsigned int
+link_hash(const char *s)
+{
+	unsigned int h = 5381;
+
+	while (*s)
+		h = ((h << 5) + h) + (unsigned char) *s++;
+
+	return h % LINK_HTSIZE;
+}
+
+static struct eth_link *
+get_link(const char *name)
+{
+	struct eth_link *l;
+	unsigned int h = link_hash(name);
+
+	for (l = link_ht[h]; l; l = l->el_next)
+		if (!strcmp(l->el_name, name))
+			return l;
+
+	l = xcalloc(1, sizeof(*l));
+	snprintf(l->el_name, sizeof(l->el_name), "%s", name);
+	l->el_next = link_ht[h];
+	link_ht[h] = l;
+
+	return l;
+}
+
+static void
+flush_link(struct eth_link *l)
+{
+	xfree(l->el_map);
+	xfree(l->el_acc);
+	xfree(l->el_have);
+	xfree(l->el_dmap);
+
+	if (l->el_stats)
+		munmap(l->el_stats, l->el_stats_size);
+
+	l->el_map = NULL;
+	l->el_acc = NULL;
+	l->el_have = NULL;
+	l->el_dmap = NULL;
+	l->el_stats = NULL;
+	l->el_nstats = 0;
+	l->el_nqueues = 0;
+	l->el_ndriver = 0;
+	memset(l->el_dflags, 0, sizeof(l->el_dflags));
+}
+
+/*
+ * ETHTOOL_GSTATS writes as many counters as the driver has right now,
+ * not as many as asked for, and the number changes with the number
+ * of channels (ethtool -L). The buffer leaves room for the counters to
+ * double and is followed by an inaccessible page, more than that
+ * makes the ioctl fail with EFAULT instead of overrunning the heap.
+ */
+static struct ethtool_stats *
+alloc_stats(struct eth_link *l, int nstats)
+{
+	size_t page = getpagesize();
+	size_t len = sizeof(struct ethtool_stats) + 2 * nstats * sizeof(uint64_t);
+	void *p;
+
+	len = (len + page - 1) & ~(page - 1);
+
+	p = mmap(NULL, len + page, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == p)
+		return NULL;
+
+	if (mprotect((char *) p + len, page, PROT_NONE) < 0) {
+		munmap(p, len + page);
+		return NULL;
+	}
+
+	l->el_stats_size = len + page;
+
+	return p;
+}
+
+static int
+do_ioctl(const char *name, void *data)
+{
+	struct ifreq ifr;
+	size_t len = strlen(name);
+
+	if (len >= sizeof(ifr.ifr_name)) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	memcpy(ifr.ifr_name, name, len);
+	ifr.ifr_data = data;
+
+	return ioctl(ethtool_fd, SIOCETHTOOL, &ifr);
+}
+
+static int
+get_nstats(const char *name)
+{
+#ifdef ETHTOOL_GSSET_INFO
+	struct {
+		struct ethtool_sset_info hdr;
+		uint32_t count;
+	} sset;
+
+	memset(&sset, 0, sizeof(sset));
+	sset.hdr.cmd = ETHTOOL_GSSET_INFO;
+	sset.hdr.sset_mask = 1ULL << ETH_SS_STATS;
+
+	if (do_ioctl(name, &sset) == 0)
+		return (sset.hdr.sset_mask & (1ULL << ETH_SS_STATS)) ?
+			(int) sset.count : 0;
+
+	if (errno != EOPNOTSUPP)
+		return -1;
+#endif
+	{
+		/* kernels before 2.6.33 */
+		struct ethtool_drvinfo drvinfo;
+
+		memset(&drvinfo, 0, sizeof(drvinfo));
+		drvinfo.cmd = ETHTOOL_GDRVINFO;
+
+		if (do_ioctl(name, &drvinfo) < 0)
+			return -1;
+
+		return drvinfo.n_stats;
+	}
+}
+
+/*
+ * Splits a counter name into queue, direction and remaining counter
+ * name. Known layouts:
+ *   rx_queue_0_bytes     (virtio_net, veth, ixgbe, ...)
+ *   rx0_bytes            (mlx4, mlx5)
+ *   rx-0.rx_bytes        (i40e, ice)
+ *   queue_0_rx_bytes     (ena)
+ *   [0]: rx_ucast_bytes  (bnxt)
+ */
+static const char *
+parse_queue(const char *s, int *queue, int *dir)
+{
+	char *end;
+	const char *p = s;
+	int d = -1;
+	long q;
+
+	if ('[' == *p) {
+		q = strtol(p + 1, &end, 10);
+		if (end == p + 1 || strncmp(end, "]: ", 3))
+			return NULL;
+		p = end + 3;
+		goto ctr_dir;
+	}
+
+	if (!strncmp(p, "queue_", 6)) {
+		q = strtol(p + 6, &end, 10);
+		if (end == p + 6 || '_' != *end)
+			return NULL;
+		p = end + 1;
+		goto ctr_dir;
+	}
+
+	if (!strncmp(p, "rx", 2))
+		d = Q_RX;
+	else if (!strncmp(p, "tx", 2))
+		d = Q_TX;
+	else
+		return NULL;
+
+	p += 2;
+	if (!strncmp(p, "_queue_", 7))
+		p += 7;
+	else if ('-' == *p)
+		p++;
+
+	q = strtol(p, &end, 10);
+	if (end == p || ('_' != *end && '.' != *end))
+		return NULL;
+	p = end + 1;
+
+	/* rx-0.rx_bytes: direction repeated in counter name */
+	if (!strncmp(p, d == Q_RX ? "rx_" : "tx_", 3))
+		p += 3;
+	goto out;
+
+ctr_dir:
+	if (!strncmp(p, "rx_", 3))
+		d = Q_RX;
+	else if (!strncmp(p, "tx_", 3))
+		d = Q_TX;
+	else
+		return NULL;
+	p += 3;
+
+out:
+	if (q < 0 || q >= c_max_queues)
+		return NULL;
+
+	*queue = (int) q;
+	*dir = d;
+
+	return p;
+}
+
+static void
+resolve_link(struct eth_link *l, int nstats)
+{
+	struct ethtool_gstrings *strings;
+	int *rank, i, nslots;
+
+	strings = xcalloc(1, sizeof(*strings) + nstats * ETH_GSTRING_LEN);
+	strings->cmd = ETHTOOL_GSTRINGS;
+	strings->string_set = ETH_SS_STATS;
+	strings->len = nstats;
+
+	if (do_ioctl(l->el_name, strings) < 0) {
+		xfree(strings);
+		l->el_failed = c_retry;
+		return;
+	}
+
+	if ((int) strings->len < nstats)
+		nstats = strings->len;
+
+	l->el_nstats = nstats;
+	l->el_map = xcalloc(nstats, sizeof(int));
+	l->el_dmap = xcalloc(nstats, sizeof(int));
+
+	for (i = 0; i < nstats; i++) {
+		char name[ETH_GSTRING_LEN + 1];
+		const char *ctr;
+		int q, d, m;
+
+		l->el_map[i] = l->el_dmap[i] = -1;
+
+		memcpy(name, &strings->data[i * ETH_GSTRING_LEN], ETH_GSTRING_LEN);
+		name[ETH_GSTRING_LEN] = '\0';
+
+		if (!(ctr = parse_queue(name, &q, &d))) {
+			for (m = 0; driver_map[m].dm_name; m++) {
+				struct driver_map *dm = &driver_map[m];
+
+				if (!strcmp(name, dm->dm_name)) {
+					l->el_dmap[i] = m;
+					l->el_dflags[dm->dm_type] |=
+						dm->dm_dir == Q_RX ? RX_PROVIDED : TX_PROVIDED;
+					l->el_ndriver++;
+					break;
+				}
+			}
+			continue;
+		}
+
+		for (m = 0; counter_map[m].cm_name; m++) {
+			if (!strcmp(ctr, counter_map[m].cm_name)) {
+				l->el_map[i] = SLOT(q, d, counter_map[m].cm_field);
+				/* remember the rank in the upper bits for now */
+				l->el_map[i] |= counter_map[m].cm_rank << 24;
+				if (q >= l->el_nqueues)
+					l->el_nqueues = q + 1;
+				break;
+			}
+		}
+	}
+
+	xfree(strings);
+
+	nslots = NSLOTS(l->el_nqueues);
+	rank = xcalloc(nslots ? nslots : 1, sizeof(int));
+
+	for (i = 0; i < nslots; i++)
+		rank[i] = 0xff;
+
+	for (i = 0; i < nstats; i++) {
+		int slot = l->el_map[i] & 0xffffff, r = l->el_map[i] >> 24;
+
+		if (l->el_map[i] >= 0 && r < rank[slot])
+			rank[slot] = r;
+	}
+
+	for (i = 0; i < nstats; i++) {
+		int slot = l->el_map[i] & 0xffffff, r = l->el_map[i] >> 24;
+
+		if (l->el_map[i] < 0)
+			continue;
+
+		l->el_map[i] = r == rank[slot] ? slot : -1;
+	}
+
+	l->el_have = xcalloc(nslots ? nslots : 1, 1);
+	for (i = 0; i < nslots; i++)
+		l->el_have[i] = rank[i] != 0xff;
+
+	xfree(rank);
+
+	l->el_acc = xcalloc(nslots ? nslots : 1, sizeof(b_cnt_t));
+
+	if (!(l->el_stats = alloc_stats(l, nstats))) {
+		flush_link(l);
+		l->el_failed = c_retry;
+	}
+}
+
+static void
+update_queue(node_t *node, int link_index, struct eth_link *l, int q)
+{
+	b_cnt_t *acc = l->el_acc;
+	unsigned char *have = l->el_have;
+	char name[IFNAME_MAX];
+	intf_t *intf;
+
+	if (!have[SLOT(q, Q_RX, Q_BYTES)] && !have[SLOT(q, Q_RX, Q_PACKETS)] &&
+	    !have[SLOT(q, Q_TX, Q_BYTES)] && !have[SLOT(q, Q_TX, Q_PACKETS)])
+		return;
+
+	snprintf(name, sizeof(name), "queue %d", q);
+
+	intf = lookup_intf(node, name, q + 1, link_index);
+	if (NULL == intf)
+		return;
+
+	intf->i_link = link_index;
+	intf->i_is_child = 1;
+	intf->i_level = 1;
+
+	intf->i_rx_bytes.r_total = acc[SLOT(q, Q_RX, Q_BYTES)];
+	intf->i_tx_bytes.r_total = acc[SLOT(q, Q_TX, Q_BYTES)];
+	intf->i_rx_packets.r_total = acc[SLOT(q, Q_RX, Q_PACKETS)];
+	intf->i_tx_packets.r_total = acc[SLOT(q, Q_TX, Q_PACKETS)];
+	intf->i_rx_bytes.r_is64bit = intf->i_tx_bytes.r_is64bit = 1;
+	intf->i_rx_packets.r_is64bit = intf->i_tx_packets.r_is64bit = 1;
+
+	if (have[SLOT(q, Q_RX, Q_DROP)] || have[SLOT(q, Q_TX, Q_DROP)])
+		update_attr(intf, DROP, acc[SLOT(q, Q_RX, Q_DROP)],
+			acc[SLOT(q, Q_TX, Q_DROP)],
+			(have[SLOT(q, Q_RX, Q_DROP)] ? RX_PROVIDED : 0) |
+			(have[SLOT(q, Q_TX, Q_DROP)] ? TX_PROVIDED : 0));
+
+	if (have[SLOT(q, Q_RX, Q_ERRORS)] || have[SLOT(q, Q_TX, Q_ERRORS)])
+		update_attr(intf, ERRORS, acc[SLOT(q, Q_RX, Q_ERRORS)],
+			acc[SLOT(q, Q_TX, Q_ERRORS)],
+			(have[SLOT(q, Q_RX, Q_ERRORS)] ? RX_PROVIDED : 0) |
+			(have[SLOT(q, Q_TX, Q_ERRORS)] ? TX_PROVIDED : 0));
+
+	notify_update(intf);
+	increase_lifetime(intf, 1);
+}
+
+static void
+update_driver(node_t *node, int link_index, struct eth_link *l)
+{
+	intf_t *intf;
+	int i;
+
+	intf = lookup_intf(node, "driver", DRIVER_HANDLE, link_index);
+	if (NULL == intf)
+		return;
+
+	intf->i_link = link_index;
+	intf->i_is_child = 1;
+	intf->i_level = 1;
+
+	for (i = 0; i < __ATTR_MAX; i++)
+		if (l->el_dflags[i])
+			update_attr(intf, i, l->el_dacc[i][Q_RX],
+				l->el_dacc[i][Q_TX], l->el_dflags[i]);
+
+	notify_update(intf);
+	increase_lifetime(intf, 1);
+}
+
+static void
+read_link(node_t *node, int link_index)
+{
+	intf_t *link = get_intf(node, link_index);
+	struct eth_link *l;
+	int i, nstats;
+
+	l = get_link(link->i_name);
+	l->el_gen = link_gen;
+
+	if (l->el_failed) {
+		l->el_failed--;
+		return;
+	}
+
+	/*
+	 * The string set is only resolved again once the number of
+	 * counters changed, see alloc_stats().
+	 */
+	if (NULL == l->el_stats) {
+		if ((nstats = get_nstats(l->el_name)) <= 0) {
+			l->el_failed = c_retry;
+			return;
+		}
+
+		resolve_link(l, nstats);
+		if (l->el_failed)
+			return;
+
+		if (0 == l->el_nqueues && 0 == l->el_ndriver) {
+			/* nothing we know of, check again later */
+			flush_link(l);
+			l->el_failed = c_retry;
+			return;
+		}
+	}
+
+	l->el_stats->cmd = ETHTOOL_GSTATS;
+	l->el_stats->n_stats = l->el_nstats;
+
+	if (do_ioctl(l->el_name, l->el_stats) < 0 ||
+	    (int) l->el_stats->n_stats != l->el_nstats) {
+		flush_link(l);
+		return;
+	}
+
+	memset(l->el_acc, 0, NSLOTS(l->el_nqueues) * sizeof(b_cnt_t));
+	memset(l->el_dacc, 0, sizeof(l->el_dacc));
+
+	for (i = 0; i < l->el_nstats; i++) {
+		if (l->el_map[i] >= 0)
+			l->el_acc[l->el_map[i]] += l->el_stats->data[i];
+		else if (l->el_dmap[i] >= 0) {
+			struct driver_map *dm = &driver_map[l->el_dmap[i]];
+
+			l->el_dacc[dm->dm_type][dm->dm_dir] += l->el_stats->data[i];
+		}
+	}
+
+	for (i = 0; i < l->el_nqueues; i++)
+		update_queue(node, link_index, l, i);
+
+	if (l->el_ndriver)
+		update_driver(node, link_index, l);
+}
+
+/*
+ * Links not seen during the last read are gone, drop them to not
+ * accumulate entries of short lived interfaces (veth, containers).
+ */
+static void
+prune_links(void)
+{
+	int i;
+
+	for (i = 0; i < LINK_HTSIZE; i++) {
+		struct eth_link **pp = &link_ht[i], *l;
+
+		while ((l = *pp)) {
+			if (l->el_gen == link_gen) {
+				pp = &l->el_next;
+				continue;
+			}
+
+			*pp = l->el_next;
+			flush_link(l);
+			xfree(l);
+		}
+	}
+}
+
+static void
+ethtool_read(void)
+{
+	node_t *node = get_local_node();
+	int i, n;
+
+	if (NULL == node)
+		return;
+
+	link_gen++;
+
+	/*
+	 * Queues are added to the interface array while walking it, the
+	 * array may be reallocated, refer to links by index only.
+	 */
+	n = node->n_nintf;
+	for (i = 0; i < n; i++) {
+		intf_t *link = get_intf(node, i);
+
+		if (!link->i_name[0] || link->i_is_child || link->i_handle ||
+		    !link->i_updated)
+			continue;
+
+		read_link(node, i);
+	}
+
+	prune_links();
+}
+
+static void
+print_help(void)
+{
+	printf(
+		"ethtool - Per queue statistics via ethtool (Linux)\n" \
+		"\n" \
+		"  Reads the driver statistics of each interface using the ethtool\n" \
+		"  ioctl interface and provides the counters of every RX/TX queue\n" \
+		"  as child of the interface, known counters of the driver itself\n" \
+		"  as child \"driver\". The names of the counters are resolved\n" \
+		"  once per interface.\n" \
+		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
+		"\n" \
+		"  Options:\n" \
+		"    maxqueues=NUM  Max number of queues per interface (default: 64)\n" \
+		"    retry=NUM      Reads to wait before retrying an interface\n" \
+		"                   without per queue statistics (default: 30)\n");
+}
+
+static void
+ethtool_set_opts(tv_t *attrs)
+{
+	while (attrs) {
+		if (!strcasecmp(attrs->type, "maxqueues") && attrs->value)
+			c_max_queues = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "retry") && attrs->value)
+			c_retry = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "help")) {
+			print_help();
+			exit(0);
+		}
+		attrs = attrs->next;
+	}
+
+	if (c_max_queues <= 0 || c_max_queues > 4096)
+		quit("maxqueues must be in the range 1..4096\n");
+}
+
+static int
+ethtool_probe(void)
+{
+	if (ethtool_fd < 0)
+		ethtool_fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	return ethtool_fd >= 0;
+}
+
+static void
+ethtool_shutdown(void)
+{
+	int i;
+
+	for (i = 0; i < LINK_HTSIZE; i++) {
+		struct eth_link *l, *next;
+
+		for (l = link_ht[i]; l; l = next) {
+			next = l->el_next;
+			flush_link(l);
+			xfree(l);
+		}
+		link_ht[i] = NULL;
+	}
+
+	if (ethtool_fd >= 0) {
+		close(ethtool_fd);
+		ethtool_fd = -1;
+	}
+}
+
+static struct input_module ethtool_ops = {
+	.im_name = "ethtool",
+	.im_read = ethtool_read,
+	.im_set_opts = ethtool_set_opts,
+	.im_probe = ethtool_probe,
+	.im_shutdown = ethtool_shutdown,
+};
+
+static void __init
+ethtool_init(void)
+{
+	register_secondary_input_module(&ethtool_ops);
+}
+
+#endif
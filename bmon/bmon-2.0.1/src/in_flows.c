@@ -0,0 +1,342 @@
+/*
+ * in_flows.c           Flow sampler using a TPACKET_V3 ring (Linux)
+ *
+ * Copyright (c) 2001-2004 Thomas Graf <tgraf@suug.ch>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <bmon/bmon.h>
+#include <bmon/input.h>
+#include <bmon/node.h>
+#include <bmon/intf.h>
+#include <bmon/flow.h>
+#include <bmon/utils.h>
+
+#if defined SYS_LINUX
+
+#include <sys/mman.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+/* headers only, a flow key never needs more */
+#define FLOW_SNAPLEN	128
+
+static char *c_intf;
+static int c_hosts = 0;
+static int c_sample = 1;
+static int c_top = 10;
+static int c_max = 4096;
+static int c_idle = 10;
+static int c_blocks = 16;
+static int c_block_size = 1 << 18;
+
+static flow_table_t flows;
+static int pkt_fd = -1;
+static uint8_t *ring;
+static size_t ring_size;
+static int cur_block;
+
+/*
+ * Accepts 1 in c_sample packets in the kernel, truncated to the headers,
+ * so packets which are not sampled never reach the ring.
+ */
+static void
+attach_filter(void)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_RANDOM),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, c_sample),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, FLOW_SNAPLEN),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(code) / sizeof(code[0]),
+		.filter = code,
+	};
+
+	/* without sampling only the snap length is needed */
+	if (c_sample <= 1) {
+		prog.filter = &code[3];
+		prog.len = 1;
+	}
+
+	if (setsockopt(pkt_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+	    sizeof(prog)) < 0)
+		quit("Unable to attach sampling filter: %s\n", strerror(errno));
+}
+
+static void
+open_ring(void)
+{
+	struct tpacket_req3 req = {
+		.tp_block_size = c_block_size,
+		.tp_block_nr = c_blocks,
+		.tp_frame_size = TPACKET_ALIGN(TPACKET3_HDRLEN + FLOW_SNAPLEN),
+		.tp_retire_blk_tov = 100,
+	};
+	struct sockaddr_ll addr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ALL),
+	};
+	int version = TPACKET_V3;
+
+	req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) *
+		req.tp_block_nr;
+
+	if (!(addr.sll_ifindex = if_nametoindex(c_intf)))
+		quit("Unknown interface %s\n", c_intf);
+
+	/*
+	 * Protocol 0 receives nothing until the bind, otherwise packets
+	 * of all interfaces would land in the ring while it is set up.
+	 */
+	if ((pkt_fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0)
+		quit("Unable to open packet socket: %s\n", strerror(errno));
+
+	attach_filter();
+
+	if (setsockopt(pkt_fd, SOL_PACKET, PACKET_VERSION, &version,
+	    sizeof(version)) < 0)
+		quit("TPACKET_V3 not supported: %s\n", strerror(errno));
+
+	if (setsockopt(pkt_fd, SOL_PACKET, PACKET_RX_RING, &req,
+	    sizeof(req)) < 0)
+		quit("Unable to set up packet ring: %s\n", strerror(errno));
+
+	ring_size = (size_t) req.tp_block_size * req.tp_block_nr;
+	ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED, pkt_fd, 0);
+	if (MAP_FAILED == ring)
+		quit("Unable to map packet ring: %s\n", strerror(errno));
+
+	if (bind(pkt_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		quit("Unable to bind to %s: %s\n", c_intf, strerror(errno));
+}
+
+static void
+walk_block(struct tpacket_block_desc *bd)
+{
+	struct tpacket3_hdr *hdr;
+	uint32_t n;
+
+	hdr = (struct tpacket3_hdr *) ((uint8_t *) bd +
+		bd->hdr.bh1.offset_to_first_pkt);
+
+	for (n = 0; n < bd->hdr.bh1.num_pkts; n++) {
+		struct sockaddr_ll *sll;
+		struct flow_key key;
+		int tx;
+
+		sll = (struct sockaddr_ll *) ((uint8_t *) hdr +
+			TPACKET_ALIGN(sizeof(*hdr)));
+
+		if (hdr->tp_net >= hdr->tp_mac &&
+		    hdr->tp_snaplen > hdr->tp_net - hdr->tp_mac &&
+		    !flow_parse_ip((uint8_t *) hdr + hdr->tp_net,
+				   hdr->tp_snaplen - (hdr->tp_net - hdr->tp_mac),
+				   &key)) {
+			tx = PACKET_OUTGOING == sll->sll_pkttype;
+
+			if (c_hosts)
+				flow_key_hosts(&key);
+			if (flow_key_canon(&key))
+				tx = !tx;
+
+			flow_account(&flows, &key, tx,
+				(b_cnt_t) hdr->tp_len * c_sample, c_sample);
+		}
+
+		hdr = (struct tpacket3_hdr *) ((uint8_t *) hdr +
+			hdr->tp_next_offset);
+	}
+}
+
+/*
+ * Hands all blocks retired by the kernel back to it. Packets are
+ * parsed where they are in the ring, nothing is copied.
+ */
+static void
+drain_ring(void)
+{
+	for (;;) {
+		struct tpacket_block_desc *bd;
+
+		bd = (struct tpacket_block_desc *) (ring +
+			(size_t) cur_block * c_block_size);
+
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status,
+		      __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			break;
+
+		walk_block(bd);
+
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+			__ATOMIC_RELEASE);
+		cur_block = (cur_block + 1) % c_blocks;
+	}
+}
+
+static void
+flows_read(void)
+{
+	node_t *node = get_local_node();
+	struct flow *top[c_top];
+	intf_t *intf;
+	int i, n, parent;
+
+	drain_ring();
+
+	n = flow_top(&flows, top, c_top);
+
+	if ((intf = get_intf_by_name(node, c_intf))) {
+		/* flows are added below, the array may move */
+		parent = intf->i_index;
+
+		for (i = 0; i < n; i++) {
+			char name[IFNAME_MAX];
+
+			flow_name(top[i], name, sizeof(name));
+
+			if (!(intf = lookup_intf(node, name, top[i]->f_hash, parent)))
+				continue;
+
+			intf->i_link = parent;
+			intf->i_is_child = 1;
+			intf->i_level = 1;
+			flow_update_intf(top[i], intf);
+
+			notify_update(intf);
+			increase_lifetime(intf, 1);
+		}
+	}
+
+	flow_expire(&flows, c_idle);
+}
+
+static void
+print_help(void)
+{
+	printf(
+		"flows - Top flows of an interface (Linux)\n" \
+		"\n" \
+		"  Captures the headers of all packets of an interface using a\n" \
+		"  memory mapped TPACKET_V3 ring and accounts them per flow. The\n" \
+		"  flows transferring the most are shown as children of the\n" \
+		"  interface. The number of flows kept is bounded, the least\n" \
+		"  active flows are replaced first. Sampling is done in the\n" \
+		"  kernel, counters are scaled accordingly. Requires CAP_NET_RAW.\n" \
+		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
+		"\n" \
+		"  Options:\n" \
+		"    intf=NAME      Interface to capture on (required)\n" \
+		"    hosts          Account per host pair instead of per 5-tuple\n" \
+		"    sample=NUM     Sample 1 in NUM packets (default: 1)\n" \
+		"    top=NUM        Number of flows to show (default: 10)\n" \
+		"    max=NUM        Max. number of flows kept (default: 4096)\n" \
+		"    idle=NUM       Forget flows idle for NUM reads (default: 10)\n" \
+		"    blocks=NUM     Number of ring blocks (default: 16)\n" \
+		"    blocksize=NUM  Size of a ring block (default: 262144)\n");
+}
+
+static void
+flows_set_opts(tv_t *attrs)
+{
+	while (attrs) {
+		if (!strcasecmp(attrs->type, "intf") && attrs->value)
+			c_intf = attrs->value;
+		else if (!strcasecmp(attrs->type, "hosts"))
+			c_hosts = 1;
+		else if (!strcasecmp(attrs->type, "sample") && attrs->value)
+			c_sample = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "top") && attrs->value)
+			c_top = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "max") && attrs->value)
+			c_max = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "idle") && attrs->value)
+			c_idle = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "blocks") && attrs->value)
+			c_blocks = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "blocksize") && attrs->value)
+			c_block_size = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "help")) {
+			print_help();
+			exit(0);
+		}
+		attrs = attrs->next;
+	}
+}
+
+static int
+flows_probe(void)
+{
+	if (NULL == c_intf) {
+		fprintf(stderr, "flows: no interface given (intf=NAME)\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+static void
+flows_init(void)
+{
+	if (c_top < 1)
+		c_top = 1;
+	if (c_sample < 1)
+		c_sample = 1;
+	if (c_max < c_top)
+		c_max = c_top;
+
+	/* a block must be a multiple of the page size */
+	c_block_size = (c_block_size + getpagesize() - 1) & ~(getpagesize() - 1);
+
+	flow_table_init(&flows, c_max);
+	open_ring();
+}
+
+static void
+flows_shutdown(void)
+{
+	if (ring && MAP_FAILED != ring)
+		munmap(ring, ring_size);
+	if (pkt_fd >= 0)
+		close(pkt_fd);
+	flow_table_free(&flows);
+}
+
+static struct input_module flows_ops = {
+	.im_name = "flows",
+	.im_read = flows_read,
+	.im_set_opts = flows_set_opts,
+	.im_probe = flows_probe,
+	.im_init = flows_init,
+	.im_shutdown = flows_shutdown,
+};
+
+static void __init
+flows_register(void)
+{
+	register_secondary_input_module(&flows_ops);
+}
+
+#endif
@@ -39,6 +39,8 @@
 #define TC_H_INGRESS    (0xFFFFFFF1U)
 
 static int c_notc = 0;
+static int c_noevents = 0;
+static int c_maxreq = 16;
 
 #include <netlink/netlink.h>
 #include <netlink/cache.h>
@@ -48,22 +50,183 @@ static int c_notc = 0;
 #include <netlink/helpers.h>
 
 #include <net/if.h>
+#include <linux/rtnetlink.h>
+#include <linux/gen_stats.h>
 
 static struct nl_handle nl_h = NL_INIT_HANDLE();
 static struct nl_cache link_cache = RTNL_INIT_LINK_CACHE();
 static struct nl_cache qdisc_cache = RTNL_INIT_QDISC_CACHE();
 static struct nl_cache class_cache = RTNL_INIT_CLASS_CACHE();
 
+/*
+ * Link events (RTMGRP_LINK) are received on a separate socket so
+ * they never interleave with the replies of a cache update.
+ */
+static int ev_fd = -1;
+
+#define LINK_HASH_SIZE 256
+
+struct link_name {
+	int                ln_index;
+	char               ln_name[IFNAMSIZ];
+	struct link_name * ln_next;
+};
+
+static struct link_name *link_names[LINK_HASH_SIZE];
+
+/*
+ * If the policy names the acceptable links explicitly and there
+ * are not too many of them, they are requested one by one with
+ * RTM_GETLINK instead of dumping all links of the system.
+ */
+struct link_req {
+	const char *     lr_name;
+	int              lr_index;
+	uint32_t         lr_seq;
+	int              lr_pending;
+	int              lr_valid;
+	struct rtnl_link lr_link;
+};
+
+static int req_fd = -1;
+static uint32_t req_seq;
+static struct link_req *link_reqs;
+static int nlink_reqs;
+
+/*
+ * The link is referred to by index, lookup_intf() may move the
+ * interface table while the tree is being walked.
+ */
 struct xdata {
-	intf_t *intf;
+	int link_index;
 	struct rtnl_link *link;
 	int level;
 	int parent;
+	int classes;
+};
+
+/*
+ * Per link summary of the qdisc dump, rebuilt every read. Entries
+ * are taken from a pool and chained by pool index so the pool can
+ * grow without invalidating the hash chains.
+ */
+struct tc_link {
+	int  tl_index;
+	int  tl_nqdiscs;
+	int  tl_classful;
+	int  tl_next;
 };
 
+static int tc_support;
+static int tc_link_hash[LINK_HASH_SIZE];
+static struct tc_link *tc_link_pool;
+static int tc_link_pool_size;
+static int tc_link_pool_used;
+
+/*
+ * (ifindex, parent handle) -> children index over the qdisc and
+ * class caches, rebuilt whenever the cache is refreshed so that the
+ * tree can be walked without rescanning the whole cache for every
+ * node. Children of a parent are chained in cache order.
+ */
+struct tc_child {
+	int                tc_ifindex;
+	uint32_t           tc_parent;
+	struct nl_common * tc_obj;
+	int                tc_next;
+};
+
+struct tc_index {
+	int *              ti_hash;
+	int                ti_hash_size;
+	struct tc_child *  ti_pool;
+	int                ti_size;
+	int                ti_used;
+};
+
+static struct tc_index qdisc_index;
+static struct tc_index class_index;
+
 static void find_sub_classes(struct xdata *, int, uint32_t);
 static void find_sub_qdiscs(struct xdata *, int, uint32_t);
 
+static inline int
+tc_index_hash(struct tc_index *ti, int ifindex, uint32_t parent)
+{
+	uint32_t h = (parent ^ (parent >> 16)) * 0x45d9f3bU;
+
+	return (h ^ (uint32_t) ifindex) & (ti->ti_hash_size - 1);
+}
+
+static void
+tc_index_add(struct tc_index *ti, int ifindex, uint32_t parent,
+	struct nl_common *obj)
+{
+	struct tc_child *c;
+
+	if (ti->ti_used >= ti->ti_size) {
+		ti->ti_size = ti->ti_size ? ti->ti_size * 2 : 64;
+		ti->ti_pool = xrealloc(ti->ti_pool,
+			ti->ti_size * sizeof(struct tc_child));
+	}
+
+	c = &ti->ti_pool[ti->ti_used++];
+	c->tc_ifindex = ifindex;
+	c->tc_parent = parent;
+	c->tc_obj = obj;
+	c->tc_next = 0;
+}
+
+static void
+tc_index_link(struct tc_index *ti)
+{
+	int n, size = 16;
+
+	while (size < ti->ti_used)
+		size <<= 1;
+
+	if (size != ti->ti_hash_size) {
+		xfree(ti->ti_hash);
+		ti->ti_hash = xcalloc(size, sizeof(int));
+		ti->ti_hash_size = size;
+	} else
+		memset(ti->ti_hash, 0, size * sizeof(int));
+
+	for (n = ti->ti_used; n > 0; n--) {
+		struct tc_child *c = &ti->ti_pool[n - 1];
+		int h = tc_index_hash(ti, c->tc_ifindex, c->tc_parent);
+
+		c->tc_next = ti->ti_hash[h];
+		ti->ti_hash[h] = n;
+	}
+}
+
+static void
+tc_index_walk(struct tc_index *ti, int ifindex, uint32_t parent,
+	void (*cb)(struct nl_common *, void *), void *arg)
+{
+	int n;
+
+	if (0 == ti->ti_hash_size)
+		return;
+
+	for (n = ti->ti_hash[tc_index_hash(ti, ifindex, parent)]; n; ) {
+		struct tc_child *c = &ti->ti_pool[n - 1];
+
+		n = c->tc_next;
+		if (c->tc_ifindex == ifindex && c->tc_parent == parent)
+			cb(c->tc_obj, arg);
+	}
+}
+
+static void
+index_class(struct nl_common *c, void *arg)
+{
+	struct rtnl_class *class = (struct rtnl_class *) c;
+
+	tc_index_add(&class_index, class->tc_ifindex, class->tc_parent, c);
+}
+
 static void
 handle_class(struct nl_common *c, void *arg)
 {
@@ -71,6 +234,7 @@ handle_class(struct nl_common *c, void *arg)
 	struct xdata *x = arg;
 	intf_t *intf;
 	char name[IFNAMSIZ];
+	int index;
 
 	snprintf(name, sizeof(name), "c:%s %s", class->tc_kind,
 		nl_handle2str(class->tc_handle));
@@ -81,7 +245,10 @@ handle_class(struct nl_common *c, void *arg)
 	if (NULL == intf)
 		return;
 
-	intf->i_link = x->intf->i_index;
+	/* sub qdiscs may move the interface array, intf is stale after */
+	index = intf->i_index;
+
+	intf->i_link = x->link_index;
 	intf->i_is_child = 1;
 	intf->i_level = x->level;
 	intf->i_tx_packets.r_total = class->tc_stats.tcs_basic.packets;
@@ -100,28 +267,27 @@ handle_class(struct nl_common *c, void *arg)
 
 	if (class->tc_info) {
 		/* Class has qdisc attached */
-		find_sub_qdiscs(x, intf->i_index, class->tc_handle);
+		find_sub_qdiscs(x, index, class->tc_handle);
 	}
 
-	find_sub_classes(x, intf->i_index, class->tc_handle);
+	find_sub_classes(x, index, class->tc_handle);
 }
 
 static void
 find_sub_classes(struct xdata *x, int parent, uint32_t parent_handle)
 {
-	struct rtnl_class filter = RTNL_INIT_CLASS();
-
 	struct xdata xn = {
-		.intf = x->intf,
+		.link_index = x->link_index,
 		.link = x->link,
 		.level = x->level + 1,
 		.parent = parent,
+		.classes = x->classes,
 	};
 
-	rtnl_class_set_parent(&filter, parent_handle);
-	rtnl_class_set_ifindex(&filter, x->link->l_index);
+	if (!x->classes)
+		return;
 
-	nl_cache_foreach_filter(&class_cache, (struct nl_common *) &filter,
+	tc_index_walk(&class_index, x->link->l_index, parent_handle,
 		handle_class, &xn);
 }
 
@@ -142,7 +308,7 @@ handle_qdisc(struct nl_common *c, void *arg)
 	if (NULL == intf)
 		return;
 
-	intf->i_link = x->intf->i_index;
+	intf->i_link = x->link_index;
 	intf->i_is_child = 1;
 	intf->i_level = x->level;
 	if (0xffff0000 == qdisc->tc_handle) {
@@ -176,43 +342,480 @@ handle_qdisc(struct nl_common *c, void *arg)
 static void
 find_sub_qdiscs(struct xdata *x, int parent, uint32_t parent_handle)
 {
-	struct rtnl_qdisc filter = RTNL_INIT_QDISC();
-
 	struct xdata xn = {
-		.intf = x->intf,
+		.link_index = x->link_index,
 		.link = x->link,
 		.level = x->level + 1,
 		.parent = parent,
+		.classes = x->classes,
 	};
 
-	rtnl_qdisc_set_parent(&filter, parent_handle);
-	rtnl_qdisc_set_ifindex(&filter, x->link->l_index);
-	nl_cache_foreach_filter(&qdisc_cache, (struct nl_common *) &filter,
-			handle_qdisc, &xn);
+	tc_index_walk(&qdisc_index, x->link->l_index, parent_handle,
+		handle_qdisc, &xn);
+}
+
+static struct tc_link *
+lookup_tc_link(int ifindex, int creat)
+{
+	struct tc_link *tl;
+	int n, h = ifindex % LINK_HASH_SIZE;
+
+	for (n = tc_link_hash[h]; n; n = tl->tl_next) {
+		tl = &tc_link_pool[n - 1];
+		if (tl->tl_index == ifindex)
+			return tl;
+	}
+
+	if (!creat)
+		return NULL;
+
+	if (tc_link_pool_used >= tc_link_pool_size) {
+		tc_link_pool_size += 64;
+		tc_link_pool = xrealloc(tc_link_pool,
+			tc_link_pool_size * sizeof(struct tc_link));
+	}
+
+	tl = &tc_link_pool[tc_link_pool_used++];
+	memset(tl, 0, sizeof(*tl));
+	tl->tl_index = ifindex;
+	tl->tl_next = tc_link_hash[h];
+	tc_link_hash[h] = tc_link_pool_used;
+
+	return tl;
+}
+
+static void
+index_qdisc(struct nl_common *c, void *arg)
+{
+	struct rtnl_qdisc *qdisc = (struct rtnl_qdisc *) c;
+	struct tc_link *tl = lookup_tc_link(qdisc->tc_ifindex, 1);
+	uint32_t parent = qdisc->tc_parent;
+
+	/* newer kernels report root qdiscs with parent TC_H_ROOT */
+	if (TC_H_ROOT == parent)
+		parent = TC_H_UNSPEC;
+
+	tc_index_add(&qdisc_index, qdisc->tc_ifindex, parent, c);
+
+	tl->tl_nqdiscs++;
+
+	/*
+	 * A lone default qdisc (pfifo_fast 0:, fq_codel 0:, ...) has no
+	 * classes, everything else might.
+	 */
+	if (qdisc->tc_handle || tl->tl_nqdiscs > 1)
+		tl->tl_classful = 1;
+}
+
+/*
+ * Fetch the qdiscs of all links with a single dump per read and
+ * summarize them per link. The kernel only dumps classes of one
+ * device at a time so classes are still fetched per link, but only
+ * for links which carry a classful qdisc.
+ */
+static void
+update_tc(void)
+{
+	memset(tc_link_hash, 0, sizeof(tc_link_hash));
+	tc_link_pool_used = 0;
+	qdisc_index.ti_used = 0;
+
+	QDISC_CACHE_IFINDEX(&qdisc_cache) = 0;
+	tc_support = nl_cache_update(&nl_h, &qdisc_cache) >= 0;
+
+	if (tc_support)
+		nl_cache_foreach(&qdisc_cache, index_qdisc, NULL);
+
+	tc_index_link(&qdisc_index);
+}
+
+/*
+ * With an explicit link list the qdisc dump is avoided as well, the
+ * kernel does not filter qdisc dumps by link. The root and ingress
+ * qdisc of each requested link are fetched with RTM_GETQDISC, the
+ * qdiscs below classes are fetched per class once the classes of
+ * the link are known. The replies are kept in a pool which replaces
+ * the qdisc cache for the walk.
+ */
+struct tc_req {
+	char *   tr_buf;
+	size_t   tr_size;
+	int      tr_off;
+	int      tr_n;
+	int      tr_ifindex;
+};
+
+static struct rtnl_qdisc *req_qdiscs;
+static int req_nqdiscs;
+static int req_qdiscs_size;
+
+static void
+add_qdisc_req(struct tc_req *tr, uint32_t parent)
+{
+	struct nlmsghdr *n;
+	struct tcmsg *tcm;
+
+	if (tr->tr_off + NLMSG_SPACE(sizeof(*tcm)) > tr->tr_size) {
+		tr->tr_size = tr->tr_size ? tr->tr_size * 2 : 16384;
+		tr->tr_buf = xrealloc(tr->tr_buf, tr->tr_size);
+	}
+
+	n = (struct nlmsghdr *) (tr->tr_buf + tr->tr_off);
+	memset(n, 0, NLMSG_SPACE(sizeof(*tcm)));
+	n->nlmsg_len = NLMSG_LENGTH(sizeof(*tcm));
+	n->nlmsg_type = RTM_GETQDISC;
+	/* the qdisc is only sent back if echoed, the ack ends each request */
+	n->nlmsg_flags = NLM_F_REQUEST | NLM_F_ECHO | NLM_F_ACK;
+	n->nlmsg_seq = ++req_seq;
+
+	tcm = NLMSG_DATA(n);
+	tcm->tcm_family = AF_UNSPEC;
+	tcm->tcm_ifindex = tr->tr_ifindex;
+	tcm->tcm_parent = parent;
+
+	tr->tr_off += NLMSG_ALIGN(n->nlmsg_len);
+	tr->tr_n++;
+}
+
+static void
+add_leaf_req(struct nl_common *c, void *arg)
+{
+	struct rtnl_class *class = (struct rtnl_class *) c;
+
+	add_qdisc_req(arg, class->tc_handle);
+}
+
+static void
+parse_qdisc_stats2(struct rtnl_qdisc *q, struct rtattr *nest)
+{
+	struct rtattr *rta;
+	int len = RTA_PAYLOAD(nest);
+
+	for (rta = RTA_DATA(nest); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+			case TCA_STATS_BASIC:
+				if (RTA_PAYLOAD(rta) >= sizeof(struct gnet_stats_basic)) {
+					struct gnet_stats_basic b;
+
+					memcpy(&b, RTA_DATA(rta), sizeof(b));
+					q->tc_stats.tcs_basic.bytes = b.bytes;
+					q->tc_stats.tcs_basic.packets = b.packets;
+				}
+				break;
+
+			case TCA_STATS_QUEUE:
+				if (RTA_PAYLOAD(rta) >= sizeof(struct gnet_stats_queue)) {
+					struct gnet_stats_queue qs;
+
+					memcpy(&qs, RTA_DATA(rta), sizeof(qs));
+					q->tc_stats.tcs_queue.qlen = qs.qlen;
+					q->tc_stats.tcs_queue.backlog = qs.backlog;
+					q->tc_stats.tcs_queue.drops = qs.drops;
+					q->tc_stats.tcs_queue.requeues = qs.requeues;
+					q->tc_stats.tcs_queue.overlimits = qs.overlimits;
+				}
+				break;
+
+			case TCA_STATS_RATE_EST:
+				if (RTA_PAYLOAD(rta) >= sizeof(struct gnet_stats_rate_est)) {
+					struct gnet_stats_rate_est r;
+
+					memcpy(&r, RTA_DATA(rta), sizeof(r));
+					q->tc_stats.tcs_rate_est.bps = r.bps;
+					q->tc_stats.tcs_rate_est.pps = r.pps;
+				}
+				break;
+		}
+	}
+}
+
+static void
+handle_qdisc_reply(struct nlmsghdr *n, int leaf)
+{
+	struct tcmsg *tcm = NLMSG_DATA(n);
+	struct rtnl_qdisc *q;
+	struct rtattr *rta;
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*tcm));
+
+	/* the builtin default qdisc of a class is not dumped either */
+	if (len < 0 || (leaf && !tcm->tcm_handle))
+		return;
+
+	if (req_nqdiscs >= req_qdiscs_size) {
+		req_qdiscs_size = req_qdiscs_size ? req_qdiscs_size * 2 : 16;
+		req_qdiscs = xrealloc(req_qdiscs,
+			req_qdiscs_size * sizeof(struct rtnl_qdisc));
+	}
+
+	q = &req_qdiscs[req_nqdiscs++];
+	memset(q, 0, sizeof(*q));
+	q->tc_ifindex = tcm->tcm_ifindex;
+	q->tc_handle = tcm->tcm_handle;
+	q->tc_parent = tcm->tcm_parent;
+
+	for (rta = TCA_RTA(tcm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+			case TCA_KIND:
+				snprintf(q->tc_kind, sizeof(q->tc_kind), "%s",
+					(char *) RTA_DATA(rta));
+				break;
+
+			case TCA_STATS2:
+				parse_qdisc_stats2(q, rta);
+				break;
+		}
+	}
+}
+
+/*
+ * Every request is answered by the qdisc, if there is one, followed
+ * by an ack or error. Requests with a sequence number of first +
+ * nroot and above ask for qdiscs below classes.
+ */
+static void
+send_qdisc_reqs(struct tc_req *tr, int nroot)
+{
+	uint32_t first = req_seq - tr->tr_n + 1;
+	int len, pending = tr->tr_n;
+	struct nlmsghdr *n;
+
+	if (0 == pending)
+		return;
+
+	if (send(req_fd, tr->tr_buf, tr->tr_off, 0) < 0)
+		quit("Unable to request qdiscs: %s\n", strerror(errno));
+
+	while (pending > 0) {
+		len = recv(req_fd, tr->tr_buf, tr->tr_size, 0);
+
+		if (len < 0) {
+			if (EINTR == errno)
+				continue;
+			/* timed out, take what we have */
+			return;
+		}
+
+		for (n = (struct nlmsghdr *) tr->tr_buf; NLMSG_OK(n, len);
+			n = NLMSG_NEXT(n, len)) {
+			if (n->nlmsg_seq - first >= (uint32_t) tr->tr_n)
+				continue;
+
+			if (NLMSG_ERROR == n->nlmsg_type)
+				pending--;
+			else if (RTM_NEWQDISC == n->nlmsg_type)
+				handle_qdisc_reply(n,
+					n->nlmsg_seq - first >= (uint32_t) nroot);
+		}
+	}
+}
+
+static void
+index_req_qdiscs(void)
+{
+	int i;
+
+	memset(tc_link_hash, 0, sizeof(tc_link_hash));
+	tc_link_pool_used = 0;
+	qdisc_index.ti_used = 0;
+
+	for (i = 0; i < req_nqdiscs; i++)
+		index_qdisc((struct nl_common *) &req_qdiscs[i], NULL);
+
+	tc_index_link(&qdisc_index);
+}
+
+static void
+request_tc(int ifindex)
+{
+	static struct tc_req tr;
+
+	tr.tr_off = tr.tr_n = 0;
+	tr.tr_ifindex = ifindex;
+	req_nqdiscs = 0;
+
+	add_qdisc_req(&tr, TC_H_ROOT);
+	add_qdisc_req(&tr, TC_H_INGRESS);
+	send_qdisc_reqs(&tr, 2);
+
+	index_req_qdiscs();
+}
+
+static void
+request_leaf_qdiscs(int ifindex)
+{
+	static struct tc_req tr;
+
+	tr.tr_off = tr.tr_n = 0;
+	tr.tr_ifindex = ifindex;
+
+	nl_cache_foreach(&class_cache, add_leaf_req, &tr);
+	send_qdisc_reqs(&tr, 0);
+
+	/* the pool may have moved, rebuild the index */
+	index_req_qdiscs();
 }
 
 static void
 handle_tc(intf_t *intf, struct rtnl_link *link)
 {
-	int adv_router_support = 1;
+	struct tc_link *tl;
+	int index = intf->i_index;
 	struct xdata x = {
 		.level = 0,
-		.intf = intf,
+		.link_index = index,
 		.link = link,
-		.parent = intf->i_index,
+		.parent = index,
 	};
 
-	QDISC_CACHE_IFINDEX(&qdisc_cache) = link->l_index;
-	if (nl_cache_update(&nl_h, &qdisc_cache) < 0)
-		adv_router_support = 0;
+	if (req_fd >= 0)
+		request_tc(link->l_index);
+
+	if (!tc_support || !(tl = lookup_tc_link(link->l_index, 0)))
+		return;
+
+	if (tl->tl_classful) {
+		CLASS_CACHE_IFINDEX(&class_cache) = link->l_index;
+		x.classes = nl_cache_update(&nl_h, &class_cache) >= 0;
+
+		class_index.ti_used = 0;
+		if (x.classes)
+			nl_cache_foreach(&class_cache, index_class, NULL);
+		tc_index_link(&class_index);
+
+		if (req_fd >= 0 && x.classes)
+			request_leaf_qdiscs(link->l_index);
+	}
+
+	/* the first walk may move the interface array, intf is stale after */
+	find_sub_qdiscs(&x, index, TC_H_UNSPEC);
+	find_sub_qdiscs(&x, index, TC_H_INGRESS);
+}
+
+static struct link_name *
+lookup_link_name(int ifindex, int creat)
+{
+	struct link_name *ln;
+	int h = ifindex % LINK_HASH_SIZE;
+
+	for (ln = link_names[h]; ln; ln = ln->ln_next)
+		if (ln->ln_index == ifindex)
+			return ln;
+
+	if (!creat)
+		return NULL;
+
+	ln = xcalloc(1, sizeof(*ln));
+	ln->ln_index = ifindex;
+	ln->ln_next = link_names[h];
+	link_names[h] = ln;
+
+	return ln;
+}
+
+static void
+forget_link_name(int ifindex)
+{
+	struct link_name **pp, *ln;
+
+	for (pp = &link_names[ifindex % LINK_HASH_SIZE]; (ln = *pp); pp = &ln->ln_next) {
+		if (ln->ln_index == ifindex) {
+			*pp = ln->ln_next;
+			xfree(ln);
+			return;
+		}
+	}
+}
+
+static void
+handle_link_event(struct nlmsghdr *n)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *rta;
+	struct link_name *ln;
+	int len = IFLA_PAYLOAD(n);
+	const char *name = NULL;
+	intf_t *intf;
+
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+		if (IFLA_IFNAME == rta->rta_type)
+			name = RTA_DATA(rta);
+
+	if (NULL == name || !name[0])
+		return;
+
+	switch (n->nlmsg_type) {
+		case RTM_NEWLINK:
+			ln = lookup_link_name(ifi->ifi_index, 1);
+
+			if (ln->ln_name[0] && strcmp(ln->ln_name, name)) {
+				/* renamed, keep counters and history */
+				intf = get_intf_by_name(get_local_node(), ln->ln_name);
+
+				if (intf) {
+					if (get_intf_by_name(get_local_node(), name))
+						remove_intf(intf);
+					else
+						rename_intf(intf, name);
+				}
+			}
+
+			strncpy(ln->ln_name, name, sizeof(ln->ln_name) - 1);
+			break;
+
+		case RTM_DELLINK:
+			forget_link_name(ifi->ifi_index);
+
+			if ((intf = get_intf_by_name(get_local_node(), name)))
+				remove_intf(intf);
+			break;
+	}
+}
+
+static void
+read_link_events(void)
+{
+	char buf[16384];
+	struct nlmsghdr *n;
+	int len;
+
+	for (;;) {
+		len = recv(ev_fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+		if (len < 0) {
+			/*
+			 * ENOBUFS: events have been lost, the interfaces
+			 * affected will still be expired via their lifetime.
+			 */
+			if (ENOBUFS == errno || EINTR == errno)
+				continue;
+			return;
+		}
+
+		if (0 == len)
+			return;
+
+		for (n = (struct nlmsghdr *) buf; NLMSG_OK(n, len);
+			n = NLMSG_NEXT(n, len))
+			if (RTM_NEWLINK == n->nlmsg_type ||
+				RTM_DELLINK == n->nlmsg_type)
+				handle_link_event(n);
+	}
+}
+
+static void
+open_event_socket(void)
+{
+	struct sockaddr_nl snl = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK,
+	};
 
-	CLASS_CACHE_IFINDEX(&class_cache) = link->l_index;
-	if (nl_cache_update(&nl_h, &class_cache) < 0)
-		adv_router_support = 0;
+	if ((ev_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0)
+		return;
 
-	if (adv_router_support) {
-		find_sub_qdiscs(&x, intf->i_index, TC_H_UNSPEC);
-		find_sub_qdiscs(&x, intf->i_index, TC_H_INGRESS);
+	if (bind(ev_fd, (struct sockaddr *) &snl, sizeof(snl)) < 0) {
+		close(ev_fd);
+		ev_fd = -1;
 	}
 }
 
@@ -221,11 +824,17 @@ do_link(struct nl_common *item, void *arg)
 {
 	struct rtnl_link *link = (struct rtnl_link *) item;
 	struct rtnl_lstats *st;
+	struct link_name *ln;
 	intf_t *intf;
 
 	if (!link->l_name[0])
 		return;
 
+	if (ev_fd >= 0) {
+		ln = lookup_link_name(link->l_index, 1);
+		strncpy(ln->ln_name, link->l_name, sizeof(ln->ln_name) - 1);
+	}
+
 	if (get_show_only_running() && !(link->l_flags & IFF_UP))
 		return;
 
@@ -266,16 +875,233 @@ do_link(struct nl_common *item, void *arg)
 	update_attr(intf, WINDOW_ERRORS, 0, st->ls_tx_window_errors, TX_PROVIDED);
 	update_attr(intf, CARRIER_ERRORS, 0, st->ls_tx_carrier_errors, TX_PROVIDED);
 
-	if (!c_notc)
+	if (!c_notc) {
+		int index = intf->i_index;
+
 		handle_tc(intf, link);
+		intf = get_intf(get_local_node(), index);
+	}
 	
 	notify_update(intf);
 	increase_lifetime(intf, 1);
 }
 
+static void
+add_rtattr(struct nlmsghdr *n, int type, const void *data, int len)
+{
+	struct rtattr *rta = (struct rtattr *) (((char *) n) + NLMSG_ALIGN(n->nlmsg_len));
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+#define FILL_LSTATS(dst, src)						\
+	do {								\
+		(dst)->ls_rx.bytes = (src)->rx_bytes;			\
+		(dst)->ls_rx.packets = (src)->rx_packets;		\
+		(dst)->ls_rx.errors = (src)->rx_errors;			\
+		(dst)->ls_rx.dropped = (src)->rx_dropped;		\
+		(dst)->ls_rx.compressed = (src)->rx_compressed;		\
+		(dst)->ls_rx.multicast = (src)->multicast;		\
+		(dst)->ls_tx.bytes = (src)->tx_bytes;			\
+		(dst)->ls_tx.packets = (src)->tx_packets;		\
+		(dst)->ls_tx.errors = (src)->tx_errors;			\
+		(dst)->ls_tx.dropped = (src)->tx_dropped;		\
+		(dst)->ls_tx.compressed = (src)->tx_compressed;		\
+		(dst)->ls_rx_fifo_errors = (src)->rx_fifo_errors;	\
+		(dst)->ls_tx_fifo_errors = (src)->tx_fifo_errors;	\
+		(dst)->ls_tx_collisions = (src)->collisions;		\
+		(dst)->ls_rx_length_errors = (src)->rx_length_errors;	\
+		(dst)->ls_rx_over_errors = (src)->rx_over_errors;	\
+		(dst)->ls_rx_crc_errors = (src)->rx_crc_errors;		\
+		(dst)->ls_rx_frame_errors = (src)->rx_frame_errors;	\
+		(dst)->ls_rx_missed_errors = (src)->rx_missed_errors;	\
+		(dst)->ls_tx_aborted_errors = (src)->tx_aborted_errors;	\
+		(dst)->ls_tx_heartbeat_errors = (src)->tx_heartbeat_errors; \
+		(dst)->ls_tx_window_errors = (src)->tx_window_errors;	\
+		(dst)->ls_tx_carrier_errors = (src)->tx_carrier_errors;	\
+	} while (0)
+
+static void
+handle_link_reply(struct link_req *lr, struct nlmsghdr *n)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtnl_link link;
+	struct rtattr *rta;
+	int len = IFLA_PAYLOAD(n), have_stats64 = 0;
+
+	memset(&link, 0, sizeof(link));
+	link.l_index = ifi->ifi_index;
+	link.l_flags = ifi->ifi_flags;
+
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+			case IFLA_IFNAME:
+				strncpy(link.l_name, RTA_DATA(rta),
+					sizeof(link.l_name) - 1);
+				break;
+
+			case IFLA_STATS64:
+				if (RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats64)) {
+					FILL_LSTATS(&link.l_stats,
+						(struct rtnl_link_stats64 *) RTA_DATA(rta));
+					have_stats64 = 1;
+				}
+				break;
+
+			case IFLA_STATS:
+				if (!have_stats64 &&
+					RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats))
+					FILL_LSTATS(&link.l_stats,
+						(struct rtnl_link_stats *) RTA_DATA(rta));
+				break;
+		}
+	}
+
+	/* renamed behind our back, look it up by name again next time */
+	if (strcmp(link.l_name, lr->lr_name)) {
+		lr->lr_index = 0;
+		return;
+	}
+
+	lr->lr_index = link.l_index;
+	lr->lr_link = link;
+	lr->lr_valid = 1;
+}
+
+static void
+request_links(void)
+{
+	static char *buf;
+	static size_t bufsize;
+	struct nlmsghdr *n;
+	int i, len, pending = 0, off = 0;
+
+	if (NULL == buf) {
+		bufsize = nlink_reqs * NLMSG_SPACE(sizeof(struct ifinfomsg) +
+			RTA_SPACE(IFNAMSIZ));
+		if (bufsize < 16384)
+			bufsize = 16384;
+		buf = xcalloc(1, bufsize);
+	}
+
+	for (i = 0; i < nlink_reqs; i++) {
+		struct link_req *lr = &link_reqs[i];
+		struct ifinfomsg *ifi;
+
+		n = (struct nlmsghdr *) (buf + off);
+		memset(n, 0, NLMSG_SPACE(sizeof(*ifi)));
+		n->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+		n->nlmsg_type = RTM_GETLINK;
+		n->nlmsg_flags = NLM_F_REQUEST;
+		n->nlmsg_seq = lr->lr_seq = ++req_seq;
+
+		ifi = NLMSG_DATA(n);
+		ifi->ifi_family = AF_UNSPEC;
+		ifi->ifi_index = lr->lr_index;
+
+		if (!lr->lr_index)
+			add_rtattr(n, IFLA_IFNAME, lr->lr_name, strlen(lr->lr_name) + 1);
+
+		off += NLMSG_ALIGN(n->nlmsg_len);
+		lr->lr_pending = 1;
+		lr->lr_valid = 0;
+		pending++;
+	}
+
+	if (send(req_fd, buf, off, 0) < 0)
+		quit("Unable to request links: %s\n", strerror(errno));
+
+	while (pending > 0) {
+		len = recv(req_fd, buf, bufsize, 0);
+
+		if (len < 0) {
+			if (EINTR == errno)
+				continue;
+			/* timed out, take what we have */
+			break;
+		}
+
+		for (n = (struct nlmsghdr *) buf; NLMSG_OK(n, len);
+			n = NLMSG_NEXT(n, len)) {
+			struct link_req *lr = NULL;
+
+			for (i = 0; i < nlink_reqs; i++)
+				if (link_reqs[i].lr_pending &&
+					link_reqs[i].lr_seq == n->nlmsg_seq)
+					lr = &link_reqs[i];
+
+			if (NULL == lr)
+				continue;
+
+			lr->lr_pending = 0;
+			pending--;
+
+			if (RTM_NEWLINK == n->nlmsg_type)
+				handle_link_reply(lr, n);
+			else if (NLMSG_ERROR == n->nlmsg_type)
+				lr->lr_index = 0; /* link does not exist (yet) */
+		}
+	}
+
+	/*
+	 * The links are only processed once all replies are in, the
+	 * qdisc requests of handle_tc() share the socket.
+	 */
+	for (i = 0; i < nlink_reqs; i++)
+		if (link_reqs[i].lr_valid)
+			do_link((struct nl_common *) &link_reqs[i].lr_link, NULL);
+}
+
+static void
+open_request_socket(void)
+{
+	const char **names;
+	struct timeval tv = { .tv_sec = 1 };
+	struct sockaddr_nl snl = { .nl_family = AF_NETLINK };
+	int i, n = intf_policy_names(&names);
+
+	if (n <= 0 || n > c_maxreq)
+		return;
+
+	if ((req_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0)
+		return;
+
+	if (bind(req_fd, (struct sockaddr *) &snl, sizeof(snl)) < 0 ||
+		setsockopt(req_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+		close(req_fd);
+		req_fd = -1;
+		return;
+	}
+
+	link_reqs = xcalloc(n, sizeof(struct link_req));
+	for (i = 0; i < n; i++)
+		link_reqs[i].lr_name = names[i];
+	nlink_reqs = n;
+}
+
 static void
 netlink_read(void)
 {
+	/*
+	 * Apply additions, renames and removals first, the dump below
+	 * then only refreshes the counters of the current link set.
+	 */
+	if (ev_fd >= 0)
+		read_link_events();
+
+	if (req_fd >= 0) {
+		/* qdiscs are requested per link by handle_tc() */
+		tc_support = 1;
+		request_links();
+		return;
+	}
+
+	if (!c_notc)
+		update_tc();
+
 	if (nl_cache_update(&nl_h, &link_cache) < 0)
 		quit("%s\n", nl_geterror());
 
@@ -286,6 +1112,16 @@ static void
 netlink_shutdown(void)
 {
 	nl_close(&nl_h);
+
+	if (ev_fd >= 0) {
+		close(ev_fd);
+		ev_fd = -1;
+	}
+
+	if (req_fd >= 0) {
+		close(req_fd);
+		req_fd = -1;
+	}
 }
 
 static void
@@ -295,6 +1131,11 @@ netlink_do_init(void)
 		quit("%s\n", nl_geterror());
 
 	nl_use_default_handlers(&nl_h);
+
+	if (!c_noevents)
+		open_event_socket();
+
+	open_request_socket();
 }
 
 static int
@@ -323,7 +1164,13 @@ print_help(void)
 		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
 		"\n" \
 		"  Options:\n" \
-		"    notc           Do not collect traffic control statistics\n");
+		"    notc           Do not collect traffic control statistics\n" \
+		"    noevents       Do not listen for link events, expire removed\n" \
+		"                   links via their lifetime only\n" \
+		"    maxreq=NUM     Request links named in the policy and their\n" \
+		"                   qdiscs one by one instead of dumping all links\n" \
+		"                   and qdiscs if there are no more than NUM of\n" \
+		"                   them (default: 16, 0: never)\n");
 }
 
 static void
@@ -332,6 +1179,10 @@ netlink_set_opts(tv_t *attrs)
 	while (attrs) {
 		if (!strcasecmp(attrs->type, "notc"))
 			c_notc = 1;
+		else if (!strcasecmp(attrs->type, "noevents"))
+			c_noevents = 1;
+		else if (!strcasecmp(attrs->type, "maxreq") && attrs->value)
+			c_maxreq = strtol(attrs->value, NULL, 0);
 		else if (!strcasecmp(attrs->type, "help")) {
 			print_help();
 			exit(0);
@@ -0,0 +1,363 @@
+/*
+ * in_netns.c            Network namespace input (Linux)
+ *
+ * Copyright (c) 2001-2004 Thomas Graf <tgraf@suug.ch>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE /* setns */
+
+#include <bmon/bmon.h>
+#include <bmon/input.h>
+#include <bmon/node.h>
+#include <bmon/intf.h>
+#include <bmon/utils.h>
+
+#if defined SYS_LINUX && defined HAVE_PTHREAD
+
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+
+#ifndef CLONE_NEWNET
+#define CLONE_NEWNET 0x40000000
+#endif
+
+static char *c_dir = "/var/run/netns";
+static int c_pids = 1;
+static int c_rescan = 10;
+
+/*
+ * A namespace is identified by the device and inode of its nsfs file,
+ * no matter how many processes share it or under how many names it was
+ * found. The namespace fd is kept open to enter it again, the net/dev
+ * file is opened once from within the namespace and stays bound to it.
+ */
+struct netns
+{
+	dev_t		ns_dev;
+	ino_t		ns_ino;
+	int		ns_fd;
+	int		ns_seen;
+	char *		ns_name;
+	char *		ns_from;
+	stat_file_t	ns_stats;
+	char *		ns_buf;
+	struct netns *	ns_next;
+};
+
+static struct netns *ns_list;
+static struct stat self_ns;
+static char *task_path;
+static int generation;
+static int rescan_rem;
+
+static pthread_t collector;
+static pthread_mutex_t ns_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ns_cond = PTHREAD_COND_INITIALIZER;
+static int ns_request, ns_done;
+
+static struct netns *
+find_ns(struct stat *st)
+{
+	struct netns *ns;
+
+	for (ns = ns_list; ns; ns = ns->ns_next)
+		if (ns->ns_dev == st->st_dev && ns->ns_ino == st->st_ino)
+			return ns;
+
+	return NULL;
+}
+
+static void
+add_ns(const char *path, const char *name)
+{
+	struct netns *ns;
+	struct stat st;
+	int fd;
+
+	if (stat(path, &st) < 0)
+		return;
+
+	/* our own namespace is the local node */
+	if (st.st_dev == self_ns.st_dev && st.st_ino == self_ns.st_ino)
+		return;
+
+	if ((ns = find_ns(&st))) {
+		ns->ns_seen = generation;
+		return;
+	}
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return;
+
+	ns = xcalloc(1, sizeof(*ns));
+	ns->ns_dev = st.st_dev;
+	ns->ns_ino = st.st_ino;
+	ns->ns_fd = fd;
+	ns->ns_seen = generation;
+	ns->ns_name = strdup(name);
+	ns->ns_from = strdup(path);
+	ns->ns_stats.sf_path = task_path;
+	ns->ns_stats.sf_fd = -1;
+
+	ns->ns_next = ns_list;
+	ns_list = ns;
+}
+
+static void
+free_ns(struct netns *ns)
+{
+	close(ns->ns_fd);
+	stat_file_close(&ns->ns_stats);
+	xfree(ns->ns_name);
+	xfree(ns->ns_from);
+	xfree(ns);
+}
+
+static void
+scan_named(void)
+{
+	DIR *d;
+	struct dirent *de;
+	char path[FILENAME_MAX], name[FILENAME_MAX];
+
+	if (!(d = opendir(c_dir)))
+		return;
+
+	while ((de = readdir(d))) {
+		if ('.' == de->d_name[0])
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", c_dir, de->d_name);
+		snprintf(name, sizeof(name), "netns/%s", de->d_name);
+		add_ns(path, name);
+	}
+
+	closedir(d);
+}
+
+static void
+scan_pids(void)
+{
+	DIR *d;
+	struct dirent *de;
+	char path[FILENAME_MAX], name[FILENAME_MAX], comm[64];
+
+	if (!(d = opendir("/proc")))
+		return;
+
+	while ((de = readdir(d))) {
+		FILE *f;
+
+		if (!isdigit((unsigned char) de->d_name[0]))
+			continue;
+
+		comm[0] = '\0';
+		snprintf(path, sizeof(path), "/proc/%s/comm", de->d_name);
+		if ((f = fopen(path, "r"))) {
+			if (fgets(comm, sizeof(comm), f))
+				comm[strcspn(comm, "\n")] = '\0';
+			fclose(f);
+		}
+
+		snprintf(path, sizeof(path), "/proc/%s/ns/net", de->d_name);
+		snprintf(name, sizeof(name), "netns/%s-%s",
+			comm[0] ? comm : "pid", de->d_name);
+		add_ns(path, name);
+	}
+
+	closedir(d);
+}
+
+/*
+ * Named namespaces are scanned first so they keep their name if
+ * processes live in them as well.
+ */
+static void
+scan_namespaces(void)
+{
+	struct netns **pp, *ns;
+
+	generation++;
+
+	scan_named();
+	if (c_pids)
+		scan_pids();
+
+	for (pp = &ns_list; (ns = *pp); ) {
+		if (ns->ns_seen != generation) {
+			*pp = ns->ns_next;
+			free_ns(ns);
+		} else
+			pp = &ns->ns_next;
+	}
+}
+
+static void
+collect(void)
+{
+	struct netns *ns;
+
+	if (rescan_rem-- <= 0) {
+		scan_namespaces();
+		rescan_rem = c_rescan - 1;
+	}
+
+	for (ns = ns_list; ns; ns = ns->ns_next) {
+		if (ns->ns_stats.sf_fd < 0 && setns(ns->ns_fd, CLONE_NEWNET) < 0) {
+			ns->ns_buf = NULL;
+			continue;
+		}
+
+		ns->ns_buf = stat_file_read(&ns->ns_stats);
+	}
+}
+
+/*
+ * setns() only affects the calling thread, the main thread and thus
+ * all other input modules stay in the namespace bmon was started in.
+ */
+static void *
+collector_thread(void *arg)
+{
+	char path[FILENAME_MAX];
+
+	snprintf(path, sizeof(path), "/proc/self/task/%ld/net/dev",
+		(long) syscall(SYS_gettid));
+	task_path = strdup(path);
+
+	pthread_mutex_lock(&ns_lock);
+	for (;;) {
+		while (!ns_request)
+			pthread_cond_wait(&ns_cond, &ns_lock);
+		ns_request = 0;
+		pthread_mutex_unlock(&ns_lock);
+
+		collect();
+
+		pthread_mutex_lock(&ns_lock);
+		ns_done = 1;
+		pthread_cond_broadcast(&ns_cond);
+	}
+
+	return NULL;
+}
+
+static void
+netns_read(void)
+{
+	struct netns *ns;
+
+	pthread_mutex_lock(&ns_lock);
+	ns_done = 0;
+	ns_request = 1;
+	pthread_cond_broadcast(&ns_cond);
+	while (!ns_done)
+		pthread_cond_wait(&ns_cond, &ns_lock);
+	pthread_mutex_unlock(&ns_lock);
+
+	/*
+	 * The collector is idle until the next request, the namespace
+	 * list and buffers can be used without holding the lock.
+	 */
+	for (ns = ns_list; ns; ns = ns->ns_next) {
+		node_t *node;
+
+		if (NULL == ns->ns_buf)
+			continue;
+
+		node = lookup_node(ns->ns_name, 1);
+		if (NULL == node->n_from)
+			node->n_from = strdup(ns->ns_from);
+
+		proc_net_dev_parse(node, ns->ns_buf, NULL);
+	}
+}
+
+static void
+print_help(void)
+{
+	printf(
+		"netns - Network namespace statistics (Linux)\n" \
+		"\n" \
+		"  Provides the interfaces of all other network namespaces, each\n" \
+		"  namespace is shown as separate node. Namespaces are found in\n" \
+		"  the netns directory (ip netns) and by looking at the namespace\n" \
+		"  of every process. Requires CAP_SYS_ADMIN to enter them.\n" \
+		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
+		"\n" \
+		"  Options:\n" \
+		"    dir=DIR        Directory of named namespaces (default: /var/run/netns)\n" \
+		"    nopids         Do not look for namespaces of processes\n" \
+		"    rescan=NUM     Look for new namespaces every NUM reads (default: 10)\n");
+}
+
+static void
+netns_set_opts(tv_t *attrs)
+{
+	while (attrs) {
+		if (!strcasecmp(attrs->type, "dir") && attrs->value)
+			c_dir = attrs->value;
+		else if (!strcasecmp(attrs->type, "nopids"))
+			c_pids = 0;
+		else if (!strcasecmp(attrs->type, "rescan") && attrs->value)
+			c_rescan = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "help")) {
+			print_help();
+			exit(0);
+		}
+		attrs = attrs->next;
+	}
+}
+
+static int
+netns_probe(void)
+{
+	if (stat("/proc/self/ns/net", &self_ns) < 0)
+		return 0;
+
+	return 1;
+}
+
+static void
+netns_init(void)
+{
+	if (pthread_create(&collector, NULL, collector_thread, NULL))
+		quit("Unable to start netns collector: %s\n", strerror(errno));
+}
+
+static struct input_module netns_ops = {
+	.im_name = "netns",
+	.im_read = netns_read,
+	.im_set_opts = netns_set_opts,
+	.im_probe = netns_probe,
+	.im_init = netns_init,
+};
+
+static void __init
+netns_init_module(void)
+{
+	register_secondary_input_module(&netns_ops);
+}
+
+#endif
@@ -33,16 +33,78 @@
 #include <bmon/conf.h>
 #include <bmon/utils.h>
 
-static char *c_cmd = "netstat -i -a";
+#if defined SYS_LINUX
+#include <net/if.h>
+#include <sys/ioctl.h>
+#endif
+
+static char *c_cmd;
+
+#if defined SYS_LINUX
+/*
+ * Unless a command is given, the statistics netstat would print are
+ * read from its source directly. The file is kept open and parsed in
+ * place, no process is created per read.
+ */
+static stat_file_t dev_file = STAT_FILE_INIT("/proc/net/dev");
+static int ctl_fd = -1;
+
+static int
+is_running(const char *name)
+{
+	struct ifreq ifr;
+
+	if (!get_show_only_running())
+		return 1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, sizeof(ifr.ifr_name) - 1);
+
+	if (ioctl(ctl_fd, SIOCGIFFLAGS, &ifr) < 0)
+		return 0;
+
+	return !!(ifr.ifr_flags & IFF_RUNNING);
+}
+
+static int
+native_read(void)
+{
+	char *buf;
+
+	if (c_cmd)
+		return 0;
+
+	if (ctl_fd < 0 && (ctl_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		quit("socket() failed: %s\n", strerror(errno));
+
+	if (!(buf = stat_file_read(&dev_file)))
+		quit("Unable to read %s: %s\n", dev_file.sf_path, strerror(errno));
+
+	proc_net_dev_parse(get_local_node(), buf, is_running);
+
+	return 1;
+}
+#else
+static inline int native_read(void) { return 0; }
+#endif
+
+static const char *
+get_cmd(void)
+{
+	return c_cmd ? c_cmd : "netstat -i -a";
+}
 
 static void
 netstat_read(void)
 {
 	FILE *       fd;
 	char         buf[512];
+
+	if (native_read())
+		return;
 	
-	if (!(fd = popen(c_cmd, "r")))
-		quit("popen(c_cmd) failed: %s\n", strerror(errno));
+	if (!(fd = popen(get_cmd(), "r")))
+		quit("popen(%s) failed: %s\n", get_cmd(), strerror(errno));
 
     for (; fgets(buf, sizeof(buf), fd);) {
 		char *p, *s;
@@ -130,19 +192,52 @@ netstat_read(void)
 	pclose(fd);
 }
 
+/*
+ * Looks for the command in PATH instead of running it, spawning a
+ * process just to find out whether it works is not worth it.
+ */
 static int
 netstat_probe(void)
 {
-	FILE *fd = popen(c_cmd, "r");
+	char path[FILENAME_MAX], prog[FILENAME_MAX];
+	const char *env, *p;
 
-	if (fd) {
-		pclose(fd);
-		return 1;
+#if defined SYS_LINUX
+	if (NULL == c_cmd)
+		return stat_file_read(&dev_file) != NULL;
+#endif
+
+	snprintf(prog, sizeof(prog), "%s", get_cmd());
+	prog[strcspn(prog, " \t")] = '\0';
+
+	if (strchr(prog, '/'))
+		return !access(prog, X_OK);
+
+	if (!(env = getenv("PATH")))
+		env = "/bin:/usr/bin";
+
+	for (p = env; *p; p += strspn(p, ":")) {
+		size_t n = strcspn(p, ":");
+
+		if (snprintf(path, sizeof(path), "%.*s/%s", (int) n, p, prog) <
+		    (int) sizeof(path) && !access(path, X_OK))
+			return 1;
+		p += n;
 	}
 
 	return 0;
 }
 
+static void
+netstat_shutdown(void)
+{
+#if defined SYS_LINUX
+	stat_file_close(&dev_file);
+	if (ctl_fd >= 0)
+		close(ctl_fd);
+#endif
+}
+
 static void
 print_help(void)
 {
@@ -153,6 +248,8 @@ print_help(void)
 		"  of netstat -i -a. Only the packet counters and a few error counters\n" \
 		"  are provided depending on the architecture. If all fails this could\n" \
 		"  theoretically be used to see at least some of the statistics.\n" \
+		"  On Linux the statistics are read from /proc/net/dev directly\n" \
+		"  unless a command is given, no process is spawned per read.\n" \
 		"\n" \
 		"  WARNING: The default behaviour is to start netstat -i -a without an absolute\n" \
 		"  path which means that an attacker could create an executable `netstat'\n" \
@@ -184,6 +281,7 @@ static struct input_module netstat_ops = {
 	.im_read = netstat_read,
 	.im_set_opts = netstat_set_opts,
 	.im_probe = netstat_probe,
+	.im_shutdown = netstat_shutdown,
 	.im_no_default = 1,
 };
 
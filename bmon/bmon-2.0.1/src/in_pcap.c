@@ -0,0 +1,577 @@
+/*
+ * in_pcap.c            pcap/pcapng replay input
+ *
+ * Copyright (c) 2001-2004 Thomas Graf <tgraf@suug.ch>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <bmon/bmon.h>
+#include <bmon/input.h>
+#include <bmon/node.h>
+#include <bmon/intf.h>
+#include <bmon/flow.h>
+#include <bmon/utils.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define PCAPNG_SHB		0x0a0d0d0a
+#define PCAPNG_IDB		1
+#define PCAPNG_PB		2
+#define PCAPNG_SPB		3
+#define PCAPNG_EPB		6
+#define PCAPNG_BYTE_ORDER	0x1a2b3c4d
+
+static char *c_file;
+static char *c_name = "pcap";
+static float c_speed = 0.0f;
+static int c_flows = 0;
+static int c_hosts = 0;
+static int c_top = 10;
+static int c_max = 4096;
+
+struct pcap_if
+{
+	char		pi_name[IFNAME_MAX];
+	int		pi_link;
+	uint64_t	pi_tsresol;
+	b_cnt_t		pi_rx_bytes;
+	b_cnt_t		pi_tx_bytes;
+	b_cnt_t		pi_rx_packets;
+	b_cnt_t		pi_tx_packets;
+	flow_table_t	pi_flows;
+};
+
+struct packet
+{
+	int		p_if;
+	uint64_t	p_ts;		/* usec */
+	const uint8_t *	p_data;
+	size_t		p_caplen;
+	size_t		p_len;
+	int		p_tx;
+};
+
+static const uint8_t *map;
+static size_t map_size, map_off;
+static int swapped, is_ng, eof;
+static uint64_t last_ts, cap_start;
+static timestamp_t wall_start;
+
+/* interfaces of all sections, packets refer to them per section */
+static struct pcap_if *ifs;
+static int nifs, if_base;
+
+static inline uint32_t
+get32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return swapped ? __builtin_bswap32(v) : v;
+}
+
+static inline uint16_t
+get16(const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return swapped ? __builtin_bswap16(v) : v;
+}
+
+static struct pcap_if *
+add_if(int link)
+{
+	struct pcap_if *pi;
+
+	ifs = xrealloc(ifs, (nifs + 1) * sizeof(*ifs));
+	pi = &ifs[nifs];
+	memset(pi, 0, sizeof(*pi));
+
+	snprintf(pi->pi_name, sizeof(pi->pi_name), "%s%d", c_name, nifs);
+	pi->pi_link = link;
+	pi->pi_tsresol = 1000000;
+
+	if (c_flows)
+		flow_table_init(&pi->pi_flows, c_max);
+
+	nifs++;
+
+	return pi;
+}
+
+/*
+ * Interface options of interest are the name and the resolution of
+ * the timestamps, 10^-n or 2^-n if the top bit is set.
+ */
+static void
+parse_idb(const uint8_t *body, size_t len)
+{
+	struct pcap_if *pi;
+	size_t off = 8;
+
+	if (len < 8)
+		return;
+
+	pi = add_if(get16(body));
+
+	while (off + 4 <= len) {
+		uint16_t code = get16(body + off);
+		uint16_t olen = get16(body + off + 2);
+
+		off += 4;
+		if (0 == code || off + olen > len)
+			break;
+
+		if (2 == code) {
+			size_t n = olen < IFNAME_MAX - 1 ? olen : IFNAME_MAX - 1;
+
+			memcpy(pi->pi_name, body + off, n);
+			pi->pi_name[n] = '\0';
+		} else if (9 == code && olen >= 1) {
+			uint8_t r = body[off];
+			uint64_t resol = 1;
+			int n;
+
+			for (n = 0; n < (r & 0x7f) && resol < (1ULL << 62); n++)
+				resol *= (r & 0x80) ? 2 : 10;
+
+			pi->pi_tsresol = resol;
+		}
+
+		off += (olen + 3) & ~3;
+	}
+}
+
+static inline uint64_t
+to_usec(struct pcap_if *pi, uint64_t ts)
+{
+	if (1000000 == pi->pi_tsresol)
+		return ts;
+
+	return (ts / pi->pi_tsresol) * 1000000 +
+		(ts % pi->pi_tsresol) * 1000000 / pi->pi_tsresol;
+}
+
+/*
+ * Looks at the next packet without consuming it, returns the number
+ * of bytes to skip to get past it or 0 at the end of the file. Blocks
+ * other than packets are handled and skipped on the way.
+ */
+static size_t
+peek_packet(struct packet *pkt)
+{
+	for (;;) {
+		const uint8_t *p = map + map_off;
+		size_t left = map_size - map_off;
+
+		if (!is_ng) {
+			struct pcap_if *pi = &ifs[0];
+
+			if (left < 16 || left - 16 < get32(p + 8))
+				return 0;
+
+			pkt->p_if = 0;
+			pkt->p_ts = (uint64_t) get32(p) * 1000000 +
+				get32(p + 4) / (pi->pi_tsresol / 1000000);
+			pkt->p_caplen = get32(p + 8);
+			pkt->p_len = get32(p + 12);
+			pkt->p_data = p + 16;
+			pkt->p_tx = 0;
+
+			return 16 + pkt->p_caplen;
+		} else {
+			uint32_t type, blen;
+
+			if (left < 12)
+				return 0;
+
+			type = get32(p);
+
+			if (PCAPNG_SHB == type) {
+				/* a new section may change the byte order */
+				uint32_t bom;
+
+				memcpy(&bom, p + 8, sizeof(bom));
+				swapped = PCAPNG_BYTE_ORDER != bom;
+				if_base = nifs;
+			}
+
+			blen = get32(p + 4);
+			if (blen < 12 || blen > left)
+				return 0;
+
+			switch (type) {
+			case PCAPNG_IDB:
+				if (nifs - if_base < 256)
+					parse_idb(p + 8, blen - 12);
+				break;
+
+			case PCAPNG_EPB:
+			case PCAPNG_PB:
+				if (blen < 32)
+					break;
+
+				if (PCAPNG_EPB == type)
+					pkt->p_if = get32(p + 8);
+				else
+					pkt->p_if = get16(p + 8);
+
+				if (pkt->p_if >= nifs - if_base)
+					break;
+
+				pkt->p_if += if_base;
+
+				pkt->p_ts = to_usec(&ifs[pkt->p_if],
+					((uint64_t) get32(p + 12) << 32) | get32(p + 16));
+				pkt->p_caplen = get32(p + 20);
+				pkt->p_len = get32(p + 24);
+				pkt->p_data = p + 28;
+				pkt->p_tx = 0;
+
+				if (pkt->p_caplen > blen - 32)
+					break;
+
+				/* epb_flags, bits 0-1 carry the direction */
+				if (PCAPNG_EPB == type) {
+					size_t off = 28 + ((pkt->p_caplen + 3) & ~3);
+
+					while (off + 4 <= blen - 4) {
+						uint16_t code = get16(p + off);
+						uint16_t olen = get16(p + off + 2);
+
+						if (0 == code || off + 4 + olen > blen - 4)
+							break;
+						if (2 == code && olen >= 4)
+							pkt->p_tx = 2 == (get32(p + off + 4) & 3);
+						off += 4 + ((olen + 3) & ~3);
+					}
+				}
+
+				last_ts = pkt->p_ts;
+				return blen;
+
+			case PCAPNG_SPB:
+				if (nifs <= if_base || blen < 16)
+					break;
+
+				/* no timestamp, it belongs to the previous packet */
+				pkt->p_if = if_base;
+				pkt->p_ts = last_ts;
+				pkt->p_len = get32(p + 8);
+				pkt->p_caplen = blen - 16 < pkt->p_len ? blen - 16 : pkt->p_len;
+				pkt->p_data = p + 12;
+				pkt->p_tx = 0;
+				return blen;
+			}
+
+			map_off += blen;
+		}
+	}
+}
+
+static void
+account(struct packet *pkt)
+{
+	struct pcap_if *pi = &ifs[pkt->p_if];
+	struct flow_key key;
+
+	if (pkt->p_tx) {
+		pi->pi_tx_bytes += pkt->p_len;
+		pi->pi_tx_packets++;
+	} else {
+		pi->pi_rx_bytes += pkt->p_len;
+		pi->pi_rx_packets++;
+	}
+
+	if (c_flows && !flow_parse(pkt->p_data, pkt->p_caplen, pi->pi_link, &key)) {
+		int tx = pkt->p_tx;
+
+		if (c_hosts)
+			flow_key_hosts(&key);
+		if (flow_key_canon(&key))
+			tx = !tx;
+
+		flow_account(&pi->pi_flows, &key, tx, pkt->p_len, 1);
+	}
+}
+
+static void
+update_flows(node_t *node, struct pcap_if *pi, int parent)
+{
+	struct flow *top[c_top];
+	int i, n;
+
+	n = flow_top(&pi->pi_flows, top, c_top);
+
+	for (i = 0; i < n; i++) {
+		char name[IFNAME_MAX];
+		intf_t *intf;
+
+		flow_name(top[i], name, sizeof(name));
+
+		if (!(intf = lookup_intf(node, name, top[i]->f_hash, parent)))
+			continue;
+
+		intf->i_link = parent;
+		intf->i_is_child = 1;
+		intf->i_level = 1;
+		flow_update_intf(top[i], intf);
+
+		notify_update(intf);
+		increase_lifetime(intf, 1);
+	}
+
+	flow_expire(&pi->pi_flows, 10);
+}
+
+/*
+ * Consumes all packets captured up to the time of this read, the
+ * reader timing follows the clock of the capture.
+ */
+static void
+pcap_read(void)
+{
+	node_t *node = get_local_node();
+	uint64_t now;
+	struct packet pkt;
+	size_t len;
+	int n;
+
+	if (eof)
+		exit(0);
+
+	now = rtiming.rt_last_read.tv_sec * 1000000ULL +
+		rtiming.rt_last_read.tv_usec;
+
+	while ((len = peek_packet(&pkt))) {
+		if (pkt.p_ts > now)
+			break;
+
+		account(&pkt);
+		map_off += len;
+	}
+
+	if (0 == len)
+		eof = 1;
+
+	for (n = 0; n < nifs; n++) {
+		struct pcap_if *pi = &ifs[n];
+		intf_t *intf;
+
+		if (!(intf = lookup_intf(node, pi->pi_name, 0, 0)))
+			continue;
+
+		intf->i_rx_bytes.r_total = pi->pi_rx_bytes;
+		intf->i_tx_bytes.r_total = pi->pi_tx_bytes;
+		intf->i_rx_packets.r_total = pi->pi_rx_packets;
+		intf->i_tx_packets.r_total = pi->pi_tx_packets;
+		intf->i_rx_bytes.r_is64bit = intf->i_tx_bytes.r_is64bit = 1;
+		intf->i_rx_packets.r_is64bit = intf->i_tx_packets.r_is64bit = 1;
+
+		notify_update(intf);
+		increase_lifetime(intf, 1);
+
+		if (c_flows)
+			update_flows(node, pi, intf->i_index);
+	}
+}
+
+/*
+ * The capture clock starts at the first packet. As fast as possible
+ * means the next read is always due, otherwise the wall clock time
+ * passed is scaled by the speed.
+ */
+static void
+pcap_clock(timestamp_t *ts)
+{
+	timestamp_t now;
+	uint64_t usec;
+
+	if (c_speed <= 0.0f) {
+		if (rtiming.rt_next_read.tv_sec) {
+			COPY_TS(ts, &rtiming.rt_next_read);
+			return;
+		}
+		usec = cap_start;
+	} else {
+		update_ts(&now);
+		if (0 == wall_start.tv_sec)
+			COPY_TS(&wall_start, &now);
+
+		usec = cap_start + (uint64_t) ((double) c_speed *
+			((now.tv_sec - wall_start.tv_sec) * 1000000LL +
+			 now.tv_usec - wall_start.tv_usec));
+	}
+
+	ts->tv_sec = usec / 1000000;
+	ts->tv_usec = usec % 1000000;
+}
+
+static unsigned long
+pcap_sleep(unsigned long usec)
+{
+	if (c_speed <= 0.0f)
+		return 0;
+
+	return (unsigned long) (usec / c_speed);
+}
+
+static void
+print_help(void)
+{
+	printf(
+		"pcap - Replay of a packet capture\n" \
+		"\n" \
+		"  Reads a pcap or pcapng file and provides the traffic of every\n" \
+		"  capture interface as if it were happening. The reader timing\n" \
+		"  follows the timestamps of the capture, the file is replayed as\n" \
+		"  fast as possible or at the given speed. bmon quits at the end\n" \
+		"  of the file. The packet direction is only known for pcapng\n" \
+		"  files carrying it, all other packets are accounted as received.\n" \
+		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
+		"\n" \
+		"  Options:\n" \
+		"    file=PATH      Capture file (required)\n" \
+		"    speed=NUM      Replay speed, 1 is real time (default: 0, as fast as possible)\n" \
+		"    name=NAME      Interface name prefix if not recorded (default: pcap)\n" \
+		"    flows          Show the top flows as children of the interface\n" \
+		"    hosts          Account flows per host pair instead of per 5-tuple\n" \
+		"    top=NUM        Number of flows to show (default: 10)\n" \
+		"    max=NUM        Max. number of flows kept (default: 4096)\n");
+}
+
+static void
+pcap_set_opts(tv_t *attrs)
+{
+	while (attrs) {
+		if (!strcasecmp(attrs->type, "file") && attrs->value)
+			c_file = attrs->value;
+		else if (!strcasecmp(attrs->type, "speed") && attrs->value)
+			c_speed = strtod(attrs->value, NULL);
+		else if (!strcasecmp(attrs->type, "name") && attrs->value)
+			c_name = attrs->value;
+		else if (!strcasecmp(attrs->type, "flows"))
+			c_flows = 1;
+		else if (!strcasecmp(attrs->type, "hosts"))
+			c_flows = c_hosts = 1;
+		else if (!strcasecmp(attrs->type, "top") && attrs->value)
+			c_top = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "max") && attrs->value)
+			c_max = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "help")) {
+			print_help();
+			exit(0);
+		}
+		attrs = attrs->next;
+	}
+}
+
+static int
+pcap_probe(void)
+{
+	struct packet pkt;
+	struct stat st;
+	uint32_t magic;
+	int fd;
+
+	if (NULL == c_file)
+		return 0;
+
+	if ((fd = open(c_file, O_RDONLY)) < 0)
+		quit("Unable to open %s: %s\n", c_file, strerror(errno));
+
+	if (fstat(fd, &st) < 0 || st.st_size < 24)
+		quit("%s: not a capture file\n", c_file);
+
+	map_size = st.st_size;
+	map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (MAP_FAILED == (void *) map)
+		quit("Unable to map %s: %s\n", c_file, strerror(errno));
+
+	madvise((void *) map, map_size, MADV_SEQUENTIAL);
+
+	if (c_top < 1)
+		c_top = 1;
+	if (c_max < c_top)
+		c_max = c_top;
+
+	memcpy(&magic, map, sizeof(magic));
+
+	if (PCAPNG_SHB == magic)
+		is_ng = 1;
+	else if (PCAP_MAGIC == magic || PCAP_MAGIC_NSEC == magic)
+		swapped = 0;
+	else if (PCAP_MAGIC == __builtin_bswap32(magic) ||
+		 PCAP_MAGIC_NSEC == __builtin_bswap32(magic))
+		swapped = 1;
+	else
+		quit("%s: not a pcap or pcapng file\n", c_file);
+
+	if (!is_ng) {
+		struct pcap_if *pi = add_if(get32(map + 20));
+
+		if (PCAP_MAGIC_NSEC == (swapped ? __builtin_bswap32(magic) : magic))
+			pi->pi_tsresol = 1000000000;
+		map_off = 24;
+	}
+
+	if (!peek_packet(&pkt))
+		quit("%s: no packets found\n", c_file);
+
+	cap_start = pkt.p_ts;
+
+	return 1;
+}
+
+static void
+pcap_shutdown(void)
+{
+	int n;
+
+	for (n = 0; n < nifs; n++)
+		if (c_flows)
+			flow_table_free(&ifs[n].pi_flows);
+
+	if (map && MAP_FAILED != (void *) map)
+		munmap((void *) map, map_size);
+}
+
+static struct input_module pcap_ops = {
+	.im_name = "pcap",
+	.im_read = pcap_read,
+	.im_set_opts = pcap_set_opts,
+	.im_probe = pcap_probe,
+	.im_shutdown = pcap_shutdown,
+	.im_clock = pcap_clock,
+	.im_sleep = pcap_sleep,
+};
+
+static void __init
+pcap_init(void)
+{
+	register_input_module(&pcap_ops);
+}
@@ -30,79 +30,86 @@
 #include <bmon/intf.h>
 #include <bmon/utils.h>
 
-static char *c_path = "/proc/net/dev";
+static stat_file_t proc_file = STAT_FILE_INIT("/proc/net/dev");
 
-static void
-proc_read(void)
+/*
+ * Parses the contents of /proc/net/dev in place. Used by every input
+ * reading the file, accept may be used to skip interfaces by name.
+ */
+void
+proc_net_dev_parse(node_t *node, char *p, int (*accept)(const char *))
 {
-    FILE *  fd;
-    char    buf[512], *p, *s;
-    int     w;
-	intf_t *i;
-
-    if (!(fd = fopen(c_path, "r")))
-        quit("Unable to open file %s: %s\n", c_path, strerror(errno));
-
-    fgets(buf, sizeof(buf), fd);
-    fgets(buf, sizeof(buf), fd);
-
-    for (; fgets(buf, sizeof(buf), fd);) {
-		b_cnt_t rx_errors, rx_drop, rx_fifo, rx_frame, rx_compressed;
-		b_cnt_t rx_multicast, tx_errors, tx_drop, tx_fifo, tx_frame;
-		b_cnt_t tx_compressed, tx_multicast;
-
-        if (buf[0] == '\r' || buf[0] == '\n')
-            continue;
-
-        if (!(p = strchr(buf, ':')))
-            continue;
-
-        *p = '\0';
-        s = (p + 1);
-
-        for (p = &buf[0]; *p == ' '; p++);
-
-		/*
-		 * XXX: get_show_only_running
-		 */
-
-        if ((i = lookup_intf(get_local_node(), p, 0, 0)) == NULL)
-            continue;
-
-        w = sscanf(s, "%llu %llu %llu %llu %llu %llu %llu %llu %llu %llu "
-                "%llu %llu %llu %llu %llu %llu\n",
-            &i->i_rx_bytes.r_total,
-            &i->i_rx_packets.r_total,
-            &rx_errors,
-            &rx_drop,
-            &rx_fifo,
-            &rx_frame,
-            &rx_compressed,
-            &rx_multicast,
-            &i->i_tx_bytes.r_total,
-            &i->i_tx_packets.r_total,
-            &tx_errors,
-            &tx_drop,
-            &tx_fifo,
-            &tx_frame,
-            &tx_compressed,
-            &tx_multicast);
-
-        if (w != 16)
-            continue;
-
-		update_attr(i, ERRORS, rx_errors, tx_errors, RX_PROVIDED|TX_PROVIDED);
-		update_attr(i, DROP, rx_drop, tx_drop, RX_PROVIDED|TX_PROVIDED);
-		update_attr(i, FIFO, rx_fifo, tx_fifo, RX_PROVIDED|TX_PROVIDED);
-		update_attr(i, FRAME, rx_frame, tx_frame, RX_PROVIDED|TX_PROVIDED);
-		update_attr(i, COMPRESSED, rx_compressed, tx_compressed, RX_PROVIDED|TX_PROVIDED);
-		update_attr(i, MULTICAST, rx_multicast, tx_multicast, RX_PROVIDED|TX_PROVIDED);
+	/* skip the two header lines */
+	p += strcspn(p, "\n");
+	if (*p) {
+		p++;
+		p += strcspn(p, "\n");
+	}
+
+	while (*p) {
+		char *name, *end;
+		b_cnt_t v[16];
+		intf_t *i;
+		int n;
+
+		p++;
+		name = p + strspn(p, " ");
+		if (!(end = strchr(name, ':')))
+			break;
+		*end = '\0';
+		p = end + 1;
+
+		for (n = 0; n < 16; n++) {
+			char *e;
+
+			v[n] = strtoull(p, &e, 10);
+			if (e == p || (*e != ' ' && *e != '\n' && *e != '\0'))
+				break;
+			p = e;
+		}
+
+		p += strcspn(p, "\n");
+
+		/* truncated or foreign line */
+		if (n < 16)
+			continue;
+
+		if (accept && !accept(name))
+			continue;
+
+		if (!(i = lookup_intf(node, name, 0, 0)))
+			continue;
+
+		i->i_rx_bytes.r_total = v[0];
+		i->i_rx_packets.r_total = v[1];
+		i->i_tx_bytes.r_total = v[8];
+		i->i_tx_packets.r_total = v[9];
+
+		update_attr(i, ERRORS, v[2], v[10], RX_PROVIDED|TX_PROVIDED);
+		update_attr(i, DROP, v[3], v[11], RX_PROVIDED|TX_PROVIDED);
+		update_attr(i, FIFO, v[4], v[12], RX_PROVIDED|TX_PROVIDED);
+		update_attr(i, FRAME, v[5], v[13], RX_PROVIDED|TX_PROVIDED);
+		update_attr(i, COMPRESSED, v[6], v[14], RX_PROVIDED|TX_PROVIDED);
+		update_attr(i, MULTICAST, v[7], v[15], RX_PROVIDED|TX_PROVIDED);
 
 		notify_update(i);
 		increase_lifetime(i, 1);
-    }
+	}
+}
+
+static void
+proc_read(void)
+{
+	char *buf;
+
+	if (!(buf = stat_file_read(&proc_file)))
+		quit("Unable to open file %s: %s\n", proc_file.sf_path,
+			strerror(errno));
 
-    fclose(fd);
+	/*
+	 * XXX: get_show_only_running
+	 */
+	proc_net_dev_parse(get_local_node(), buf, NULL);
 }
 
 static void
@@ -123,7 +130,7 @@ proc_set_opts(tv_t *attrs)
 {
 	while (attrs) {
 		if (!strcasecmp(attrs->type, "file") && attrs->value)
-			c_path = attrs->value;
+			proc_file.sf_path = attrs->value;
 		else if (!strcasecmp(attrs->type, "help")) {
 			print_help();
 			exit(0);
@@ -135,13 +142,13 @@ proc_set_opts(tv_t *attrs)
 static int
 proc_probe(void)
 {
-	FILE *fd = fopen(c_path, "r");
+	return stat_file_read(&proc_file) != NULL;
+}
 
-	if (fd) {
-		fclose(fd);
-		return 1;
-	}
-	return 0;
+static void
+proc_shutdown(void)
+{
+	stat_file_close(&proc_file);
 }
 
 static struct input_module proc_ops = {
@@ -149,6 +156,7 @@ static struct input_module proc_ops = {
 	.im_read = proc_read,
 	.im_set_opts = proc_set_opts,
 	.im_probe = proc_probe,
+	.im_shutdown = proc_shutdown,
 };
 
 static void __init
@@ -0,0 +1,508 @@
+/*
+ * in_proto.c            Protocol statistics from /proc/net/{snmp,netstat} (Linux)
+ *
+ * Copyright (c) 2001-2004 Thomas Graf <tgraf@suug.ch>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <bmon/bmon.h>
+#include <bmon/input.h>
+#include <bmon/node.h>
+#include <bmon/intf.h>
+#include <bmon/utils.h>
+
+#if defined SYS_LINUX
+
+static char *c_dir = "/proc/net";
+
+/*
+ * Pseudo interfaces, one per protocol
+ */
+enum {
+	P_IP,
+	P_ICMP,
+	P_TCP,
+	P_UDP,
+	P_IP6,
+	P_ICMP6,
+	P_UDP6,
+	__P_MAX,
+};
+
+static const char *proto_names[__P_MAX] = {
+	[P_IP] = "ip",
+	[P_ICMP] = "icmp",
+	[P_TCP] = "tcp",
+	[P_UDP] = "udp",
+	[P_IP6] = "ip6",
+	[P_ICMP6] = "icmp6",
+	[P_UDP6] = "udp6",
+};
+
+#define RX RX_PROVIDED
+#define TX TX_PROVIDED
+#define GAUGE 0
+#define COUNTER RATE_PROVIDED
+
+/*
+ * Counters of interest. The section is the line prefix in snmp and
+ * netstat, snmp6 has no sections. Counters mapping to the same
+ * protocol, attribute and direction are summed up.
+ */
+static struct proto_counter {
+	const char *	pc_section;
+	const char *	pc_name;
+	int		pc_proto;
+	int		pc_type;
+	int		pc_dir;
+	int		pc_flags;
+} proto_counters[] = {
+	{ "Ip", "InReceives",		P_IP,	PACKETS,	RX, COUNTER },
+	{ "Ip", "OutRequests",		P_IP,	PACKETS,	TX, COUNTER },
+	{ "Ip", "InDiscards",		P_IP,	DROP,		RX, COUNTER },
+	{ "Ip", "OutDiscards",		P_IP,	DROP,		TX, COUNTER },
+	{ "Ip", "InHdrErrors",		P_IP,	ERRORS,		RX, COUNTER },
+	{ "Ip", "InAddrErrors",		P_IP,	ERRORS,		RX, COUNTER },
+	{ "Ip", "ForwDatagrams",	P_IP,	FORWARDED,	TX, COUNTER },
+	{ "Ip", "OutNoRoutes",		P_IP,	NO_ROUTES,	TX, COUNTER },
+	{ "Ip", "ReasmFails",		P_IP,	FRAG_ERRORS,	RX, COUNTER },
+	{ "Ip", "FragFails",		P_IP,	FRAG_ERRORS,	TX, COUNTER },
+	{ "IpExt", "InOctets",		P_IP,	BYTES,		RX, COUNTER },
+	{ "IpExt", "OutOctets",		P_IP,	BYTES,		TX, COUNTER },
+	{ "IpExt", "InNoRoutes",	P_IP,	NO_ROUTES,	RX, COUNTER },
+	{ "IpExt", "InCsumErrors",	P_IP,	CSUM_ERRORS,	RX, COUNTER },
+	{ "IpExt", "InMcastPkts",	P_IP,	MULTICAST,	RX, COUNTER },
+	{ "IpExt", "OutMcastPkts",	P_IP,	MULTICAST,	TX, COUNTER },
+	{ "IpExt", "InBcastPkts",	P_IP,	BROADCAST,	RX, COUNTER },
+	{ "IpExt", "OutBcastPkts",	P_IP,	BROADCAST,	TX, COUNTER },
+
+	{ "Icmp", "InMsgs",		P_ICMP,	PACKETS,	RX, COUNTER },
+	{ "Icmp", "OutMsgs",		P_ICMP,	PACKETS,	TX, COUNTER },
+	{ "Icmp", "InErrors",		P_ICMP,	ERRORS,		RX, COUNTER },
+	{ "Icmp", "OutErrors",		P_ICMP,	ERRORS,		TX, COUNTER },
+	{ "Icmp", "InCsumErrors",	P_ICMP,	CSUM_ERRORS,	RX, COUNTER },
+	{ "Icmp", "InDestUnreachs",	P_ICMP,	UNREACHABLE,	RX, COUNTER },
+	{ "Icmp", "OutDestUnreachs",	P_ICMP,	UNREACHABLE,	TX, COUNTER },
+
+	{ "Tcp", "InSegs",		P_TCP,	PACKETS,	RX, COUNTER },
+	{ "Tcp", "OutSegs",		P_TCP,	PACKETS,	TX, COUNTER },
+	{ "Tcp", "RetransSegs",		P_TCP,	RETRANS,	TX, COUNTER },
+	{ "Tcp", "InErrs",		P_TCP,	ERRORS,		RX, COUNTER },
+	{ "Tcp", "InCsumErrors",	P_TCP,	CSUM_ERRORS,	RX, COUNTER },
+	{ "Tcp", "OutRsts",		P_TCP,	RESETS,		TX, COUNTER },
+	{ "Tcp", "PassiveOpens",	P_TCP,	CONN_OPENS,	RX, COUNTER },
+	{ "Tcp", "ActiveOpens",		P_TCP,	CONN_OPENS,	TX, COUNTER },
+	{ "Tcp", "CurrEstab",		P_TCP,	ESTABLISHED,	RX, GAUGE },
+	{ "TcpExt", "ListenOverflows",	P_TCP,	LISTEN_OVERFLOWS, RX, COUNTER },
+	{ "TcpExt", "ListenDrops",	P_TCP,	LISTEN_DROPS,	RX, COUNTER },
+	{ "TcpExt", "TCPTimeouts",	P_TCP,	TIMEOUTS,	TX, COUNTER },
+	{ "TcpExt", "TCPBacklogDrop",	P_TCP,	DROP,		RX, COUNTER },
+	{ "TcpExt", "TCPRcvQDrop",	P_TCP,	DROP,		RX, COUNTER },
+
+	{ "Udp", "InDatagrams",		P_UDP,	PACKETS,	RX, COUNTER },
+	{ "Udp", "OutDatagrams",	P_UDP,	PACKETS,	TX, COUNTER },
+	{ "Udp", "NoPorts",		P_UDP,	NO_PORTS,	RX, COUNTER },
+	{ "Udp", "InErrors",		P_UDP,	ERRORS,		RX, COUNTER },
+	{ "Udp", "RcvbufErrors",	P_UDP,	BUF_ERRORS,	RX, COUNTER },
+	{ "Udp", "SndbufErrors",	P_UDP,	BUF_ERRORS,	TX, COUNTER },
+	{ "Udp", "InCsumErrors",	P_UDP,	CSUM_ERRORS,	RX, COUNTER },
+
+	{ "", "Ip6InReceives",		P_IP6,	PACKETS,	RX, COUNTER },
+	{ "", "Ip6OutRequests",		P_IP6,	PACKETS,	TX, COUNTER },
+	{ "", "Ip6InOctets",		P_IP6,	BYTES,		RX, COUNTER },
+	{ "", "Ip6OutOctets",		P_IP6,	BYTES,		TX, COUNTER },
+	{ "", "Ip6InDiscards",		P_IP6,	DROP,		RX, COUNTER },
+	{ "", "Ip6OutDiscards",		P_IP6,	DROP,		TX, COUNTER },
+	{ "", "Ip6InHdrErrors",		P_IP6,	ERRORS,		RX, COUNTER },
+	{ "", "Ip6InAddrErrors",	P_IP6,	ERRORS,		RX, COUNTER },
+	{ "", "Ip6OutForwDatagrams",	P_IP6,	FORWARDED,	TX, COUNTER },
+	{ "", "Ip6InNoRoutes",		P_IP6,	NO_ROUTES,	RX, COUNTER },
+	{ "", "Ip6OutNoRoutes",		P_IP6,	NO_ROUTES,	TX, COUNTER },
+	{ "", "Ip6ReasmFails",		P_IP6,	FRAG_ERRORS,	RX, COUNTER },
+	{ "", "Ip6FragFails",		P_IP6,	FRAG_ERRORS,	TX, COUNTER },
+	{ "", "Ip6InMcastPkts",		P_IP6,	MULTICAST,	RX, COUNTER },
+	{ "", "Ip6OutMcastPkts",	P_IP6,	MULTICAST,	TX, COUNTER },
+
+	{ "", "Icmp6InMsgs",		P_ICMP6, PACKETS,	RX, COUNTER },
+	{ "", "Icmp6OutMsgs",		P_ICMP6, PACKETS,	TX, COUNTER },
+	{ "", "Icmp6InErrors",		P_ICMP6, ERRORS,	RX, COUNTER },
+	{ "", "Icmp6OutErrors",		P_ICMP6, ERRORS,	TX, COUNTER },
+	{ "", "Icmp6InCsumErrors",	P_ICMP6, CSUM_ERRORS,	RX, COUNTER },
+	{ "", "Icmp6InDestUnreachs",	P_ICMP6, UNREACHABLE,	RX, COUNTER },
+	{ "", "Icmp6OutDestUnreachs",	P_ICMP6, UNREACHABLE,	TX, COUNTER },
+
+	{ "", "Udp6InDatagrams",	P_UDP6,	PACKETS,	RX, COUNTER },
+	{ "", "Udp6OutDatagrams",	P_UDP6,	PACKETS,	TX, COUNTER },
+	{ "", "Udp6NoPorts",		P_UDP6,	NO_PORTS,	RX, COUNTER },
+	{ "", "Udp6InErrors",		P_UDP6,	ERRORS,		RX, COUNTER },
+	{ "", "Udp6RcvbufErrors",	P_UDP6,	BUF_ERRORS,	RX, COUNTER },
+	{ "", "Udp6SndbufErrors",	P_UDP6,	BUF_ERRORS,	TX, COUNTER },
+	{ "", "Udp6InCsumErrors",	P_UDP6,	CSUM_ERRORS,	RX, COUNTER },
+
+	{ NULL },
+};
+
+#undef RX
+#undef TX
+
+struct proto_val
+{
+	b_cnt_t		pv_rx;
+	b_cnt_t		pv_tx;
+	int		pv_flags;
+};
+
+static struct proto_val proto_vals[__P_MAX][__ATTR_MAX];
+static struct proto_val proto_saved[__P_MAX][__ATTR_MAX];
+static int proto_present[__P_MAX];
+
+/*
+ * Column map of a statistics file, built from the header lines once
+ * and used to pick the values out of the value lines every read.
+ * snmp/netstat come as pairs of header and value lines per section
+ * ("Tcp: RtoAlgorithm ..." followed by "Tcp: 1 ..."), snmp6 lists one
+ * "name value" per line; it is treated as a single section with one
+ * column per line.
+ */
+struct proto_file
+{
+	stat_file_t	pf_file;
+	int		pf_flat;
+	int		pf_resolved;
+	int		pf_ncols;
+	int		pf_nsections;
+	short *		pf_cols;
+};
+
+static struct proto_file proto_files[] = {
+	{ .pf_file = STAT_FILE_INIT("snmp") },
+	{ .pf_file = STAT_FILE_INIT("netstat") },
+	{ .pf_file = STAT_FILE_INIT("snmp6"), .pf_flat = 1 },
+};
+
+#define NFILES (sizeof(proto_files) / sizeof(proto_files[0]))
+
+static int
+find_counter(const char *section, size_t slen, const char *name, size_t nlen)
+{
+	int i;
+
+	for (i = 0; proto_counters[i].pc_name; i++) {
+		struct proto_counter *pc = &proto_counters[i];
+
+		if (strlen(pc->pc_section) == slen &&
+		    !strncmp(pc->pc_section, section, slen) &&
+		    strlen(pc->pc_name) == nlen &&
+		    !strncmp(pc->pc_name, name, nlen))
+			return i;
+	}
+
+	return -1;
+}
+
+static void
+add_col(struct proto_file *pf, int counter)
+{
+	pf->pf_cols = xrealloc(pf->pf_cols, (pf->pf_ncols + 1) * sizeof(short));
+	pf->pf_cols[pf->pf_ncols++] = counter;
+
+	if (counter >= 0) {
+		struct proto_counter *pc = &proto_counters[counter];
+
+		proto_vals[pc->pc_proto][pc->pc_type].pv_flags |=
+			pc->pc_dir | pc->pc_flags;
+		proto_present[pc->pc_proto] = 1;
+	}
+}
+
+static void
+resolve_file(struct proto_file *pf, char *buf)
+{
+	char *p = buf;
+
+	xfree(pf->pf_cols);
+	pf->pf_cols = NULL;
+	pf->pf_ncols = pf->pf_nsections = 0;
+
+	while (*p) {
+		char *eol = p + strcspn(p, "\n");
+		char *s, *e;
+		size_t slen;
+
+		if (pf->pf_flat) {
+			e = p + strcspn(p, " \t\n");
+			add_col(pf, find_counter("", 0, p, e - p));
+			goto next;
+		}
+
+		if (NULL == (s = memchr(p, ':', eol - p)))
+			goto next;
+
+		slen = s - p;
+		pf->pf_nsections++;
+
+		for (s++; s < eol; s = e) {
+			while (' ' == *s)
+				s++;
+			if (s >= eol)
+				break;
+			e = s + strcspn(s, " \n");
+			add_col(pf, find_counter(p, slen, s, e - s));
+		}
+
+		/* skip value line */
+		p = *eol ? eol + 1 : eol;
+		eol = p + strcspn(p, "\n");
+next:
+		p = *eol ? eol + 1 : eol;
+	}
+
+	pf->pf_resolved = 1;
+}
+
+static inline void
+account(int counter, b_cnt_t v)
+{
+	struct proto_counter *pc = &proto_counters[counter];
+	struct proto_val *pv = &proto_vals[pc->pc_proto][pc->pc_type];
+
+	if (pc->pc_dir & RX_PROVIDED)
+		pv->pv_rx += v;
+	else
+		pv->pv_tx += v;
+}
+
+/*
+ * Returns -1 if the layout does not match the resolved column map.
+ */
+static int
+read_values(struct proto_file *pf, char *p)
+{
+	int col = 0, sections = 0;
+
+	while (*p) {
+		char *eol = p + strcspn(p, "\n");
+		char *s, *end;
+
+		if (pf->pf_flat) {
+			s = p + strcspn(p, " \t\n");
+			if (col >= pf->pf_ncols)
+				return -1;
+			if (pf->pf_cols[col] >= 0)
+				account(pf->pf_cols[col], strtoull(s, NULL, 10));
+			col++;
+			goto next;
+		}
+
+		/* header line */
+		if (NULL == memchr(p, ':', eol - p))
+			goto next;
+		sections++;
+		p = *eol ? eol + 1 : eol;
+		eol = p + strcspn(p, "\n");
+
+		if (NULL == (s = memchr(p, ':', eol - p)))
+			return -1;
+
+		for (s++; s < eol; s = end) {
+			while (' ' == *s)
+				s++;
+			if (s >= eol)
+				break;
+			if (col >= pf->pf_ncols)
+				return -1;
+			if (pf->pf_cols[col] >= 0)
+				account(pf->pf_cols[col], strtoull(s, &end, 10));
+			else
+				end = s + strcspn(s, " \n");
+			col++;
+		}
+next:
+		p = *eol ? eol + 1 : eol;
+	}
+
+	if (col != pf->pf_ncols || sections != pf->pf_nsections)
+		return -1;
+
+	return 0;
+}
+
+static void
+open_files(void)
+{
+	int i;
+
+	for (i = 0; i < NFILES; i++) {
+		struct proto_file *pf = &proto_files[i];
+		char path[FILENAME_MAX];
+
+		snprintf(path, sizeof(path), "%s/%s", c_dir, pf->pf_file.sf_path);
+		pf->pf_file.sf_path = strdup(path);
+	}
+}
+
+static void
+update_proto(node_t *node, int proto)
+{
+	intf_t *intf;
+	int t;
+
+	if (NULL == (intf = lookup_intf(node, proto_names[proto], 0, 0)))
+		return;
+
+	for (t = 0; t < __ATTR_MAX; t++) {
+		struct proto_val *pv = &proto_vals[proto][t];
+
+		if (!pv->pv_flags)
+			continue;
+
+		if (t == BYTES) {
+			intf->i_rx_bytes.r_total = pv->pv_rx;
+			intf->i_tx_bytes.r_total = pv->pv_tx;
+		} else if (t == PACKETS) {
+			intf->i_rx_packets.r_total = pv->pv_rx;
+			intf->i_tx_packets.r_total = pv->pv_tx;
+		} else
+			update_attr(intf, t, pv->pv_rx, pv->pv_tx, pv->pv_flags);
+	}
+
+	notify_update(intf);
+	increase_lifetime(intf, 1);
+}
+
+static void
+proto_read(void)
+{
+	node_t *node = get_local_node();
+	int i, t, retry;
+
+	for (i = 0; i < __P_MAX; i++)
+		for (t = 0; t < __ATTR_MAX; t++)
+			proto_vals[i][t].pv_rx = proto_vals[i][t].pv_tx = 0;
+
+	for (i = 0; i < NFILES; i++) {
+		struct proto_file *pf = &proto_files[i];
+		char *buf;
+
+		/* snmp6 is missing without IPv6 */
+		if (NULL == (buf = stat_file_read(&pf->pf_file)))
+			continue;
+
+		/*
+		 * A read failing half way has accounted part of the file
+		 * already, keep the sums of the previous files to start
+		 * over from.
+		 */
+		memcpy(proto_saved, proto_vals, sizeof(proto_vals));
+
+		for (retry = 0; retry < 2; retry++) {
+			if (!pf->pf_resolved)
+				resolve_file(pf, buf);
+
+			if (read_values(pf, buf) == 0)
+				break;
+
+			/* layout changed underneath us, start over */
+			memcpy(proto_vals, proto_saved, sizeof(proto_vals));
+			pf->pf_resolved = 0;
+		}
+	}
+
+	for (i = 0; i < __P_MAX; i++)
+		if (proto_present[i])
+			update_proto(node, i);
+}
+
+static void
+print_help(void)
+{
+	printf(
+		"proto - Protocol statistics (Linux)\n" \
+		"\n" \
+		"  Reads the protocol statistics of /proc/net/snmp, /proc/net/snmp6\n" \
+		"  and /proc/net/netstat and provides them as pseudo interfaces\n" \
+		"  (ip, icmp, tcp, udp, ip6, icmp6, udp6). Counters such as\n" \
+		"  retransmits, listen queue overflows and receive buffer errors\n" \
+		"  are attributes with rate and history. The column layout is\n" \
+		"  resolved once, only values are parsed afterwards.\n" \
+		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
+		"\n" \
+		"  Options:\n" \
+		"    dir=DIR        Directory of statistic files (default: /proc/net)\n");
+}
+
+static void
+proto_set_opts(tv_t *attrs)
+{
+	while (attrs) {
+		if (!strcasecmp(attrs->type, "dir") && attrs->value)
+			c_dir = attrs->value;
+		else if (!strcasecmp(attrs->type, "help")) {
+			print_help();
+			exit(0);
+		}
+		attrs = attrs->next;
+	}
+}
+
+static int
+proto_probe(void)
+{
+	int i;
+	char *buf;
+
+	open_files();
+
+	for (i = 0; i < NFILES; i++) {
+		struct proto_file *pf = &proto_files[i];
+
+		if ((buf = stat_file_read(&pf->pf_file)))
+			resolve_file(pf, buf);
+	}
+
+	return proto_files[0].pf_resolved;
+}
+
+static void
+proto_shutdown(void)
+{
+	int i;
+
+	for (i = 0; i < NFILES; i++) {
+		stat_file_close(&proto_files[i].pf_file);
+		xfree(proto_files[i].pf_cols);
+	}
+}
+
+static struct input_module proto_ops = {
+	.im_name = "proto",
+	.im_read = proto_read,
+	.im_set_opts = proto_set_opts,
+	.im_probe = proto_probe,
+	.im_shutdown = proto_shutdown,
+};
+
+static void __init
+proto_init(void)
+{
+	register_secondary_input_module(&proto_ops);
+}
+
+#endif
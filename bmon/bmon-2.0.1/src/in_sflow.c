@@ -0,0 +1,686 @@
+/*
+ * in_sflow.c           sFlow/IPFIX collector input
+ *
+ * Copyright (c) 2001-2004 Thomas Graf <tgraf@suug.ch>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE /* recvmmsg */
+
+#include <bmon/bmon.h>
+#include <bmon/input.h>
+#include <bmon/node.h>
+#include <bmon/intf.h>
+#include <bmon/utils.h>
+
+#if defined SYS_LINUX
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#define BATCH		16
+#define DGRAM_MAX	65536
+#define MAX_FIELDS	64
+
+static int c_sflow_port = 6343;
+static int c_ipfix_port = 4739;
+static int c_expire = 300;
+
+struct port_row
+{
+	uint32_t	r_index;
+	int		r_fresh;
+	time_t		r_seen;
+	b_cnt_t		r_cnt[4];	/* rx bytes, rx pkts, tx bytes, tx pkts */
+	b_cnt_t		r_rx_errors, r_tx_errors;
+	b_cnt_t		r_rx_drop, r_tx_drop;
+	timestamp_t	r_ts;
+};
+
+struct template
+{
+	uint32_t	t_domain;
+	uint16_t	t_id;
+	int		t_nfields;
+	struct {
+		uint16_t	f_id;
+		uint16_t	f_len;
+	} t_fields[MAX_FIELDS];
+	struct template *t_next;
+};
+
+/*
+ * An exporter is identified by the agent address it reports (sFlow)
+ * or the source address of its datagrams (IPFIX) and is shown as
+ * node, its ports as interfaces of that node. sFlow provides absolute
+ * counters while IPFIX records are summed up, a device exporting both
+ * is shown as two nodes named after the protocol and address.
+ */
+struct exporter
+{
+	char			e_name[INET6_ADDRSTRLEN];
+	char			e_node[INET6_ADDRSTRLEN + 8];
+	const char *		e_proto;
+	struct port_row *	e_rows;
+	int			e_nrows;
+	struct template *	e_templates;
+	struct exporter *	e_next;
+};
+
+static struct exporter *exporters;
+static int sflow_fd = -1, ipfix_fd = -1;
+
+static uint8_t *bufs;
+static struct mmsghdr msgs[BATCH];
+static struct iovec iovs[BATCH];
+static struct sockaddr_storage addrs[BATCH];
+static char ctls[BATCH][CMSG_SPACE(sizeof(struct timeval))];
+
+static inline uint32_t
+get32(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline uint64_t
+get64(const uint8_t *p)
+{
+	return ((uint64_t) get32(p) << 32) | get32(p + 4);
+}
+
+static inline uint16_t
+get16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint64_t
+get_uint(const uint8_t *p, int len)
+{
+	uint64_t v = 0;
+
+	/* reduced size encoding, any length up to 8 */
+	while (len--)
+		v = (v << 8) | *p++;
+
+	return v;
+}
+
+static struct exporter *
+get_exporter(const char *name, const char *proto)
+{
+	struct exporter *e;
+
+	for (e = exporters; e; e = e->e_next)
+		if (!strcmp(e->e_name, name) && e->e_proto == proto)
+			return e;
+
+	e = xcalloc(1, sizeof(*e));
+	snprintf(e->e_name, sizeof(e->e_name), "%s", name);
+	snprintf(e->e_node, sizeof(e->e_node), "%s/%s", proto, name);
+	e->e_proto = proto;
+	e->e_next = exporters;
+	exporters = e;
+
+	return e;
+}
+
+static struct port_row *
+get_row(struct exporter *e, uint32_t index)
+{
+	int lo = 0, hi = e->e_nrows;
+	struct port_row *r;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (e->e_rows[mid].r_index == index)
+			return &e->e_rows[mid];
+		if (e->e_rows[mid].r_index < index)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	e->e_rows = xrealloc(e->e_rows, (e->e_nrows + 1) * sizeof(*r));
+	r = &e->e_rows[lo];
+	memmove(r + 1, r, (e->e_nrows - lo) * sizeof(*r));
+	e->e_nrows++;
+
+	memset(r, 0, sizeof(*r));
+	r->r_index = index;
+
+	return r;
+}
+
+static void
+touch_row(struct port_row *r, timestamp_t *ts)
+{
+	COPY_TS(&r->r_ts, ts);
+	r->r_seen = ts->tv_sec;
+	r->r_fresh = 1;
+}
+
+/*
+ * sFlow v5, only counter samples carrying generic interface counters
+ * are of interest, flow samples are skipped.
+ */
+static void
+parse_sflow(const uint8_t *p, size_t len, timestamp_t *ts)
+{
+	const uint8_t *end = p + len;
+	char name[INET6_ADDRSTRLEN];
+	struct exporter *e;
+	uint32_t nsamples, n;
+
+	if (len < 8 || 5 != get32(p))
+		return;
+
+	if (1 == get32(p + 4) && len >= 28) {
+		inet_ntop(AF_INET, p + 8, name, sizeof(name));
+		p += 12;
+	} else if (2 == get32(p + 4) && len >= 40) {
+		inet_ntop(AF_INET6, p + 8, name, sizeof(name));
+		p += 24;
+	} else
+		return;
+
+	/* sub agent, sequence, uptime */
+	p += 12;
+	nsamples = get32(p);
+	p += 4;
+
+	e = get_exporter(name, "sflow");
+
+	for (n = 0; n < nsamples && end - p >= 8; n++) {
+		uint32_t format = get32(p), slen = get32(p + 4), nrec, m;
+		const uint8_t *s = p + 8, *send;
+
+		if ((size_t) (end - s) < slen)
+			return;
+		p = send = s + slen;
+
+		/* counter sample (2) and expanded counter sample (4) */
+		if (2 == format && slen >= 12)
+			s += 8;
+		else if (4 == format && slen >= 16)
+			s += 12;
+		else
+			continue;
+
+		nrec = get32(s);
+		s += 4;
+
+		for (m = 0; m < nrec && send - s >= 8; m++) {
+			uint32_t rformat = get32(s), rlen = get32(s + 4);
+			const uint8_t *r = s + 8;
+			struct port_row *row;
+
+			if ((size_t) (send - r) < rlen)
+				break;
+			s = r + rlen;
+
+			/* generic interface counters */
+			if (1 != rformat || rlen < 88)
+				continue;
+
+			row = get_row(e, get32(r));
+			/* unicast, multicast and broadcast packets */
+			row->r_cnt[0] = get64(r + 24);
+			row->r_cnt[1] = (b_cnt_t) get32(r + 32) + get32(r + 36) +
+					get32(r + 40);
+			row->r_rx_drop = get32(r + 44);
+			row->r_rx_errors = get32(r + 48);
+			row->r_cnt[2] = get64(r + 56);
+			row->r_cnt[3] = (b_cnt_t) get32(r + 64) + get32(r + 68) +
+					get32(r + 72);
+			row->r_tx_drop = get32(r + 76);
+			row->r_tx_errors = get32(r + 80);
+			touch_row(row, ts);
+		}
+	}
+}
+
+static struct template *
+find_template(struct exporter *e, uint32_t domain, uint16_t id)
+{
+	struct template *t;
+
+	for (t = e->e_templates; t; t = t->t_next)
+		if (t->t_domain == domain && t->t_id == id)
+			return t;
+
+	return NULL;
+}
+
+static void
+parse_templates(struct exporter *e, uint32_t domain, const uint8_t *p,
+		const uint8_t *end)
+{
+	while (end - p >= 4) {
+		uint16_t id = get16(p), count = get16(p + 2);
+		struct template *t;
+		int n;
+
+		p += 4;
+
+		/* withdrawal or padding */
+		if (id < 256 || 0 == count)
+			return;
+
+		if (!(t = find_template(e, domain, id))) {
+			t = xcalloc(1, sizeof(*t));
+			t->t_domain = domain;
+			t->t_id = id;
+			t->t_next = e->e_templates;
+			e->e_templates = t;
+		}
+
+		t->t_nfields = 0;
+
+		for (n = 0; n < count; n++) {
+			uint16_t fid, flen;
+
+			if (end - p < 4)
+				return;
+
+			fid = get16(p);
+			flen = get16(p + 2);
+			p += 4;
+
+			/* enterprise specific, never one of ours */
+			if (fid & 0x8000) {
+				if (end - p < 4)
+					return;
+				p += 4;
+				fid = 0;
+			}
+
+			if (t->t_nfields < MAX_FIELDS) {
+				t->t_fields[t->t_nfields].f_id = fid;
+				t->t_fields[t->t_nfields].f_len = flen;
+			}
+			t->t_nfields++;
+		}
+
+		/* records we cannot describe completely are ignored */
+		if (t->t_nfields > MAX_FIELDS)
+			t->t_nfields = 0;
+	}
+}
+
+/* information elements, RFC 7012 */
+#define IE_OCTET_DELTA		1
+#define IE_PACKET_DELTA		2
+#define IE_INGRESS_IF		10
+#define IE_EGRESS_IF		14
+#define IE_DIRECTION		61
+
+/*
+ * Flow records carry deltas, the bytes are accounted as received on
+ * the ingress interface and as transmitted on the egress interface.
+ */
+static void
+parse_data(struct exporter *e, struct template *t, const uint8_t *p,
+	   const uint8_t *end, timestamp_t *ts)
+{
+	while (p < end) {
+		const uint8_t *start = p;
+		uint64_t bytes = 0, pkts = 0;
+		uint32_t in = 0, out = 0;
+		int n, dir = -1;
+
+		for (n = 0; n < t->t_nfields; n++) {
+			size_t flen = t->t_fields[n].f_len;
+
+			if (65535 == flen) {
+				if (end - p < 1)
+					return;
+				flen = *p++;
+				if (255 == flen) {
+					if (end - p < 2)
+						return;
+					flen = get16(p);
+					p += 2;
+				}
+			}
+
+			if ((size_t) (end - p) < flen)
+				return;
+
+			if (flen <= 8) {
+				switch (t->t_fields[n].f_id) {
+				case IE_OCTET_DELTA:
+					bytes = get_uint(p, flen);
+					break;
+				case IE_PACKET_DELTA:
+					pkts = get_uint(p, flen);
+					break;
+				case IE_INGRESS_IF:
+					in = get_uint(p, flen);
+					break;
+				case IE_EGRESS_IF:
+					out = get_uint(p, flen);
+					break;
+				case IE_DIRECTION:
+					dir = get_uint(p, flen);
+					break;
+				}
+			}
+
+			p += flen;
+		}
+
+		/*
+		 * A record consuming no bytes (no fields or only fields of
+		 * length zero) would loop forever.
+		 */
+		if (p == start)
+			return;
+
+		if (in && 1 != dir) {
+			struct port_row *r = get_row(e, in);
+
+			r->r_cnt[0] += bytes;
+			r->r_cnt[1] += pkts;
+			touch_row(r, ts);
+		}
+
+		if (out && 0 != dir) {
+			struct port_row *r = get_row(e, out);
+
+			r->r_cnt[2] += bytes;
+			r->r_cnt[3] += pkts;
+			touch_row(r, ts);
+		}
+	}
+}
+
+static void
+parse_ipfix(const uint8_t *p, size_t len, struct sockaddr_storage *from,
+	    timestamp_t *ts)
+{
+	const uint8_t *end;
+	char name[INET6_ADDRSTRLEN];
+	struct exporter *e;
+	uint32_t domain;
+
+	if (len < 16 || 10 != get16(p) || get16(p + 2) > len)
+		return;
+
+	end = p + get16(p + 2);
+	domain = get32(p + 12);
+	p += 16;
+
+	if (AF_INET6 == from->ss_family &&
+	    IN6_IS_ADDR_V4MAPPED(&((struct sockaddr_in6 *) from)->sin6_addr))
+		inet_ntop(AF_INET,
+			&((struct sockaddr_in6 *) from)->sin6_addr.s6_addr[12],
+			name, sizeof(name));
+	else if (!xinet_ntop((struct sockaddr *) from, name, sizeof(name)))
+		return;
+
+	e = get_exporter(name, "ipfix");
+
+	while (end - p >= 4) {
+		uint16_t id = get16(p), slen = get16(p + 2);
+		struct template *t;
+
+		if (slen < 4 || slen > end - p)
+			return;
+
+		if (2 == id)
+			parse_templates(e, domain, p + 4, p + slen);
+		else if (id >= 256 && (t = find_template(e, domain, id)))
+			parse_data(e, t, p + 4, p + slen, ts);
+
+		p += slen;
+	}
+}
+
+/*
+ * Datagrams are received in batches, each with its kernel receive
+ * timestamp which is used as sample time.
+ */
+static void
+drain(int fd)
+{
+	int n, m;
+
+	for (;;) {
+		for (n = 0; n < BATCH; n++) {
+			iovs[n].iov_base = bufs + n * DGRAM_MAX;
+			iovs[n].iov_len = DGRAM_MAX;
+			msgs[n].msg_hdr = (struct msghdr) {
+				.msg_name = &addrs[n],
+				.msg_namelen = sizeof(addrs[n]),
+				.msg_iov = &iovs[n],
+				.msg_iovlen = 1,
+				.msg_control = ctls[n],
+				.msg_controllen = sizeof(ctls[n]),
+			};
+		}
+
+		if ((m = recvmmsg(fd, msgs, BATCH, MSG_DONTWAIT, NULL)) <= 0)
+			return;
+
+		for (n = 0; n < m; n++) {
+			struct msghdr *h = &msgs[n].msg_hdr;
+			struct cmsghdr *cmsg;
+			timestamp_t ts;
+
+			update_ts(&ts);
+			for (cmsg = CMSG_FIRSTHDR(h); cmsg; cmsg = CMSG_NXTHDR(h, cmsg)) {
+				if (SOL_SOCKET == cmsg->cmsg_level &&
+				    SCM_TIMESTAMP == cmsg->cmsg_type) {
+					struct timeval tv;
+
+					memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+					ts.tv_sec = tv.tv_sec;
+					ts.tv_usec = tv.tv_usec;
+				}
+			}
+
+			if (fd == sflow_fd)
+				parse_sflow(iovs[n].iov_base, msgs[n].msg_len, &ts);
+			else
+				parse_ipfix(iovs[n].iov_base, msgs[n].msg_len,
+					&addrs[n], &ts);
+		}
+
+		if (m < BATCH)
+			return;
+	}
+}
+
+static void
+update_exporter(struct exporter *e, time_t now)
+{
+	node_t *node = lookup_node(e->e_node, 1);
+	int n;
+
+	if (NULL == node->n_from)
+		node->n_from = strdup(e->e_proto);
+
+	for (n = 0; n < e->e_nrows; n++) {
+		struct port_row *r = &e->e_rows[n];
+		char name[IFNAME_MAX];
+		intf_t *i;
+
+		/* ports not reported anymore */
+		if (now - r->r_seen > c_expire) {
+			memmove(r, r + 1, (--e->e_nrows - n) * sizeof(*r));
+			n--;
+			continue;
+		}
+
+		snprintf(name, sizeof(name), "if%u", r->r_index);
+		if (!(i = lookup_intf(node, name, 0, 0)))
+			continue;
+
+		/* samples arrive far less often than reads */
+		increase_lifetime(i, 1);
+
+		if (!r->r_fresh)
+			continue;
+
+		i->i_rx_bytes.r_total = r->r_cnt[0];
+		i->i_rx_packets.r_total = r->r_cnt[1];
+		i->i_tx_bytes.r_total = r->r_cnt[2];
+		i->i_tx_packets.r_total = r->r_cnt[3];
+		i->i_rx_bytes.r_is64bit = i->i_tx_bytes.r_is64bit = 1;
+
+		if (!strcmp(e->e_proto, "sflow")) {
+			update_attr(i, ERRORS, r->r_rx_errors, r->r_tx_errors,
+				RX_PROVIDED | TX_PROVIDED);
+			update_attr(i, DROP, r->r_rx_drop, r->r_tx_drop,
+				RX_PROVIDED | TX_PROVIDED);
+		}
+
+		notify_update_ts(i, &r->r_ts);
+		r->r_fresh = 0;
+	}
+}
+
+static void
+sflow_read(void)
+{
+	struct exporter *e;
+	timestamp_t now;
+
+	if (sflow_fd >= 0)
+		drain(sflow_fd);
+	if (ipfix_fd >= 0)
+		drain(ipfix_fd);
+
+	update_ts(&now);
+
+	for (e = exporters; e; e = e->e_next)
+		update_exporter(e, now.tv_sec);
+}
+
+static int
+open_port(int port)
+{
+	struct sockaddr_in6 addr = {
+		.sin6_family = AF_INET6,
+		.sin6_addr = IN6ADDR_ANY_INIT,
+		.sin6_port = htons(port),
+	};
+	int fd, on = 1, off = 0;
+
+	/* a dual stack socket accepts IPv4 exporters as well */
+	if ((fd = socket(AF_INET6, SOCK_DGRAM, 0)) < 0)
+		quit("socket() failed: %s\n", strerror(errno));
+
+	setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+	setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		quit("Unable to bind to port %d: %s\n", port, strerror(errno));
+
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+		quit("fcntl failed: %s\n", strerror(errno));
+
+	return fd;
+}
+
+static void
+print_help(void)
+{
+	printf(
+		"sflow - sFlow and IPFIX collector\n" \
+		"\n" \
+		"  Receives sFlow v5 and IPFIX datagrams from switches and routers\n" \
+		"  bmon cannot run on. Every exporter is shown as a separate node\n" \
+		"  (sflow/ADDR, ipfix/ADDR), its ports are shown as interfaces\n" \
+		"  named after their ifIndex.\n" \
+		"  sFlow counter samples provide the interface counters, IPFIX\n" \
+		"  flow records are summed up per ingress and egress interface.\n" \
+		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
+		"\n" \
+		"  Options:\n" \
+		"    port=NUM       sFlow port, 0 to disable (default: 6343)\n" \
+		"    ipfix=NUM      IPFIX port, 0 to disable (default: 4739)\n" \
+		"    expire=SEC     Forget ports not reported for SEC seconds (default: 300)\n");
+}
+
+static void
+sflow_set_opts(tv_t *attrs)
+{
+	while (attrs) {
+		if (!strcasecmp(attrs->type, "port") && attrs->value)
+			c_sflow_port = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "ipfix") && attrs->value)
+			c_ipfix_port = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "expire") && attrs->value)
+			c_expire = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "help")) {
+			print_help();
+			exit(0);
+		}
+		attrs = attrs->next;
+	}
+}
+
+static int
+sflow_probe(void)
+{
+	return c_sflow_port > 0 || c_ipfix_port > 0;
+}
+
+static void
+sflow_init(void)
+{
+	if (c_sflow_port > 0)
+		sflow_fd = open_port(c_sflow_port);
+	if (c_ipfix_port > 0)
+		ipfix_fd = open_port(c_ipfix_port);
+
+	bufs = xcalloc(BATCH, DGRAM_MAX);
+}
+
+static void
+sflow_shutdown(void)
+{
+	if (sflow_fd >= 0)
+		close(sflow_fd);
+	if (ipfix_fd >= 0)
+		close(ipfix_fd);
+	xfree(bufs);
+}
+
+static struct input_module sflow_ops = {
+	.im_name = "sflow",
+	.im_read = sflow_read,
+	.im_set_opts = sflow_set_opts,
+	.im_probe = sflow_probe,
+	.im_init = sflow_init,
+	.im_shutdown = sflow_shutdown,
+};
+
+static void __init
+sflow_register(void)
+{
+	register_secondary_input_module(&sflow_ops);
+}
+
+#endif
@@ -0,0 +1,851 @@
+/*
+ * in_snmp.c            SNMPv2c input
+ *
+ * Copyright (c) 2001-2004 Thomas Graf <tgraf@suug.ch>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <bmon/bmon.h>
+#include <bmon/input.h>
+#include <bmon/node.h>
+#include <bmon/intf.h>
+#include <bmon/conf.h>
+#include <bmon/utils.h>
+
+#if defined HAVE_PTHREAD
+
+#include <pthread.h>
+#include <poll.h>
+#include <netdb.h>
+#include <fcntl.h>
+
+#define SNMP_BUFSIZE	65536
+#define MAX_AGENTS	32768
+
+/* walks an interface may be missing before it is dropped */
+#define ROW_EXPIRE	5
+
+/* ASN.1/BER tags used by SNMP */
+#define BER_INTEGER	0x02
+#define BER_OCTETS	0x04
+#define BER_NULL	0x05
+#define BER_OID		0x06
+#define BER_SEQUENCE	0x30
+#define BER_COUNTER32	0x41
+#define BER_COUNTER64	0x46
+#define BER_END_OF_MIB	0x82
+#define PDU_RESPONSE	0xa2
+#define PDU_GETBULK	0xa5
+
+enum {
+	COL_IN_OCTETS,
+	COL_IN_PKTS,
+	COL_OUT_OCTETS,
+	COL_OUT_PKTS,
+	__COL_MAX,
+};
+
+/* ifXTable columns, ifName and the 64 bit counters */
+static const uint32_t if_x_table[] = { 1, 3, 6, 1, 2, 1, 31, 1, 1, 1 };
+#define IFX_LEN		(sizeof(if_x_table) / sizeof(if_x_table[0]))
+#define IFX_NAME	1
+static const uint32_t counter_cols[__COL_MAX] = { 6, 7, 10, 11 };
+
+static char *c_community = "public";
+static char *c_file;
+static int c_maxrep = 16;
+static int c_timeout = 1000;
+static int c_retries = 2;
+static int c_names = 60;
+
+struct snmp_row
+{
+	uint32_t	r_index;
+	int		r_fresh;
+	int		r_seen;
+	char		r_name[IFNAME_MAX];
+	b_cnt_t		r_cnt[__COL_MAX];
+	timestamp_t	r_ts;
+};
+
+/*
+ * An agent has at most one request in flight, a walk is continued
+ * as soon as its reply arrives. Many agents are walked in parallel.
+ */
+struct agent
+{
+	char *			a_host;
+	char *			a_community;
+	struct sockaddr_storage	a_addr;
+	socklen_t		a_addrlen;
+	int			a_fd;
+
+	int			a_busy;
+	int			a_names;
+	int			a_need_names;
+	int			a_walks;
+	uint32_t		a_last;
+	uint32_t		a_reqid;
+	uint16_t		a_seq;
+	int			a_tries;
+	timestamp_t		a_sent;
+	timestamp_t		a_next;
+
+	struct snmp_row *	a_rows;
+	int			a_nrows;
+};
+
+static struct agent *agents;
+static int nagents;
+static int fd4 = -1, fd6 = -1;
+static tv_t *agent_opts;
+
+static pthread_t walker;
+static pthread_mutex_t snmp_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * BER encoding, constructed types are written with room for a long
+ * form length which is then shrunk to the minimal encoding.
+ */
+struct ber
+{
+	uint8_t *	b_buf;
+	size_t		b_len;
+	size_t		b_size;
+};
+
+static void
+ber_byte(struct ber *b, uint8_t v)
+{
+	if (b->b_len < b->b_size)
+		b->b_buf[b->b_len] = v;
+	b->b_len++;
+}
+
+static size_t
+ber_begin(struct ber *b, uint8_t tag)
+{
+	ber_byte(b, tag);
+	b->b_len += 3;
+	return b->b_len;
+}
+
+static void
+ber_end(struct ber *b, size_t start)
+{
+	size_t len = b->b_len - start, hdr;
+	uint8_t *p = b->b_buf + start - 3;
+
+	if (b->b_len > b->b_size)
+		return;
+
+	if (len < 0x80) {
+		p[0] = len;
+		hdr = 1;
+	} else if (len < 0x100) {
+		p[0] = 0x81;
+		p[1] = len;
+		hdr = 2;
+	} else {
+		p[0] = 0x82;
+		p[1] = len >> 8;
+		p[2] = len;
+		hdr = 3;
+	}
+
+	memmove(p + hdr, b->b_buf + start, len);
+	b->b_len -= 3 - hdr;
+}
+
+static void
+ber_int(struct ber *b, int64_t v)
+{
+	int n = 8;
+
+	/* strip redundant leading bytes */
+	while (n > 1 && ((v >> ((n - 1) * 8 - 1)) == 0 ||
+			 (v >> ((n - 1) * 8 - 1)) == -1))
+		n--;
+
+	ber_byte(b, BER_INTEGER);
+	ber_byte(b, n);
+	while (n--)
+		ber_byte(b, v >> (n * 8));
+}
+
+static void
+ber_octets(struct ber *b, const char *s)
+{
+	size_t start = ber_begin(b, BER_OCTETS);
+
+	while (*s)
+		ber_byte(b, *s++);
+	ber_end(b, start);
+}
+
+static void
+ber_oid(struct ber *b, const uint32_t *oid, int len)
+{
+	size_t start = ber_begin(b, BER_OID);
+	int n;
+
+	ber_byte(b, oid[0] * 40 + oid[1]);
+
+	for (n = 2; n < len; n++) {
+		int shift;
+
+		for (shift = 28; shift > 0; shift -= 7)
+			if (oid[n] >> shift)
+				ber_byte(b, 0x80 | ((oid[n] >> shift) & 0x7f));
+		ber_byte(b, oid[n] & 0x7f);
+	}
+
+	ber_end(b, start);
+}
+
+/* returns the content of the next element or NULL */
+static const uint8_t *
+ber_get(const uint8_t **pp, const uint8_t *end, uint8_t *tag, size_t *len)
+{
+	const uint8_t *p = *pp;
+	size_t l;
+
+	if (end - p < 2)
+		return NULL;
+
+	*tag = *p++;
+	l = *p++;
+
+	if (l & 0x80) {
+		int n = l & 0x7f;
+
+		if (n > 3 || end - p < n)
+			return NULL;
+		for (l = 0; n--; )
+			l = (l << 8) | *p++;
+	}
+
+	if ((size_t) (end - p) < l)
+		return NULL;
+
+	*len = l;
+	*pp = p + l;
+
+	return p;
+}
+
+static uint64_t
+ber_uint(const uint8_t *p, size_t len)
+{
+	uint64_t v = 0;
+
+	while (len--)
+		v = (v << 8) | *p++;
+
+	return v;
+}
+
+static int
+ber_get_oid(const uint8_t *p, size_t len, uint32_t *oid, int max)
+{
+	int n = 0;
+	uint32_t v = 0;
+
+	if (len < 1 || max < 2)
+		return -1;
+
+	oid[n++] = p[0] / 40;
+	oid[n++] = p[0] % 40;
+
+	for (p++, len--; len; p++, len--) {
+		v = (v << 7) | (*p & 0x7f);
+		if (!(*p & 0x80)) {
+			if (n >= max)
+				return -1;
+			oid[n++] = v;
+			v = 0;
+		}
+	}
+
+	return n;
+}
+
+static void
+send_request(struct agent *a)
+{
+	uint8_t buf[1024];
+	struct ber b = { .b_buf = buf, .b_size = sizeof(buf) };
+	uint32_t oid[IFX_LEN + 2];
+	size_t msg, pdu, list;
+	int n, ncols = a->a_names ? 1 : __COL_MAX;
+
+	a->a_reqid = ((uint32_t) (a - agents) << 16) | ++a->a_seq;
+
+	msg = ber_begin(&b, BER_SEQUENCE);
+	ber_int(&b, 1);				/* v2c */
+	ber_octets(&b, a->a_community);
+	pdu = ber_begin(&b, PDU_GETBULK);
+	ber_int(&b, a->a_reqid);
+	ber_int(&b, 0);				/* non-repeaters */
+	ber_int(&b, c_maxrep);
+	list = ber_begin(&b, BER_SEQUENCE);
+
+	memcpy(oid, if_x_table, sizeof(if_x_table));
+	for (n = 0; n < ncols; n++) {
+		size_t vb = ber_begin(&b, BER_SEQUENCE);
+		int len = IFX_LEN + 1;
+
+		oid[IFX_LEN] = a->a_names ? IFX_NAME : counter_cols[n];
+		if (a->a_last)
+			oid[len++] = a->a_last;
+
+		ber_oid(&b, oid, len);
+		ber_byte(&b, BER_NULL);
+		ber_byte(&b, 0);
+		ber_end(&b, vb);
+	}
+
+	ber_end(&b, list);
+	ber_end(&b, pdu);
+	ber_end(&b, msg);
+
+	update_ts(&a->a_sent);
+
+	if (b.b_len <= sizeof(buf))
+		sendto(a->a_fd, buf, b.b_len, 0, (struct sockaddr *) &a->a_addr,
+			a->a_addrlen);
+}
+
+static void
+start_walk(struct agent *a)
+{
+	a->a_busy = 1;
+	a->a_last = 0;
+	a->a_tries = 0;
+	a->a_names = a->a_need_names || (c_names && !(a->a_walks % c_names));
+	a->a_need_names = 0;
+	a->a_walks++;
+
+	send_request(a);
+}
+
+static struct snmp_row *
+get_row(struct agent *a, uint32_t index)
+{
+	int lo = 0, hi = a->a_nrows;
+	struct snmp_row *r;
+
+	/* rows are sorted by ifIndex, walks return them in order */
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (a->a_rows[mid].r_index == index)
+			return &a->a_rows[mid];
+		if (a->a_rows[mid].r_index < index)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	a->a_rows = xrealloc(a->a_rows, (a->a_nrows + 1) * sizeof(*r));
+	r = &a->a_rows[lo];
+	memmove(r + 1, r, (a->a_nrows - lo) * sizeof(*r));
+	a->a_nrows++;
+
+	memset(r, 0, sizeof(*r));
+	r->r_index = index;
+	r->r_seen = a->a_walks;
+	snprintf(r->r_name, sizeof(r->r_name), "if%u", index);
+
+	/* new interface, its name is needed */
+	if (!a->a_names)
+		a->a_need_names = 1;
+
+	return r;
+}
+
+/*
+ * Returns the ifIndex if the variable belongs to the column walked,
+ * 0 if the walk went past the end of it.
+ */
+static uint32_t
+column_index(const uint8_t *p, size_t len, uint32_t col)
+{
+	uint32_t oid[IFX_LEN + 2];
+	int n = ber_get_oid(p, len, oid, IFX_LEN + 2);
+
+	if (n != IFX_LEN + 2 || memcmp(oid, if_x_table, sizeof(if_x_table)) ||
+	    oid[IFX_LEN] != col)
+		return 0;
+
+	return oid[IFX_LEN + 1];
+}
+
+/*
+ * Every repetition of a reply carries one variable per column walked,
+ * all of them for the same ifIndex.
+ */
+static void
+handle_varbinds(struct agent *a, const uint8_t *p, const uint8_t *end,
+		timestamp_t *ts)
+{
+	int ncols = a->a_names ? 1 : __COL_MAX, col = 0, rows = 0;
+	struct snmp_row *r = NULL;
+	const uint8_t *vb;
+	uint8_t tag;
+	size_t len;
+
+	while ((vb = ber_get(&p, end, &tag, &len))) {
+		const uint8_t *vend = vb + len, *oid, *val;
+		size_t olen, vlen;
+		uint32_t index;
+
+		if (BER_SEQUENCE != tag ||
+		    !(oid = ber_get(&vb, vend, &tag, &olen)) || BER_OID != tag ||
+		    !(val = ber_get(&vb, vend, &tag, &vlen)))
+			goto done;
+
+		index = column_index(oid, olen, a->a_names ? IFX_NAME :
+			counter_cols[col]);
+
+		if (!index || BER_END_OF_MIB == tag)
+			goto done;
+
+		if (0 == col)
+			r = get_row(a, index);
+		else if (index != r->r_index)
+			goto done;
+
+		if (a->a_names) {
+			size_t n = vlen < IFNAME_MAX - 1 ? vlen : IFNAME_MAX - 1;
+
+			if (BER_OCTETS == tag && n) {
+				memcpy(r->r_name, val, n);
+				r->r_name[n] = '\0';
+			}
+		} else if ((BER_COUNTER64 == tag || BER_COUNTER32 == tag) &&
+			   vlen <= 9) {
+			r->r_cnt[col] = ber_uint(val, vlen);
+			if (ncols - 1 == col) {
+				COPY_TS(&r->r_ts, ts);
+				r->r_fresh = 1;
+				r->r_seen = a->a_walks;
+			}
+		}
+
+		if (++col == ncols) {
+			col = 0;
+			rows++;
+			a->a_last = index;
+		}
+	}
+
+	/* a full reply means there is more */
+	if (rows >= c_maxrep) {
+		a->a_tries = 0;
+		send_request(a);
+		return;
+	}
+
+done:
+	a->a_busy = 0;
+}
+
+static void
+handle_reply(const uint8_t *buf, size_t size, timestamp_t *ts)
+{
+	const uint8_t *p = buf, *end = buf + size, *v;
+	struct agent *a;
+	uint8_t tag;
+	size_t len;
+	uint32_t reqid;
+
+	if (!(v = ber_get(&p, end, &tag, &len)) || BER_SEQUENCE != tag)
+		return;
+	end = v + len;
+	p = v;
+
+	/* version, community */
+	if (!ber_get(&p, end, &tag, &len) || !ber_get(&p, end, &tag, &len))
+		return;
+
+	if (!(v = ber_get(&p, end, &tag, &len)) || PDU_RESPONSE != tag)
+		return;
+	end = v + len;
+	p = v;
+
+	if (!(v = ber_get(&p, end, &tag, &len)) || BER_INTEGER != tag)
+		return;
+	reqid = ber_uint(v, len);
+
+	if ((reqid >> 16) >= (uint32_t) nagents)
+		return;
+	a = &agents[reqid >> 16];
+
+	/* late or duplicated replies */
+	if (!a->a_busy || reqid != a->a_reqid)
+		return;
+
+	/* error status */
+	if (!(v = ber_get(&p, end, &tag, &len)) || ber_uint(v, len)) {
+		a->a_busy = 0;
+		return;
+	}
+
+	/* error index, varbind list */
+	if (!ber_get(&p, end, &tag, &len) ||
+	    !(v = ber_get(&p, end, &tag, &len)) || BER_SEQUENCE != tag) {
+		a->a_busy = 0;
+		return;
+	}
+
+	handle_varbinds(a, v, v + len, ts);
+}
+
+/*
+ * Replies are timestamped by the kernel on arrival, the counters of
+ * a reply are accounted at that time rather than at the next read.
+ */
+static void
+drain(int fd)
+{
+	static uint8_t buf[SNMP_BUFSIZE];
+
+	for (;;) {
+		char ctl[CMSG_SPACE(sizeof(struct timeval))];
+		struct iovec iov = { buf, sizeof(buf) };
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = ctl,
+			.msg_controllen = sizeof(ctl),
+		};
+		struct cmsghdr *cmsg;
+		timestamp_t ts;
+		ssize_t n;
+
+		if ((n = recvmsg(fd, &msg, MSG_DONTWAIT)) < 0)
+			return;
+
+		update_ts(&ts);
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (SOL_SOCKET == cmsg->cmsg_level &&
+			    SCM_TIMESTAMP == cmsg->cmsg_type) {
+				struct timeval tv;
+
+				memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+				ts.tv_sec = tv.tv_sec;
+				ts.tv_usec = tv.tv_usec;
+			}
+		}
+
+		pthread_mutex_lock(&snmp_lock);
+		handle_reply(buf, n, &ts);
+		pthread_mutex_unlock(&snmp_lock);
+	}
+}
+
+static int
+ms_until(timestamp_t *now, timestamp_t *t)
+{
+	float d = time_diff(now, t);
+
+	return d <= 0.0f ? 0 : (int) (d * 1000.0f) + 1;
+}
+
+static void *
+walker_thread(void *arg)
+{
+	timestamp_t interval, tmo;
+	struct pollfd pfd[2];
+	int npfd = 0, n;
+
+	get_read_interval_as_ts(&interval);
+	float_to_ts(&tmo, c_timeout / 1000.0f);
+
+	if (fd4 >= 0)
+		pfd[npfd++] = (struct pollfd) { .fd = fd4, .events = POLLIN };
+	if (fd6 >= 0)
+		pfd[npfd++] = (struct pollfd) { .fd = fd6, .events = POLLIN };
+
+	for (;;) {
+		timestamp_t now;
+		int wait = 1000;
+
+		update_ts(&now);
+
+		pthread_mutex_lock(&snmp_lock);
+		for (n = 0; n < nagents; n++) {
+			struct agent *a = &agents[n];
+			timestamp_t t;
+
+			if (a->a_busy) {
+				ts_add(&t, &a->a_sent, &tmo);
+				if (ts_le(&t, &now)) {
+					if (a->a_tries++ < c_retries)
+						send_request(a);
+					else
+						a->a_busy = 0;
+					ts_add(&t, &a->a_sent, &tmo);
+				}
+			} else {
+				if (ts_le(&a->a_next, &now)) {
+					/* do not try to catch up with missed walks */
+					ts_add(&a->a_next, &a->a_next, &interval);
+					if (ts_le(&a->a_next, &now))
+						ts_add(&a->a_next, &now, &interval);
+					start_walk(a);
+					ts_add(&t, &a->a_sent, &tmo);
+				} else
+					COPY_TS(&t, &a->a_next);
+			}
+
+			if (ms_until(&now, &t) < wait)
+				wait = ms_until(&now, &t);
+		}
+		pthread_mutex_unlock(&snmp_lock);
+
+		if (poll(pfd, npfd, wait) > 0)
+			for (n = 0; n < npfd; n++)
+				if (pfd[n].revents & POLLIN)
+					drain(pfd[n].fd);
+	}
+
+	return NULL;
+}
+
+static void
+snmp_read(void)
+{
+	int n, m;
+
+	pthread_mutex_lock(&snmp_lock);
+
+	for (n = 0; n < nagents; n++) {
+		struct agent *a = &agents[n];
+		node_t *node;
+
+		if (!a->a_nrows)
+			continue;
+
+		node = lookup_node(a->a_host, 1);
+		if (NULL == node->n_from)
+			node->n_from = strdup(a->a_host);
+
+		for (m = 0; m < a->a_nrows; m++) {
+			struct snmp_row *r = &a->a_rows[m];
+			intf_t *i;
+
+			/* interfaces gone from the agent expire */
+			if (a->a_walks - r->r_seen > ROW_EXPIRE) {
+				memmove(r, r + 1, (--a->a_nrows - m) * sizeof(*r));
+				m--;
+				continue;
+			}
+
+			if (!(i = lookup_intf(node, r->r_name, 0, 0)))
+				continue;
+
+			/* keep interfaces across reads without a new sample */
+			increase_lifetime(i, 1);
+
+			if (!r->r_fresh)
+				continue;
+
+			i->i_rx_bytes.r_total = r->r_cnt[COL_IN_OCTETS];
+			i->i_rx_packets.r_total = r->r_cnt[COL_IN_PKTS];
+			i->i_tx_bytes.r_total = r->r_cnt[COL_OUT_OCTETS];
+			i->i_tx_packets.r_total = r->r_cnt[COL_OUT_PKTS];
+			i->i_rx_bytes.r_is64bit = i->i_tx_bytes.r_is64bit = 1;
+			i->i_rx_packets.r_is64bit = i->i_tx_packets.r_is64bit = 1;
+
+			notify_update_ts(i, &r->r_ts);
+			r->r_fresh = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&snmp_lock);
+}
+
+static void
+add_agent(const char *spec, const char *community)
+{
+	struct addrinfo hints = { .ai_socktype = SOCK_DGRAM }, *res;
+	char host[256], *port = "161", *p;
+	struct agent *a;
+	int *fd;
+
+	if (nagents >= MAX_AGENTS)
+		quit("Too many SNMP agents\n");
+
+	snprintf(host, sizeof(host), "%s", spec);
+
+	/* host:port, [v6addr]:port */
+	if ('[' == host[0] && (p = strchr(host, ']'))) {
+		*p++ = '\0';
+		memmove(host, host + 1, strlen(host));
+		if (':' == *p)
+			port = p + 1;
+	} else if ((p = strchr(host, ':')) && !strchr(p + 1, ':')) {
+		*p = '\0';
+		port = p + 1;
+	}
+
+	if (getaddrinfo(host, port, &hints, &res))
+		quit("Unable to resolve SNMP agent %s\n", spec);
+
+	fd = AF_INET6 == res->ai_family ? &fd6 : &fd4;
+	if (*fd < 0) {
+		int on = 1;
+
+		if ((*fd = socket(res->ai_family, SOCK_DGRAM, 0)) < 0)
+			quit("socket() failed: %s\n", strerror(errno));
+		setsockopt(*fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+		fcntl(*fd, F_SETFL, O_NONBLOCK);
+	}
+
+	agents = xrealloc(agents, (nagents + 1) * sizeof(*agents));
+	a = &agents[nagents++];
+	memset(a, 0, sizeof(*a));
+
+	a->a_host = strdup(spec);
+	a->a_community = strdup(community ? community : c_community);
+	memcpy(&a->a_addr, res->ai_addr, res->ai_addrlen);
+	a->a_addrlen = res->ai_addrlen;
+	a->a_fd = *fd;
+
+	freeaddrinfo(res);
+}
+
+static void
+read_agent_file(const char *path)
+{
+	FILE *f;
+	char buf[512];
+
+	if (!(f = fopen(path, "r")))
+		quit("Unable to open %s: %s\n", path, strerror(errno));
+
+	while (fgets(buf, sizeof(buf), f)) {
+		char *host, *community;
+
+		if (!(host = strtok(buf, " \t\r\n")) || '#' == host[0])
+			continue;
+
+		community = strtok(NULL, " \t\r\n");
+		add_agent(host, community);
+	}
+
+	fclose(f);
+}
+
+static void
+print_help(void)
+{
+	printf(
+		"snmp - SNMPv2c interface statistics\n" \
+		"\n" \
+		"  Collects the 64 bit interface counters of the ifXTable from\n" \
+		"  SNMP agents, e.g. switches and routers bmon cannot run on.\n" \
+		"  Every agent is shown as a separate node. All agents are walked\n" \
+		"  in parallel using GETBULK requests by a separate thread, the\n" \
+		"  interface names are cached. Rates are calculated based on the\n" \
+		"  arrival time of the replies.\n" \
+		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
+		"\n" \
+		"  Options:\n" \
+		"    agent=HOST[:PORT]  Agent to query, may be given multiple times\n" \
+		"    file=PATH          File with one agent per line: HOST[:PORT] [COMMUNITY]\n" \
+		"    community=STR      Community (default: public)\n" \
+		"    maxrep=NUM         Max. repetitions per request (default: 16)\n" \
+		"    timeout=MS         Request timeout (default: 1000)\n" \
+		"    retries=NUM        Number of retransmissions (default: 2)\n" \
+		"    names=NUM          Refresh interface names every NUM walks (default: 60)\n");
+}
+
+static void
+snmp_set_opts(tv_t *attrs)
+{
+	agent_opts = attrs;
+
+	while (attrs) {
+		if (!strcasecmp(attrs->type, "community") && attrs->value)
+			c_community = attrs->value;
+		else if (!strcasecmp(attrs->type, "file") && attrs->value)
+			c_file = attrs->value;
+		else if (!strcasecmp(attrs->type, "maxrep") && attrs->value)
+			c_maxrep = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "timeout") && attrs->value)
+			c_timeout = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "retries") && attrs->value)
+			c_retries = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "names") && attrs->value)
+			c_names = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "help")) {
+			print_help();
+			exit(0);
+		}
+		attrs = attrs->next;
+	}
+}
+
+static int
+snmp_probe(void)
+{
+	tv_t *t;
+
+	/* the community applies to all agents no matter the order */
+	for (t = agent_opts; t; t = t->next)
+		if (!strcasecmp(t->type, "agent") && t->value)
+			add_agent(t->value, NULL);
+
+	if (c_file)
+		read_agent_file(c_file);
+
+	if (c_maxrep < 1)
+		c_maxrep = 1;
+
+	return nagents > 0;
+}
+
+static void
+snmp_init(void)
+{
+	if (pthread_create(&walker, NULL, walker_thread, NULL))
+		quit("Unable to start SNMP walker: %s\n", strerror(errno));
+}
+
+static struct input_module snmp_ops = {
+	.im_name = "snmp",
+	.im_read = snmp_read,
+	.im_set_opts = snmp_set_opts,
+	.im_probe = snmp_probe,
+	.im_init = snmp_init,
+};
+
+static void __init
+snmp_register(void)
+{
+	register_secondary_input_module(&snmp_ops);
+}
+
+#endif
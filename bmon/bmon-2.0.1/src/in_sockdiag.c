@@ -0,0 +1,651 @@
+/*
+ * in_sockdiag.c         Per process TCP bandwidth via sock_diag (Linux)
+ *
+ * Copyright (c) 2001-2004 Thomas Graf <tgraf@suug.ch>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <bmon/bmon.h>
+#include <bmon/input.h>
+#include <bmon/node.h>
+#include <bmon/intf.h>
+#include <bmon/utils.h>
+
+#if defined SYS_LINUX
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/tcp.h>
+
+#define SD_BUFSIZE	65536
+#define UNATTRIBUTED	0xffffffffU
+
+/* tcp_info must be long enough to carry both byte counters */
+#define TCPI_MIN_LEN \
+	(offsetof(struct tcp_info, tcpi_bytes_received) + sizeof(uint64_t))
+
+static char *c_name = "processes";
+static int c_top = 10;
+static int c_scan = 256;
+
+/*
+ * Every TCP socket is kept in an open addressing table keyed by its
+ * inode. The table holds the counters of the previous read, the delta
+ * of the current read and the process owning the socket if known.
+ */
+struct sock_ent
+{
+	uint32_t	se_inode;
+	uint32_t	se_gen;
+	uint32_t	se_pid;
+	uint64_t	se_acked;
+	uint64_t	se_received;
+	uint64_t	se_tx;
+	uint64_t	se_rx;
+};
+
+#define SE_FREE		0
+#define SE_DELETED	0xffffffffU
+
+struct proc_ent
+{
+	uint32_t	pe_pid;
+	uint32_t	pe_gen;
+	b_cnt_t		pe_rx;
+	b_cnt_t		pe_tx;
+	b_cnt_t		pe_delta;
+	char		pe_comm[16];
+};
+
+struct table
+{
+	void *		t_ents;
+	size_t		t_size;
+	size_t		t_used;
+	size_t		t_deleted;
+};
+
+static struct table socks, procs;
+static int nl_fd = -1;
+static uint32_t nl_seq;
+static char *nl_buf;
+static uint32_t generation;
+static size_t scan_pos;
+static b_cnt_t total_rx, total_tx, unknown_rx, unknown_tx;
+
+static inline uint32_t
+hash32(uint32_t v)
+{
+	v ^= v >> 16;
+	v *= 0x7feb352dU;
+	v ^= v >> 15;
+	v *= 0x846ca68bU;
+	v ^= v >> 16;
+	return v;
+}
+
+#define SOCK(i)	(((struct sock_ent *) socks.t_ents) + (i))
+#define PROC(i)	(((struct proc_ent *) procs.t_ents) + (i))
+
+static struct sock_ent *
+find_sock(uint32_t inode)
+{
+	size_t i, mask = socks.t_size - 1;
+
+	for (i = hash32(inode) & mask; ; i = (i + 1) & mask) {
+		if (SOCK(i)->se_inode == inode)
+			return SOCK(i);
+		if (SOCK(i)->se_inode == SE_FREE)
+			return NULL;
+	}
+}
+
+static struct proc_ent *
+find_proc(uint32_t pid)
+{
+	size_t i, mask = procs.t_size - 1;
+
+	for (i = hash32(pid) & mask; ; i = (i + 1) & mask) {
+		if (PROC(i)->pe_pid == pid)
+			return PROC(i);
+		if (PROC(i)->pe_pid == SE_FREE)
+			return NULL;
+	}
+}
+
+/*
+ * Rebuilds a table at the given size, dropping all tombstones. Sockets
+ * and processes use the same layout, the key is the first member.
+ */
+static void
+rehash(struct table *t, size_t entsize, size_t size)
+{
+	char *old = t->t_ents;
+	size_t n, oldsize = t->t_size;
+
+	t->t_ents = xcalloc(size, entsize);
+	t->t_size = size;
+	t->t_used = 0;
+	t->t_deleted = 0;
+
+	for (n = 0; n < oldsize; n++) {
+		uint32_t key = *(uint32_t *) (old + n * entsize);
+		size_t i, mask = size - 1;
+
+		if (key == SE_FREE || key == SE_DELETED)
+			continue;
+
+		for (i = hash32(key) & mask; *(uint32_t *) ((char *) t->t_ents +
+		     i * entsize) != SE_FREE; i = (i + 1) & mask);
+
+		memcpy((char *) t->t_ents + i * entsize, old + n * entsize,
+			entsize);
+		t->t_used++;
+	}
+
+	xfree(old);
+}
+
+static void *
+insert(struct table *t, size_t entsize, uint32_t key)
+{
+	size_t i, mask;
+	char *e;
+
+	/* keep the load factor below 1/2 including tombstones */
+	if ((t->t_used + t->t_deleted + 1) * 2 > t->t_size) {
+		size_t size = t->t_size;
+
+		while ((t->t_used + 1) * 2 > size / 2)
+			size *= 2;
+		rehash(t, entsize, size);
+	}
+
+	mask = t->t_size - 1;
+	for (i = hash32(key) & mask; ; i = (i + 1) & mask) {
+		e = (char *) t->t_ents + i * entsize;
+		if (*(uint32_t *) e == SE_FREE)
+			break;
+	}
+
+	memset(e, 0, entsize);
+	*(uint32_t *) e = key;
+	t->t_used++;
+
+	return e;
+}
+
+static void
+sweep(struct table *t, size_t entsize, size_t gen_off)
+{
+	size_t n;
+
+	for (n = 0; n < t->t_size; n++) {
+		char *e = (char *) t->t_ents + n * entsize;
+		uint32_t key = *(uint32_t *) e;
+
+		if (key == SE_FREE || key == SE_DELETED)
+			continue;
+
+		if (*(uint32_t *) (e + gen_off) != generation) {
+			*(uint32_t *) e = SE_DELETED;
+			t->t_used--;
+			t->t_deleted++;
+		}
+	}
+
+	if (t->t_deleted * 4 > t->t_size)
+		rehash(t, entsize, t->t_size);
+}
+
+static void
+update_sock(struct inet_diag_msg *msg, int len)
+{
+	struct rtattr *rta = (struct rtattr *) (msg + 1);
+	struct tcp_info *ti = NULL;
+	struct sock_ent *se;
+	uint32_t inode = msg->idiag_inode;
+
+	len -= NLMSG_ALIGN(sizeof(*msg));
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == INET_DIAG_INFO &&
+		    RTA_PAYLOAD(rta) >= TCPI_MIN_LEN) {
+			ti = RTA_DATA(rta);
+			break;
+		}
+	}
+
+	if (NULL == ti || inode == SE_FREE || inode == SE_DELETED)
+		return;
+
+	if (NULL == (se = find_sock(inode))) {
+		se = insert(&socks, sizeof(*se), inode);
+		/*
+		 * Sockets present on the first read have been transferring
+		 * for an unknown amount of time, later ones are new.
+		 */
+		if (generation > 1) {
+			se->se_tx = ti->tcpi_bytes_acked;
+			se->se_rx = ti->tcpi_bytes_received;
+		}
+	} else {
+		se->se_tx = ti->tcpi_bytes_acked >= se->se_acked ?
+			ti->tcpi_bytes_acked - se->se_acked : 0;
+		se->se_rx = ti->tcpi_bytes_received >= se->se_received ?
+			ti->tcpi_bytes_received - se->se_received : 0;
+	}
+
+	se->se_acked = ti->tcpi_bytes_acked;
+	se->se_received = ti->tcpi_bytes_received;
+	se->se_gen = generation;
+}
+
+static int
+dump_family(int family)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct inet_diag_req_v2 req;
+	} msg = {
+		.nlh = {
+			.nlmsg_len = sizeof(msg),
+			.nlmsg_type = SOCK_DIAG_BY_FAMILY,
+			.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+			.nlmsg_seq = ++nl_seq,
+		},
+		.req = {
+			.sdiag_family = family,
+			.sdiag_protocol = IPPROTO_TCP,
+			.idiag_ext = 1 << (INET_DIAG_INFO - 1),
+			/* all but listeners and timewait, they transfer nothing */
+			.idiag_states = ~((1 << 10) | (1 << 6)),
+		},
+	};
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+
+	if (sendto(nl_fd, &msg, sizeof(msg), 0, (struct sockaddr *) &addr,
+	    sizeof(addr)) < 0)
+		return -1;
+
+	for (;;) {
+		struct nlmsghdr *nlh;
+		ssize_t len;
+
+		if ((len = recv(nl_fd, nl_buf, SD_BUFSIZE, 0)) < 0) {
+			if (EINTR == errno)
+				continue;
+			return -1;
+		}
+
+		for (nlh = (struct nlmsghdr *) nl_buf; NLMSG_OK(nlh, len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != nl_seq)
+				continue;
+			if (NLMSG_DONE == nlh->nlmsg_type)
+				return 0;
+			if (NLMSG_ERROR == nlh->nlmsg_type)
+				return -1;
+			if (SOCK_DIAG_BY_FAMILY == nlh->nlmsg_type)
+				update_sock(NLMSG_DATA(nlh),
+					nlh->nlmsg_len - NLMSG_HDRLEN);
+		}
+	}
+}
+
+static void
+read_comm(struct proc_ent *pe)
+{
+	char path[64];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/%u/comm", pe->pe_pid);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return;
+
+	if ((n = read(fd, pe->pe_comm, sizeof(pe->pe_comm) - 1)) > 0)
+		pe->pe_comm[strcspn(pe->pe_comm, "\n")] = '\0';
+	close(fd);
+}
+
+/*
+ * Assigns all known sockets referenced by the fd table of a process to
+ * it. Only readlink() is needed per fd, sockets link to "socket:[ino]".
+ * Returns the number of sockets which were unattributed before.
+ */
+static int
+scan_fds(struct proc_ent *pe)
+{
+	char path[64], link[64];
+	struct dirent *de;
+	DIR *d;
+	int found = 0;
+
+	snprintf(path, sizeof(path), "/proc/%u/fd", pe->pe_pid);
+	if (!(d = opendir(path)))
+		return 0;
+
+	while ((de = readdir(d))) {
+		struct sock_ent *se;
+		ssize_t n;
+
+		if (DT_LNK != de->d_type && DT_UNKNOWN != de->d_type)
+			continue;
+
+		n = readlinkat(dirfd(d), de->d_name, link, sizeof(link) - 1);
+		if (n < 9 || strncmp(link, "socket:[", 8))
+			continue;
+		link[n] = '\0';
+
+		if ((se = find_sock(strtoul(link + 8, NULL, 10)))) {
+			if (!se->se_pid)
+				found++;
+			se->se_pid = pe->pe_pid;
+		}
+	}
+
+	closedir(d);
+
+	return found;
+}
+
+static int
+count_unknown(void)
+{
+	size_t n;
+	int unknown = 0;
+
+	for (n = 0; n < socks.t_size; n++) {
+		struct sock_ent *se = SOCK(n);
+
+		if (se->se_inode == SE_FREE || se->se_inode == SE_DELETED)
+			continue;
+
+		if (!se->se_pid || !find_proc(se->se_pid)) {
+			se->se_pid = 0;
+			unknown++;
+		}
+	}
+
+	return unknown;
+}
+
+/*
+ * New processes are scanned as they appear. Sockets which could not
+ * be attributed cause a bounded number of known processes to be
+ * rescanned per read, round robin, so the cost per read stays flat
+ * no matter how many processes and sockets exist. Only live entries
+ * count against the budget, the rescan ends early once all sockets
+ * are attributed.
+ */
+static void
+update_procs(void)
+{
+	struct dirent *de;
+	DIR *d;
+	int unknown, budget = c_scan;
+	size_t n;
+
+	if (!(d = opendir("/proc")))
+		return;
+
+	while ((de = readdir(d))) {
+		struct proc_ent *pe;
+		uint32_t pid;
+
+		if (!isdigit((unsigned char) de->d_name[0]))
+			continue;
+
+		pid = strtoul(de->d_name, NULL, 10);
+		if (NULL == (pe = find_proc(pid))) {
+			pe = insert(&procs, sizeof(*pe), pid);
+			read_comm(pe);
+			scan_fds(pe);
+		}
+		pe->pe_gen = generation;
+	}
+
+	closedir(d);
+
+	sweep(&procs, sizeof(struct proc_ent), offsetof(struct proc_ent, pe_gen));
+	unknown = count_unknown();
+
+	for (n = 0; unknown > 0 && budget > 0 && n < procs.t_size; n++) {
+		struct proc_ent *pe;
+
+		scan_pos = (scan_pos + 1) & (procs.t_size - 1);
+		pe = PROC(scan_pos);
+
+		if (pe->pe_pid == SE_FREE || pe->pe_pid == SE_DELETED)
+			continue;
+
+		unknown -= scan_fds(pe);
+		budget--;
+	}
+}
+
+static void
+account(void)
+{
+	size_t n;
+
+	for (n = 0; n < procs.t_size; n++)
+		PROC(n)->pe_delta = 0;
+
+	for (n = 0; n < socks.t_size; n++) {
+		struct sock_ent *se = SOCK(n);
+		struct proc_ent *pe;
+
+		if (se->se_inode == SE_FREE || se->se_inode == SE_DELETED)
+			continue;
+
+		total_rx += se->se_rx;
+		total_tx += se->se_tx;
+
+		if (se->se_pid && (pe = find_proc(se->se_pid))) {
+			pe->pe_rx += se->se_rx;
+			pe->pe_tx += se->se_tx;
+			pe->pe_delta += se->se_rx + se->se_tx;
+		} else {
+			unknown_rx += se->se_rx;
+			unknown_tx += se->se_tx;
+		}
+
+		se->se_rx = se->se_tx = 0;
+	}
+}
+
+static void
+update_child(node_t *node, int parent, const char *name, uint32_t handle,
+	     b_cnt_t rx, b_cnt_t tx)
+{
+	intf_t *intf;
+
+	if (NULL == (intf = lookup_intf(node, name, handle, parent)))
+		return;
+
+	intf->i_link = parent;
+	intf->i_is_child = 1;
+	intf->i_level = 1;
+	intf->i_rx_bytes.r_total = rx;
+	intf->i_tx_bytes.r_total = tx;
+
+	notify_update(intf);
+	increase_lifetime(intf, 1);
+}
+
+static void
+sockdiag_read(void)
+{
+	node_t *node = get_local_node();
+	struct proc_ent *top[c_top];
+	intf_t *intf;
+	size_t n;
+	int i, k, ntop = 0, parent;
+
+	generation++;
+
+	if (dump_family(AF_INET) < 0 || dump_family(AF_INET6) < 0)
+		quit("Unable to dump sockets: %s\n", strerror(errno));
+
+	sweep(&socks, sizeof(struct sock_ent), offsetof(struct sock_ent, se_gen));
+	update_procs();
+	account();
+
+	if (NULL == (intf = lookup_intf(node, c_name, 0, 0)))
+		return;
+
+	intf->i_rx_bytes.r_total = total_rx;
+	intf->i_tx_bytes.r_total = total_tx;
+	notify_update(intf);
+	increase_lifetime(intf, 1);
+
+	/* processes are added below, the array may move */
+	parent = intf->i_index;
+
+	/* partial insertion sort, c_top is small */
+	for (n = 0; n < procs.t_size; n++) {
+		struct proc_ent *pe = PROC(n);
+
+		if (pe->pe_pid == SE_FREE || pe->pe_pid == SE_DELETED ||
+		    !pe->pe_delta)
+			continue;
+
+		if (ntop == c_top && pe->pe_delta <= top[ntop - 1]->pe_delta)
+			continue;
+
+		if (ntop < c_top)
+			ntop++;
+
+		for (k = ntop - 1; k > 0 && top[k - 1]->pe_delta < pe->pe_delta; k--)
+			top[k] = top[k - 1];
+		top[k] = pe;
+	}
+
+	for (i = 0; i < ntop; i++) {
+		char name[IFNAME_MAX];
+
+		snprintf(name, sizeof(name), "%s[%u]",
+			top[i]->pe_comm[0] ? top[i]->pe_comm : "?",
+			top[i]->pe_pid);
+		update_child(node, parent, name, top[i]->pe_pid,
+			top[i]->pe_rx, top[i]->pe_tx);
+	}
+
+	if (unknown_rx || unknown_tx)
+		update_child(node, parent, "unattributed", UNATTRIBUTED,
+			unknown_rx, unknown_tx);
+}
+
+static void
+print_help(void)
+{
+	printf(
+		"sockdiag - Per process TCP bandwidth (Linux)\n" \
+		"\n" \
+		"  Dumps all TCP sockets via NETLINK_SOCK_DIAG and accounts the\n" \
+		"  bytes acknowledged and received since the last read to the\n" \
+		"  process owning the socket. The processes moving the most bytes\n" \
+		"  are shown as children of a pseudo interface. Sockets are mapped\n" \
+		"  to processes via /proc/<pid>/fd, new processes are scanned once,\n" \
+		"  known ones only when sockets cannot be attributed.\n" \
+		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
+		"\n" \
+		"  Options:\n" \
+		"    name=NAME      Name of pseudo interface (default: processes)\n" \
+		"    top=NUM        Number of processes to show (default: 10)\n" \
+		"    scan=NUM       Max. processes to rescan per read (default: 256)\n");
+}
+
+static void
+sockdiag_set_opts(tv_t *attrs)
+{
+	while (attrs) {
+		if (!strcasecmp(attrs->type, "name") && attrs->value)
+			c_name = attrs->value;
+		else if (!strcasecmp(attrs->type, "top") && attrs->value)
+			c_top = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "scan") && attrs->value)
+			c_scan = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "help")) {
+			print_help();
+			exit(0);
+		}
+		attrs = attrs->next;
+	}
+}
+
+static int
+sockdiag_probe(void)
+{
+	if ((nl_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+	    NETLINK_SOCK_DIAG)) < 0)
+		return 0;
+
+	return 1;
+}
+
+static void
+sockdiag_init(void)
+{
+	if (c_top < 1)
+		c_top = 1;
+
+	nl_buf = xcalloc(1, SD_BUFSIZE);
+
+	socks.t_size = 1024;
+	socks.t_ents = xcalloc(socks.t_size, sizeof(struct sock_ent));
+	procs.t_size = 1024;
+	procs.t_ents = xcalloc(procs.t_size, sizeof(struct proc_ent));
+}
+
+static void
+sockdiag_shutdown(void)
+{
+	if (nl_fd >= 0)
+		close(nl_fd);
+	xfree(nl_buf);
+	xfree(socks.t_ents);
+	xfree(procs.t_ents);
+}
+
+static struct input_module sockdiag_ops = {
+	.im_name = "sockdiag",
+	.im_read = sockdiag_read,
+	.im_set_opts = sockdiag_set_opts,
+	.im_probe = sockdiag_probe,
+	.im_init = sockdiag_init,
+	.im_shutdown = sockdiag_shutdown,
+};
+
+static void __init
+sockdiag_register(void)
+{
+	register_secondary_input_module(&sockdiag_ops);
+}
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * in_softnet.c          /proc/net/softnet_stat input (Linux)
+ *
+ * Copyright (c) 2001-2004 Thomas Graf <tgraf@suug.ch>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <bmon/bmon.h>
+#include <bmon/input.h>
+#include <bmon/node.h>
+#include <bmon/intf.h>
+#include <bmon/utils.h>
+
+#if defined SYS_LINUX
+
+static stat_file_t softnet_file = STAT_FILE_INIT("/proc/net/softnet_stat");
+static char *c_name = "softnet";
+
+/*
+ * Columns of /proc/net/softnet_stat, one line per online CPU. Newer
+ * kernels append the backlog length and the CPU number.
+ */
+enum {
+	SN_PROCESSED,
+	SN_DROPPED,
+	SN_SQUEEZED,
+	SN_CPU_COLLISION = 8,
+	SN_RECEIVED_RPS,
+	SN_FLOW_LIMIT,
+	SN_BACKLOG,
+	SN_CPU,
+	__SN_MAX,
+};
+
+static void
+update_softnet_attrs(intf_t *intf, b_cnt_t *v)
+{
+	intf->i_rx_packets.r_total = v[SN_PROCESSED];
+
+	update_attr(intf, DROP, v[SN_DROPPED], 0, RX_PROVIDED | RATE_PROVIDED);
+	update_attr(intf, TIME_SQUEEZE, v[SN_SQUEEZED], 0,
+		RX_PROVIDED | RATE_PROVIDED);
+	/* contention on the transmit queue lock, the only TX counter */
+	update_attr(intf, CPU_COLLISION, 0, v[SN_CPU_COLLISION], TX_PROVIDED);
+	update_attr(intf, RECEIVED_RPS, v[SN_RECEIVED_RPS], 0, RX_PROVIDED);
+	update_attr(intf, FLOW_LIMIT, v[SN_FLOW_LIMIT], 0, RX_PROVIDED);
+
+	notify_update(intf);
+	increase_lifetime(intf, 1);
+}
+
+static void
+softnet_read(void)
+{
+	node_t *node = get_local_node();
+	b_cnt_t sum[__SN_MAX];
+	char *p, *end;
+	intf_t *intf;
+	int parent, line;
+
+	if (NULL == (p = stat_file_read(&softnet_file)))
+		quit("Unable to read %s: %s\n", softnet_file.sf_path,
+			strerror(errno));
+
+	if (NULL == (intf = lookup_intf(node, c_name, 0, 0)))
+		return;
+
+	/* CPUs are added while parsing, the array may move */
+	parent = intf->i_index;
+	memset(sum, 0, sizeof(sum));
+
+	for (line = 0; *p; line++) {
+		b_cnt_t v[__SN_MAX];
+		char name[IFNAME_MAX];
+		int n, cpu;
+
+		memset(v, 0, sizeof(v));
+
+		for (n = 0; n < __SN_MAX; n++) {
+			while (' ' == *p)
+				p++;
+			/* strtoull would happily skip the newline */
+			if (!isxdigit((unsigned char) *p))
+				break;
+			v[n] = strtoull(p, &end, 16);
+			p = end;
+		}
+
+		p += strcspn(p, "\n");
+		if ('\n' == *p)
+			p++;
+
+		if (0 == n)
+			continue;
+
+		cpu = n > SN_CPU ? (int) v[SN_CPU] : line;
+
+		for (n = 0; n < SN_BACKLOG; n++)
+			sum[n] += v[n];
+
+		snprintf(name, sizeof(name), "cpu%d", cpu);
+
+		if (NULL == (intf = lookup_intf(node, name, cpu + 1, parent)))
+			continue;
+
+		intf->i_link = parent;
+		intf->i_is_child = 1;
+		intf->i_level = 1;
+
+		update_softnet_attrs(intf, v);
+	}
+
+	update_softnet_attrs(get_intf(node, parent), sum);
+}
+
+static void
+print_help(void)
+{
+	printf(
+		"softnet - Per CPU softnet statistics (Linux)\n" \
+		"\n" \
+		"  Reads /proc/net/softnet_stat and provides every CPU as child of\n" \
+		"  a pseudo interface. Processed packets are accounted as received\n" \
+		"  packets, backlog drops and time squeezes (the NET_RX softirq\n" \
+		"  ran out of budget or time) are attributes with rate and history.\n" \
+		"  The file is kept open and read without allocating memory.\n" \
+		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
+		"\n" \
+		"  Options:\n" \
+		"    path=FILE      Path to softnet statistics (default: /proc/net/softnet_stat)\n" \
+		"    name=NAME      Name of pseudo interface (default: softnet)\n");
+}
+
+static void
+softnet_set_opts(tv_t *attrs)
+{
+	while (attrs) {
+		if (!strcasecmp(attrs->type, "path") && attrs->value)
+			softnet_file.sf_path = attrs->value;
+		else if (!strcasecmp(attrs->type, "name") && attrs->value)
+			c_name = attrs->value;
+		else if (!strcasecmp(attrs->type, "help")) {
+			print_help();
+			exit(0);
+		}
+		attrs = attrs->next;
+	}
+}
+
+static int
+softnet_probe(void)
+{
+	return stat_file_read(&softnet_file) != NULL;
+}
+
+static void
+softnet_shutdown(void)
+{
+	stat_file_close(&softnet_file);
+}
+
+static struct input_module softnet_ops = {
+	.im_name = "softnet",
+	.im_read = softnet_read,
+	.im_set_opts = softnet_set_opts,
+	.im_probe = softnet_probe,
+	.im_shutdown = softnet_shutdown,
+};
+
+static void __init
+softnet_init(void)
+{
+	register_secondary_input_module(&softnet_ops);
+}
+
+#endif
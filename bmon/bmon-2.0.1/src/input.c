@@ -142,6 +142,29 @@ input_read(void)
 	remove_unused_node_intfs();
 }
 
+/*
+ * The reader timing follows the clock of the primary input, which is
+ * the wall clock unless recorded data is replayed.
+ */
+void
+input_clock(timestamp_t *ts)
+{
+	find_preferred();
+
+	if (preferred->im_clock)
+		preferred->im_clock(ts);
+	else
+		update_ts(ts);
+}
+
+unsigned long
+input_sleep(unsigned long usec)
+{
+	find_preferred();
+
+	return preferred->im_sleep ? preferred->im_sleep(usec) : usec;
+}
+
 static void
 list_input(void)
 {
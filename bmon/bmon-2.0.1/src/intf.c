@@ -24,6 +24,8 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE /* FNM_CASEFOLD */
+
 #include <bmon/bmon.h>
 #include <bmon/node.h>
 #include <bmon/conf.h>
@@ -31,6 +33,13 @@
 #include <bmon/input.h>
 #include <bmon/utils.h>
 
+#include <fnmatch.h>
+#include <regex.h>
+
+#ifndef FNM_CASEFOLD
+#define FNM_CASEFOLD 0
+#endif
+
 #define DEFAULT_LIFETIME        10
 #define MAX_POLICY             255
 #define SECOND                 1.0f
@@ -64,17 +73,22 @@ update_attr(intf_t *i, int type, b_cnt_t rx, b_cnt_t tx, int flags)
 	i->i_nattrs++;
 
 found:
+	if ((flags & RATE_PROVIDED) && NULL == a->a_hist)
+		a->a_hist = xcalloc(1, sizeof(history_t));
+
 	if (flags & RX_PROVIDED) {
 		if (a->a_rx != rx)
-			update_ts(&a->a_updated); /* XXX: use read ts */
+			COPY_TS(&a->a_updated, &rtiming.rt_last_read);
 		a->a_rx = rx;
+		a->a_rx_rate.r_total = rx;
 		a->a_rx_enabled = 1;
 	}
 
 	if (flags & TX_PROVIDED) {
 		if (a->a_tx != tx)
-			update_ts(&a->a_updated);
+			COPY_TS(&a->a_updated, &rtiming.rt_last_read);
 		a->a_tx = tx;
+		a->a_tx_rate.r_total = tx;
 		a->a_tx_enabled = 1;
 	}
 }
@@ -144,6 +158,48 @@ type2name(int type)
 			return "Backlog";
 		case REQUEUES:
 			return "Requeues";
+		case TIME_SQUEEZE:
+			return "Squeezed";
+		case CPU_COLLISION:
+			return "CPU Coll";
+		case RECEIVED_RPS:
+			return "RPS Recv";
+		case FLOW_LIMIT:
+			return "Flow Limit";
+		case RETRANS:
+			return "Retransmits";
+		case RESETS:
+			return "Resets";
+		case CONN_OPENS:
+			return "Conn Opens";
+		case ESTABLISHED:
+			return "Established";
+		case LISTEN_OVERFLOWS:
+			return "Listen Ovfl";
+		case LISTEN_DROPS:
+			return "Listen Drops";
+		case TIMEOUTS:
+			return "Timeouts";
+		case NO_PORTS:
+			return "No Port";
+		case BUF_ERRORS:
+			return "Buffer Err";
+		case CSUM_ERRORS:
+			return "Csum Err";
+		case FORWARDED:
+			return "Forwarded";
+		case NO_ROUTES:
+			return "No Route";
+		case FRAG_ERRORS:
+			return "Frag Err";
+		case UNREACHABLE:
+			return "Unreachable";
+		case STALE:
+			return "Stale";
+		case DUPLICATES:
+			return "Duplicates";
+		case LOOPS:
+			return "Loops";
 		default:
 		{
 			static char str[256];
@@ -153,60 +209,197 @@ type2name(int type)
 	}
 }
 
+/*
+ * The policy is compiled once after parsing. Plain names go into a
+ * hash table, "abc*" and "*abc" into prefix and suffix tables, any
+ * other wildcard pattern is matched as shell glob and a pattern
+ * starting with '~' is an extended regular expression. Matching is
+ * case insensitive. Decisions are remembered per name in a direct
+ * mapped cache so interface churn does not evaluate the policy over
+ * and over again.
+ */
+enum {
+	PAT_EXACT,
+	PAT_PREFIX,
+	PAT_SUFFIX,
+	PAT_GLOB,
+	PAT_REGEX,
+};
+
+typedef struct pattern_s
+{
+	int          p_type;
+	const char * p_str;
+	size_t       p_len;
+	regex_t      p_re;
+} pattern_t;
+
+#define EXACT_HASH_SIZE 512
+
+typedef struct policy_s
+{
+	int          p_n;
+	int          p_nexact;
+	const char * p_exact[EXACT_HASH_SIZE];
+	pattern_t *  p_prefix;
+	int          p_nprefix;
+	pattern_t *  p_suffix;
+	int          p_nsuffix;
+	pattern_t *  p_other;
+	int          p_nother;
+} policy_t;
+
+static policy_t allow_policy;
+static policy_t deny_policy;
+
+#define DECISION_CACHE_SIZE 1024
+
+static struct decision_s
+{
+	char         d_name[IFNAME_MAX];
+	int          d_allowed;
+} decision_cache[DECISION_CACHE_SIZE];
+
+static inline unsigned int
+name_hash(const char *name)
+{
+	unsigned int h = 2166136261U;
+
+	for (; *name; name++)
+		h = (h ^ (uint8_t) tolower(*name)) * 16777619U;
+
+	return h;
+}
+
+static void
+add_pattern(pattern_t **list, int *n, int type, const char *str)
+{
+	pattern_t *p;
+
+	*list = xrealloc(*list, (*n + 1) * sizeof(pattern_t));
+	p = &(*list)[(*n)++];
+	memset(p, 0, sizeof(*p));
+
+	p->p_type = type;
+	p->p_str = str;
+	p->p_len = strlen(str);
+
+	if (PAT_REGEX == type &&
+		regcomp(&p->p_re, str, REG_EXTENDED | REG_ICASE | REG_NOSUB))
+		quit("Invalid regular expression in policy: %s\n", str);
+}
+
+static void
+compile_policy(policy_t *p, char **patterns)
+{
+	int i;
+
+	for (i = 0; i < MAX_POLICY && patterns[i]; i++) {
+		char *s = patterns[i];
+		size_t len = strlen(s);
+		char *wc = strpbrk(s, "*?[");
+
+		p->p_n++;
+
+		if ('~' == s[0])
+			add_pattern(&p->p_other, &p->p_nother, PAT_REGEX, s + 1);
+		else if (NULL == wc) {
+			unsigned int h = name_hash(s) % EXACT_HASH_SIZE;
+
+			if (p->p_nexact >= EXACT_HASH_SIZE - 1)
+				BUG();
+
+			while (p->p_exact[h])
+				h = (h + 1) % EXACT_HASH_SIZE;
+			p->p_exact[h] = s;
+			p->p_nexact++;
+		} else if (wc == &s[len - 1] && '*' == *wc) {
+			s[len - 1] = '\0';
+			add_pattern(&p->p_prefix, &p->p_nprefix, PAT_PREFIX, s);
+		} else if (wc == s && '*' == *s && !strpbrk(s + 1, "*?["))
+			add_pattern(&p->p_suffix, &p->p_nsuffix, PAT_SUFFIX, s + 1);
+		else
+			add_pattern(&p->p_other, &p->p_nother, PAT_GLOB, s);
+	}
+}
+
 static int
-match_mask(const char *mask, const char *str)
+policy_match(policy_t *p, const char *name)
 {
-	int i, n;
-	char c;
+	size_t len = strlen(name);
+	unsigned int h;
+	int i;
 
-	if (!mask || !str)
-		return 0;
-	
-	for (i = 0, n = 0; mask[i] != '\0'; i++, n++) {
-		if (mask[i] == '*') {
-			c = tolower(mask[i+1]);
-			
-			if (c == '\0')
-				return 1; /* nothing after wildcard, matches in any case */
-			
-			/*look for c in str, c is the character after the wildcard */
-			for (; tolower(str[n]) != c; n++)
-				if (str[n] == '\0')
-					return 0; /* character after wildcard was not found */
-			
-			n--;
-		} else if (tolower(mask[i]) != tolower(str[n]))
-			return 0;
+	if (p->p_nexact) {
+		for (h = name_hash(name) % EXACT_HASH_SIZE; p->p_exact[h];
+			h = (h + 1) % EXACT_HASH_SIZE)
+			if (!strcasecmp(p->p_exact[h], name))
+				return 1;
 	}
 
-	return str[n] == '\0' ? 1 : 0;
+	for (i = 0; i < p->p_nprefix; i++)
+		if (!strncasecmp(p->p_prefix[i].p_str, name, p->p_prefix[i].p_len))
+			return 1;
+
+	for (i = 0; i < p->p_nsuffix; i++) {
+		pattern_t *s = &p->p_suffix[i];
+
+		if (len >= s->p_len && !strcasecmp(s->p_str, name + len - s->p_len))
+			return 1;
+	}
+
+	for (i = 0; i < p->p_nother; i++) {
+		pattern_t *o = &p->p_other[i];
+
+		if (PAT_REGEX == o->p_type) {
+			if (!regexec(&o->p_re, name, 0, NULL, 0))
+				return 1;
+		} else if (!fnmatch(o->p_str, name, FNM_CASEFOLD))
+			return 1;
+	}
+
+	return 0;
 }
 
 static int
 intf_allowed(const char *name)
 {
-	int n;
+	struct decision_s *d;
 	
-	if (!allowed_intf[0] && !denied_intf[0])
+	if (!allow_policy.p_n && !deny_policy.p_n)
 		return 1;
 
-	if (!allowed_intf[0]) {
-		for (n = 0; n < MAX_POLICY && denied_intf[n]; n++)
-			if (match_mask(denied_intf[n], name))
-				return 0;
-	
-		return 1;
+	d = &decision_cache[name_hash(name) % DECISION_CACHE_SIZE];
+
+	if (strcmp(d->d_name, name)) {
+		memset(d->d_name, 0, sizeof(d->d_name));
+		strncpy(d->d_name, name, sizeof(d->d_name) - 1);
+
+		if (policy_match(&deny_policy, name))
+			d->d_allowed = 0;
+		else if (!allow_policy.p_n)
+			d->d_allowed = 1;
+		else
+			d->d_allowed = policy_match(&allow_policy, name);
 	}
 
-	for (n = 0; n < MAX_POLICY && denied_intf[n]; n++)
-		if (match_mask(denied_intf[n], name))
-			return 0;
-	
-	for (n=0; n < MAX_POLICY && allowed_intf[n]; n++)
-		if (match_mask(allowed_intf[n], name))
-			return 1;
+	return d->d_allowed;
+}
 
-	return 0;
+/*
+ * Returns the number of entries in the allow list if all of them
+ * are plain interface names, i.e. the set of acceptable interfaces
+ * is known in advance and input modules may ask for exactly these
+ * instead of fetching everything. Returns 0 otherwise.
+ */
+int
+intf_policy_names(const char ***names)
+{
+	if (allow_policy.p_n != allow_policy.p_nexact)
+		return 0;
+
+	*names = (const char **) allowed_intf;
+	return allow_policy.p_n;
 }
 
 void
@@ -246,52 +439,146 @@ intf_parse_policy(const char *policy)
 	}
 	
 	xfree(s);
+
+	compile_policy(&allow_policy, allowed_intf);
+	compile_policy(&deny_policy, denied_intf);
+}
+
+
+/*
+ * Interfaces are hashed by (name, handle, parent) into n_intf_hash,
+ * which has as many buckets as n_intf has slots. Chains and the list
+ * of unused slots are linked via i_hash_next as slot index + 1 so
+ * they survive a reallocation of n_intf.
+ */
+static inline unsigned int
+intf_hash(const char *name, uint32_t handle, int parent)
+{
+	unsigned int h = 2166136261U;
+
+	for (; *name; name++)
+		h = (h ^ (uint8_t) *name) * 16777619U;
+
+	h = (h ^ handle) * 16777619U;
+	return (h ^ (unsigned int) parent) * 16777619U;
+}
+
+static inline int *
+intf_bucket(node_t *node, const char *name, uint32_t handle, int parent)
+{
+	return &node->n_intf_hash[intf_hash(name, handle, parent) & (node->n_nintf - 1)];
+}
+
+static void
+intf_hash_link(node_t *node, intf_t *i)
+{
+	int *b = intf_bucket(node, i->i_name, i->i_handle, i->i_parent);
+
+	i->i_hash_next = *b;
+	*b = i->i_index + 1;
+}
+
+static void
+intf_hash_unlink(node_t *node, intf_t *i)
+{
+	int *p = intf_bucket(node, i->i_name, i->i_handle, i->i_parent);
+
+	for (; *p; p = &node->n_intf[*p - 1].i_hash_next) {
+		if (*p - 1 == i->i_index) {
+			*p = i->i_hash_next;
+			return;
+		}
+	}
+}
+
+static void
+grow_intfs(node_t *node)
+{
+	int i, oldsize = node->n_nintf;
+
+	node->n_nintf = oldsize ? oldsize * 2 : 32;
+	node->n_intf = xrealloc(node->n_intf, node->n_nintf * sizeof(intf_t));
+	memset(node->n_intf + oldsize, 0, (node->n_nintf - oldsize) * sizeof(intf_t));
+
+	xfree(node->n_intf_hash);
+	node->n_intf_hash = xcalloc(node->n_nintf, sizeof(int));
+
+	for (i = 0; i < oldsize; i++)
+		if (node->n_intf[i].i_name[0])
+			intf_hash_link(node, &node->n_intf[i]);
+
+	for (i = node->n_nintf - 1; i >= oldsize; i--) {
+		node->n_intf[i].i_hash_next = node->n_intf_free;
+		node->n_intf_free = i + 1;
+	}
 }
 
+static intf_t *
+find_intf(node_t *node, const char *name, uint32_t handle, int parent)
+{
+	int n;
+
+	if (NULL == node->n_intf)
+		return NULL;
+
+	for (n = *intf_bucket(node, name, handle, parent); n;
+		n = node->n_intf[n - 1].i_hash_next) {
+		intf_t *i = &node->n_intf[n - 1];
+
+		if (i->i_handle == handle && i->i_parent == parent &&
+			!strcmp(name, i->i_name))
+			return i;
+	}
+
+	return NULL;
+}
 
 intf_t *
 lookup_intf(node_t *node, const char *name, uint32_t handle, int parent)
 {
-	int i;
+	intf_t *i;
 	
 	if (NULL == node)
 		BUG();
 	
-	if (NULL == node->n_intf) {
-		node->n_nintf = 32;
-		node->n_intf = xcalloc(node->n_nintf, sizeof(intf_t));
-	}
-	
-	for (i = 0; i < node->n_nintf; i++)
-		if (!strcmp(name, node->n_intf[i].i_name) &&
-			node->n_intf[i].i_handle == handle &&
-			node->n_intf[i].i_parent == parent)
-			return node->n_intf[i].i_updated == 0 ? &node->n_intf[i] : NULL;
+	if ((i = find_intf(node, name, handle, parent)))
+		return i->i_updated == 0 ? i : NULL;
 	
 	if (!handle && !intf_allowed(name))
 		return NULL;
 	
-	for (i = 0; i < node->n_nintf; i++)
-		if (node->n_intf[i].i_name[0] == '\0')
-			break;
+	if (0 == node->n_intf_free)
+		grow_intfs(node);
 	
-	if (i >= node->n_nintf) {
-		int oldsize = node->n_nintf;
-		node->n_nintf += 32;
-		node->n_intf = xrealloc(node->n_intf, node->n_nintf * sizeof(intf_t));
-		memset(node->n_intf + oldsize, 0, (node->n_nintf - oldsize) * sizeof(intf_t));
-	}
+	i = &node->n_intf[node->n_intf_free - 1];
+	node->n_intf_free = i->i_hash_next;
+	memset(i, 0, sizeof(*i));
 	
-	memset(&node->n_intf[i], 0, sizeof(node->n_intf[i]));
-	
-	strncpy(node->n_intf[i].i_name, name, sizeof(node->n_intf[i].i_name) - 1);
-	node->n_intf[i].i_handle = handle;
-	node->n_intf[i].i_parent = parent;
-	node->n_intf[i].i_index = i;
-	node->n_intf[i].i_node = node;
-	node->n_intf[i].i_lifetime = DEFAULT_LIFETIME;
+	strncpy(i->i_name, name, sizeof(i->i_name) - 1);
+	i->i_handle = handle;
+	i->i_parent = parent;
+	i->i_index = i - node->n_intf;
+	i->i_node = node;
+	i->i_lifetime = DEFAULT_LIFETIME;
+	intf_hash_link(node, i);
+
+	return i;
+}
 
-	return &node->n_intf[i];
+/*
+ * Like lookup_intf() but also returns interfaces already updated during
+ * this read, for inputs receiving several timestamped samples of the
+ * same interface within one read interval.
+ */
+intf_t *
+lookup_intf_sample(node_t *node, const char *name, uint32_t handle, int parent)
+{
+	intf_t *i;
+
+	if (node && (i = find_intf(node, name, handle, parent)))
+		return i;
+
+	return lookup_intf(node, name, handle, parent);
 }
 
 void
@@ -312,20 +599,65 @@ reset_intf(intf_t *i)
 	i->i_updated = 0;
 }
 
+static void
+free_intf(intf_t *i)
+{
+	node_t *node = i->i_node;
+	int m;
+
+	for (m = 0; m < ATTR_HASH_MAX; m++) {
+		intf_attr_t *a, *next;
+		for (a = i->i_attrs[m]; a; a = next) {
+			next = a->a_next;
+			xfree(a->a_hist);
+			free(a);
+		}
+	}
+
+	intf_hash_unlink(node, i);
+	memset(i, 0, sizeof(intf_t));
+
+	i->i_hash_next = node->n_intf_free;
+	node->n_intf_free = (i - node->n_intf) + 1;
+}
+
 void
 remove_unused_intf(intf_t *i)
 {
-	if (--(i->i_lifetime) <= 0) {
-		int m;
-		for (m = 0; m < ATTR_HASH_MAX; m++) {
-			intf_attr_t *a, *next;
-			for (a = i->i_attrs[m]; a; a = next) {
-				next = a->a_next;
-				free(a);
-			}
-		}
-		memset(i, 0, sizeof(intf_t));
+	if (--(i->i_lifetime) <= 0)
+		free_intf(i);
+}
+
+void
+remove_intf(intf_t *i)
+{
+	node_t *node = i->i_node;
+	int m, index = i->i_index;
+
+	if (NULL == node || i->i_is_child)
+		BUG();
+
+	/*
+	 * Children (tc trees etc.) refer to their link by index, they
+	 * cannot outlive it.
+	 */
+	for (m = 0; m < node->n_nintf; m++) {
+		intf_t *c = &node->n_intf[m];
+
+		if (c->i_name[0] && c->i_is_child && c->i_link == index)
+			free_intf(c);
 	}
+
+	free_intf(i);
+}
+
+void
+rename_intf(intf_t *i, const char *name)
+{
+	intf_hash_unlink(i->i_node, i);
+	memset(i->i_name, 0, sizeof(i->i_name));
+	strncpy(i->i_name, name, sizeof(i->i_name) - 1);
+	intf_hash_link(i->i_node, i);
 }
 
 static void
@@ -436,20 +768,52 @@ update_history(history_t *hist, rate_t *rx, rate_t *tx, timestamp_t *ts)
 	update_history_element(&hist->h_day, rx, tx, ts, DAY);
 }
 
+static void
+update_attr_rates(intf_t *i, timestamp_t *ts)
+{
+	int m;
+
+	for (m = 0; m < ATTR_HASH_MAX; m++) {
+		intf_attr_t *a;
+
+		for (a = i->i_attrs[m]; a; a = a->a_next) {
+			if (NULL == a->a_hist)
+				continue;
+
+			calc_rate(&a->a_rx_rate, ts);
+			calc_rate(&a->a_tx_rate, ts);
+			update_history(a->a_hist, &a->a_rx_rate, &a->a_tx_rate, ts);
+		}
+	}
+}
+
+/*
+ * Inputs which know when the counters were sampled, e.g. from the
+ * arrival time of a reply, provide that time so rates are not skewed
+ * by the delay until the next read.
+ */
 void
-notify_update(intf_t *i)
+notify_update_ts(intf_t *i, timestamp_t *ts)
 {
 	i->i_updated = 1;
 
-	calc_rate(&i->i_rx_bytes,   &rtiming.rt_last_read);
-	calc_rate(&i->i_tx_bytes,   &rtiming.rt_last_read);
-	calc_rate(&i->i_rx_packets, &rtiming.rt_last_read);
-	calc_rate(&i->i_tx_packets, &rtiming.rt_last_read);
+	calc_rate(&i->i_rx_bytes,   ts);
+	calc_rate(&i->i_tx_bytes,   ts);
+	calc_rate(&i->i_rx_packets, ts);
+	calc_rate(&i->i_tx_packets, ts);
 
-	update_history(&i->i_bytes_hist, &i->i_rx_bytes, &i->i_tx_bytes,
-		&rtiming.rt_last_read);
+	update_history(&i->i_bytes_hist, &i->i_rx_bytes, &i->i_tx_bytes, ts);
 	update_history(&i->i_packets_hist, &i->i_rx_packets, &i->i_tx_packets,
-		&rtiming.rt_last_read);
+		ts);
+
+	if (i->i_nattrs)
+		update_attr_rates(i, ts);
+}
+
+void
+notify_update(intf_t *i)
+{
+	notify_update_ts(i, &rtiming.rt_last_read);
 }
 
 void
@@ -458,13 +822,19 @@ increase_lifetime(intf_t *i, int l)
 	i->i_lifetime += l;
 }
 
+intf_t *
+get_intf_by_name(node_t *node, const char *name)
+{
+	intf_t *i = find_intf(node, name, 0, 0);
+
+	return i && !i->i_is_child ? i : NULL;
+}
+
 intf_t *
 get_intf(node_t *node, int index)
 {
-	int i;
+	if (index < 0 || index >= node->n_nintf)
+		return NULL;
 
-	for (i = 0; i < node->n_nintf; i++)
-		if (node->n_intf[i].i_index == index)
-			return &node->n_intf[i];
-	return NULL;
+	return &node->n_intf[index];
 }
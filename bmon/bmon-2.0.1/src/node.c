@@ -28,44 +28,125 @@
 #include <bmon/node.h>
 #include <bmon/utils.h>
 
+#include <fcntl.h>
+
 static node_t *nodes;
 static size_t nodes_size;
 static size_t nnodes;
+static int *node_hash;
+static int nodes_free;
 static const char * node_name;
+static uint32_t local_origin;
 static node_t *local_node;
 static node_t *current_node;
+static uint32_t node_serial;
+
+/* reads a node is kept after its last interface has gone */
+#define NODE_LIFETIME 10
+
+
+/*
+ * Nodes are hashed by name into node_hash, which has as many buckets
+ * as nodes has slots. Chains and the list of unused slots are linked
+ * via n_hash_next as slot index + 1, like the interfaces of a node.
+ */
+static inline int *
+node_bucket(const char *name)
+{
+	unsigned int h = 2166136261U;
+
+	for (; *name; name++)
+		h = (h ^ (uint8_t) *name) * 16777619U;
+
+	return &node_hash[h & (nodes_size - 1)];
+}
 
+static void
+node_hash_link(node_t *node)
+{
+	int *b = node_bucket(node->n_name);
+
+	node->n_hash_next = *b;
+	*b = node->n_index + 1;
+}
+
+static void
+node_hash_unlink(node_t *node)
+{
+	int *p = node_bucket(node->n_name);
+
+	for (; *p; p = &nodes[*p - 1].n_hash_next) {
+		if (*p - 1 == node->n_index) {
+			*p = node->n_hash_next;
+			return;
+		}
+	}
+}
+
+/*
+ * Interfaces and the node cursors point into the node array, they
+ * must follow it when it moves.
+ */
+static void
+grow_nodes(void)
+{
+	int i, m, oldsize = nodes_size;
+	int local = local_node ? local_node->n_index : -1;
+	int current = current_node ? current_node->n_index : -1;
+
+	nodes_size = oldsize ? oldsize * 2 : 32;
+	nodes = xrealloc(nodes, nodes_size * sizeof(node_t));
+	memset(nodes + oldsize, 0, (nodes_size - oldsize) * sizeof(node_t));
+
+	if (local >= 0)
+		local_node = &nodes[local];
+
+	if (current >= 0)
+		current_node = &nodes[current];
+
+	for (i = 0; i < oldsize; i++)
+		for (m = 0; m < nodes[i].n_nintf; m++)
+			nodes[i].n_intf[m].i_node = &nodes[i];
+
+	xfree(node_hash);
+	node_hash = xcalloc(nodes_size, sizeof(int));
+
+	for (i = 0; i < oldsize; i++)
+		if (nodes[i].n_name)
+			node_hash_link(&nodes[i]);
+
+	for (i = nodes_size - 1; i >= oldsize; i--) {
+		nodes[i].n_hash_next = nodes_free;
+		nodes_free = i + 1;
+	}
+}
 
 node_t *
 lookup_node(const char *name, int creat)
 {
-	int i;
+	node_t *node;
+	int n;
 
-	if (NULL == nodes) {
-		nodes_size = 32;
-		nodes = xcalloc(nodes_size, sizeof(node_t));
-	}
+	if (NULL == nodes)
+		grow_nodes();
 
-	for (i = 0; i < nodes_size; i++)
-		if (nodes[i].n_name && !strcmp(name, nodes[i].n_name))
-			return &nodes[i];
+	for (n = *node_bucket(name); n; n = nodes[n - 1].n_hash_next)
+		if (!strcmp(name, nodes[n - 1].n_name))
+			return &nodes[n - 1];
 
 	if (creat) {
-		for (i = 0; i < nodes_size; i++)
-			if (NULL == nodes[i].n_name)
-				break;
+		if (0 == nodes_free)
+			grow_nodes();
 
-		while (i >= nodes_size) {
-			int oldsize = nodes_size;
-			nodes_size += 32;
-			nodes = xrealloc(nodes, nodes_size * sizeof(node_t));
-			memset((uint8_t *) nodes + oldsize, 0, (nodes_size - oldsize) * sizeof(node_t));
-		}
+		node = &nodes[nodes_free - 1];
+		nodes_free = node->n_hash_next;
 
-		nodes[i].n_name = strdup(name);
-		nodes[i].n_index = i;
+		node->n_name = strdup(name);
+		node->n_index = node - nodes;
+		node->n_serial = ++node_serial;
+		node_hash_link(node);
 		nnodes++;
-		return &nodes[i];
+		return node;
 	}
 
 	return NULL;
@@ -76,8 +157,9 @@ foreach_node(void (*cb)(node_t *, void *), void *arg)
 {
 	int i;
 
-	for (i = 0; i < nnodes; i++)
-		cb(&nodes[i], arg);
+	for (i = 0; i < nodes_size; i++)
+		if (nodes[i].n_name)
+			cb(&nodes[i], arg);
 }
 
 void
@@ -96,7 +178,7 @@ foreach_node_intf(void (*cb)(node_t *, intf_t *, void *), void *arg)
 {
 	int i, m;
 
-	for (i = 0; i < nnodes; i++) {
+	for (i = 0; i < nodes_size; i++) {
 		node_t *n = &nodes[i];
 		
 		for (m = 0; m < n->n_nintf; m++)
@@ -122,21 +204,80 @@ static void __remove_unused_intf(node_t *n, intf_t *i, void *arg)
 	remove_unused_intf(i);
 }
 
+/*
+ * Slots of removed nodes are reused, modules keeping state per node
+ * index recognize a new node by its serial.
+ */
+static void
+free_node(node_t *node)
+{
+	int index = node->n_index;
+
+	if (node == current_node)
+		current_node = NULL;
+
+	node_hash_unlink(node);
+
+	xfree(node->n_name);
+	xfree(node->n_from);
+	xfree(node->n_intf);
+	xfree(node->n_intf_hash);
+	memset(node, 0, sizeof(*node));
+	nnodes--;
+
+	node->n_hash_next = nodes_free;
+	nodes_free = index + 1;
+}
+
+/*
+ * Input modules keep the interfaces of a node alive for as long as
+ * it is heard of, a node left without any has gone silent.
+ */
 void
 remove_unused_node_intfs(void)
 {
+	int i, m;
+
 	foreach_node_intf(__remove_unused_intf, NULL);
+
+	for (i = 0; i < nodes_size; i++) {
+		node_t *n = &nodes[i];
+
+		if (NULL == n->n_name || n == local_node)
+			continue;
+
+		for (m = 0; m < n->n_nintf; m++)
+			if (n->n_intf[m].i_name[0])
+				break;
+
+		if (m < n->n_nintf)
+			n->n_idle = 0;
+		else if (++n->n_idle > NODE_LIFETIME)
+			free_node(n);
+	}
 }
 
 node_t *
 get_local_node(void)
 {
-	if (NULL == local_node)
+	if (NULL == local_node) {
 		local_node = lookup_node(node_name, 1);
+		local_node->n_origin = local_origin;
+	}
 
 	return local_node;
 }
 
+/*
+ * Identifies this instance of bmon in distributed statistics, two
+ * instances on the same host must differ.
+ */
+uint32_t
+get_local_origin(void)
+{
+	return local_origin;
+}
+
 int
 get_nnodes(void)
 {
@@ -154,10 +295,34 @@ get_node_info(void)
 	node_name = strdup(uts.nodename);
 }
 
+static void
+get_origin(void)
+{
+	struct timeval tv;
+	uint32_t h = 2166136261U;
+	int fd;
+
+	if ((fd = open("/dev/urandom", O_RDONLY)) >= 0) {
+		if (read(fd, &local_origin, sizeof(local_origin)) < 0)
+			local_origin = 0;
+		close(fd);
+	}
+
+	gettimeofday(&tv, NULL);
+	h = (h ^ (uint32_t) tv.tv_sec) * 16777619U;
+	h = (h ^ (uint32_t) tv.tv_usec) * 16777619U;
+	h = (h ^ (uint32_t) getpid()) * 16777619U;
+
+	local_origin ^= h;
+	if (0 == local_origin)
+		local_origin = 1;
+}
+
 static void __init
 node_init(void)
 {
 	get_node_info();
+	get_origin();
 }
 
 node_t *
@@ -174,7 +339,7 @@ first_node(void)
 	if (nnodes <= 0)
 		return EMPTY_LIST;
 	
-	for (i = 0; i < nnodes; i++) {
+	for (i = 0; i < nodes_size; i++) {
 		if (nodes[i].n_name) {
 			current_node = &nodes[i];
 			return 0;
@@ -192,7 +357,7 @@ last_node(void)
 	if (nnodes <= 0)
 		return EMPTY_LIST;
 	
-	for (i = (nnodes - 1); i >= 0; i--) {
+	for (i = (nodes_size - 1); i >= 0; i--) {
 		if (nodes[i].n_name) {
 			current_node = &nodes[i];
 			return 0;
@@ -235,7 +400,7 @@ next_node(void)
 		return first_node();
 	else {
 		int i;
-		for (i = (current_node->n_index + 1); i < nnodes; i++) {
+		for (i = (current_node->n_index + 1); i < nodes_size; i++) {
 			if (nodes[i].n_name) {
 				current_node = &nodes[i];
 				return 0;
@@ -123,8 +123,14 @@ print_list(intf_t *i, node_t *node)
 static void
 print_attr_detail(intf_attr_t *a, void *arg)
 {
-	printf("  %-14s %12llu     %12llu\n",
-		type2name(a->a_type), a->a_rx, a->a_tx);
+	if (a->a_hist)
+		printf("  %-14s %12llu     %12llu     %10u/s %10u/s\n",
+			type2name(a->a_type), (unsigned long long) a->a_rx,
+			(unsigned long long) a->a_tx,
+			a->a_rx_rate.r_tps, a->a_tx_rate.r_tps);
+	else
+		printf("  %-14s %12llu     %12llu\n",
+			type2name(a->a_type), a->a_rx, a->a_tx);
 }
 
 static void
@@ -150,13 +156,11 @@ print_details(intf_t *i)
 }
 
 static void
-print_graph(intf_t *i)
+print_hist_graph(history_t *h)
 {
 	int w;
 
-	graph_t *g = create_configued_graph(&i->i_bytes_hist, c_graph_height);
-
-	printf("%s\n", i->i_name);
+	graph_t *g = create_configued_graph(h, c_graph_height);
 
 	printf("RX   %s\n", g->g_rx.t_y_unit);
 	
@@ -177,6 +181,23 @@ print_graph(intf_t *i)
 	free_graph(g);
 }
 
+static void
+print_attr_graph(intf_attr_t *a, void *arg)
+{
+	if (a->a_hist) {
+		printf("%s %s\n", (char *) arg, type2name(a->a_type));
+		print_hist_graph(a->a_hist);
+	}
+}
+
+static void
+print_graph(intf_t *i)
+{
+	printf("%s\n", i->i_name);
+	print_hist_graph(&i->i_bytes_hist);
+	foreach_attr(i, print_attr_graph, i->i_name);
+}
+
 static void
 ascii_draw_intf(intf_t *i, void *arg)
 {
@@ -33,6 +33,15 @@
 #include <bmon/utils.h>
 
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 static int send_fd;
 static int c_ipv6;
@@ -42,68 +51,110 @@ static int c_forward = 0;
 static int c_errignore = 0;
 static int c_debug = 0;
 static int c_send_all = 15;
+static int c_mtu = 0;
+static int c_version = BMON_VERSION;
+static char *c_relay = NULL;
+static int c_top = 5;
+static int c_lease = 10;
+static int c_tcp = 0;
+static char *c_unix = NULL;
+static int c_queue = 1048576;
 static int send_all_rem = 1;
+static int send_family;
+static int mtu;
+static uint32_t frag_seq;
+static size_t frag_off;
+
+/*
+ * Messages are serialized in a single pass into one send buffer which
+ * is kept across reads. It only grows if a node does not fit, once
+ * the largest node has been seen no memory is allocated anymore.
+ */
+static uint8_t *send_buf;
+static size_t send_buf_size;
+
+/*
+ * Stream transport: messages are queued as length prefixed frames
+ * and written once per interval without blocking. Whatever the
+ * collector has not taken yet stays queued, send_fd is -1 while
+ * no connection exists.
+ */
+static int stream;
+static int stream_up;
+static struct sockaddr_storage stream_addr;
+static socklen_t stream_addrlen;
+static uint8_t *queue_buf;
+static size_t queue_len, queue_size;
+
+/* messages on a stream are only limited by the 16 bit length */
+#define STREAM_MTU 65000
 
 static void *
-build_opts(intf_t *intf, size_t *size)
+msg_reserve(size_t off, size_t len)
 {
-	void *buf;
-	size_t optsize = 0, off = 0;
-	struct distr_msg_ifopt *ip;
-
-	if (intf->i_handle)
-		optsize += sizeof(*ip) + 4;
+	if (off + len > send_buf_size) {
+		while (off + len > send_buf_size)
+			send_buf_size = send_buf_size ? send_buf_size * 2 : 8192;
+		send_buf = xrealloc(send_buf, send_buf_size);
+	}
 
-	if (intf->i_parent)
-		optsize += sizeof(*ip);
+	/* padding and reserved fields must be zero */
+	memset(send_buf + off, 0, len);
 
-	if (intf->i_link)
-		optsize += sizeof(*ip);
+	return send_buf + off;
+}
 
-	if (intf->i_level)
-		optsize += sizeof(*ip);
+static size_t
+put_opt(size_t off, int type, uint16_t value)
+{
+	struct distr_msg_ifopt *ip = msg_reserve(off, sizeof(*ip));
 
-	if (0 == optsize) {
-		*size = 0;
-		return NULL;
-	}
+	ip->io_type = type;
+	ip->io_pad = htons(value);
 
-	buf = xcalloc(1, optsize);
+	return off + sizeof(*ip);
+}
 
+static size_t
+put_opts(intf_t *intf, size_t off)
+{
 	if (intf->i_handle) {
-		ip = buf + off;
+		struct distr_msg_ifopt *ip;
+		uint32_t handle = htonl(intf->i_handle);
+
+		ip = msg_reserve(off, sizeof(*ip) + sizeof(handle));
 		ip->io_type = IFOPT_HANDLE;
-		ip->io_len = 4;
-		*((uint32_t *) (buf + off + sizeof(*ip)))  = htonl(intf->i_handle);
-		off += sizeof(*ip) + 4;
+		ip->io_len = sizeof(handle);
+		memcpy(ip + 1, &handle, sizeof(handle));
+		off += sizeof(*ip) + sizeof(handle);
 	}
 
-	if (intf->i_parent) {
-		ip = buf + off;
-		ip->io_type = IFOPT_PARENT;
-		ip->io_len = 0;
-		ip->io_pad = htons(intf->i_parent);
-		off += sizeof(*ip);
-	}
+	if (intf->i_parent)
+		off = put_opt(off, IFOPT_PARENT, intf->i_parent);
 
-	if (intf->i_link) {
-		ip = buf + off;
-		ip->io_type = IFOPT_LINK;
-		ip->io_len = 0;
-		ip->io_pad = htons(intf->i_link);
-		off += sizeof(*ip);
-	}
+	if (intf->i_link)
+		off = put_opt(off, IFOPT_LINK, intf->i_link);
 
-	if (intf->i_level) {
-		ip = buf + off;
-		ip->io_type = IFOPT_LEVEL;
-		ip->io_len = 0;
-		ip->io_pad = htons(intf->i_level);
-		off += sizeof(*ip);
-	}
+	if (intf->i_level)
+		off = put_opt(off, IFOPT_LEVEL, intf->i_level);
+
+	return off;
+}
+
+static size_t
+put_attr(size_t off, int type, int flags, uint64_t rx, uint64_t tx,
+	 int rx_overflows, int tx_overflows)
+{
+	struct distr_msg_attr *ap = msg_reserve(off, sizeof(*ap));
 
-	*size = optsize;
-	return buf;
+	ap->a_type = type;
+	ap->a_flags = flags;
+	ap->a_rx = rx;
+	ap->a_tx = tx;
+	ap->a_rx_overflows = rx_overflows;
+	ap->a_tx_overflows = tx_overflows;
+
+	return off + sizeof(*ap);
 }
 
 static inline int
@@ -128,182 +179,909 @@ worth_sending(intf_attr_t *a)
 }
 
 
-static void *
-build_intf_msg(intf_t *intf, size_t *size)
+static size_t
+put_intf(intf_t *intf, size_t off)
 {
-	int i, off = 0;
-	void *buf, *opts;
-	size_t msgsize = 0, namelen, nattrs = 0, optsize;
+	size_t start = off, namelen, optslen;
 	struct distr_msg_intf *ip;
-	struct distr_msg_attr *ap;
+	int i;
 
 	namelen = (strlen(intf->i_name) + 5) & ~3; /* 5 because of \0 */
-	opts = build_opts(intf, &optsize);
+
+	ip = msg_reserve(off, sizeof(*ip) + namelen);
+	ip->i_index = htons(intf->i_index);
+	ip->i_namelen = namelen;
+	ip->i_flags |= intf->i_is_child ? IF_IS_CHILD : 0;
+	memcpy(send_buf + off + sizeof(*ip), intf->i_name, strlen(intf->i_name));
+	off += sizeof(*ip) + namelen;
+
+	optslen = put_opts(intf, off) - off;
+	off += optslen;
 
 	for (i = 0; i < ATTR_HASH_MAX; i++) {
 		intf_attr_t *a;
-		for (a = intf->i_attrs[i]; a; a = a->a_next)
-			if (worth_sending(a))
-				nattrs++;
+		for (a = intf->i_attrs[i]; a; a = a->a_next) {
+			if (!worth_sending(a))
+				continue;
+
+			off = put_attr(off, a->a_type,
+				(a->a_rx_enabled ? ATTR_RX_PROVIDED : 0) |
+				(a->a_tx_enabled ? ATTR_TX_PROVIDED : 0) |
+				(a->a_hist ? ATTR_RATE_PROVIDED : 0),
+				a->a_rx, a->a_tx, 0, 0);
+
+			COPY_TS(&a->a_last_distribution, &a->a_updated);
+		}
 	}
 
-	nattrs += 2;
-	
-	msgsize = sizeof(*ip) + namelen + optsize + (nattrs * sizeof(*ap));
+	/* bytes & packets */
+	if (intf->i_rx_bytes.r_total || intf->i_tx_bytes.r_total ||
+	    send_all_rem == 0)
+		off = put_attr(off, BYTES, ATTR_RX_PROVIDED | ATTR_TX_PROVIDED,
+			intf->i_rx_bytes.r_total, intf->i_tx_bytes.r_total,
+			intf->i_rx_bytes.r_overflows,
+			intf->i_tx_bytes.r_overflows);
 
-	ip = buf = xcalloc(1, msgsize);
+	if (intf->i_rx_packets.r_total || intf->i_tx_packets.r_total ||
+	    send_all_rem == 0)
+		off = put_attr(off, PACKETS, ATTR_RX_PROVIDED | ATTR_TX_PROVIDED,
+			intf->i_rx_packets.r_total, intf->i_tx_packets.r_total,
+			intf->i_rx_packets.r_overflows,
+			intf->i_tx_packets.r_overflows);
 
-	ip->i_index = htons(intf->i_index);
-	ip->i_offset = htons(msgsize);
-	ip->i_namelen = namelen;
-	ip->i_optslen = optsize;
-	ip->i_flags |= intf->i_is_child ? IF_IS_CHILD : 0;
+	/* the buffer may have moved */
+	ip = (struct distr_msg_intf *) (send_buf + start);
+	ip->i_optslen = optslen;
+	ip->i_offset = htons(off - start);
 
-	off = sizeof(*ip);
-	memcpy(buf + off, intf->i_name, strlen(intf->i_name));
-	off += namelen;
+	return off;
+}
+
+/*
+ * Version 2 state of an interface: the base values of the current
+ * generation and the values sent last. Kept per node and interface
+ * index, the tables only grow while the node exists.
+ */
+struct intf_state
+{
+	int		is_valid;
+	uint8_t		is_gen;
+	char		is_name[IFNAME_MAX];
+	uint32_t	is_handle;
+	int		is_parent;
+	uint64_t	is_attrs;
+	b_cnt_t		is_base[__ATTR_MAX][2];
+	b_cnt_t		is_last[__ATTR_MAX][2];
+
+	/* byte and packet counters last added to the relay aggregate */
+	int		is_agg_valid;
+	int		is_agg_top;
+	char		is_agg_name[IFNAME_MAX];
+	b_cnt_t		is_agg_last[2][2];
+};
+
+struct node_state
+{
+	uint32_t		ns_serial;	/* node the state belongs to */
+	struct intf_state *	ns_intf;
+	int			ns_nintf;
+	int			ns_forwarded;
+	uint32_t		ns_seq;
+	int			ns_lease;	/* intervals left to drill down */
+};
+
+static struct node_state *node_states;
+static int nnode_states;
 
-	if (opts) {
-		memcpy(buf + off, opts, optsize);
-		off += optsize;
+static struct node_state *
+get_node_state(node_t *node)
+{
+	int n = node->n_index;
+
+	if (n >= nnode_states) {
+		node_states = xrealloc(node_states, (n + 1) * sizeof(struct node_state));
+		memset(node_states + nnode_states, 0,
+			(n + 1 - nnode_states) * sizeof(struct node_state));
+		nnode_states = n + 1;
+	}
+
+	/* the slot of a removed node has been taken over */
+	if (node_states[n].ns_serial != node->n_serial) {
+		xfree(node_states[n].ns_intf);
+		memset(&node_states[n], 0, sizeof(struct node_state));
+		node_states[n].ns_serial = node->n_serial;
 	}
 
+	return &node_states[n];
+}
+
+static struct intf_state *
+get_intf_state(intf_t *intf)
+{
+	struct node_state *ns = get_node_state(intf->i_node);
+
+	if (intf->i_index >= ns->ns_nintf) {
+		int size = intf->i_node->n_nintf;
+
+		ns->ns_intf = xrealloc(ns->ns_intf, size * sizeof(struct intf_state));
+		memset(ns->ns_intf + ns->ns_nintf, 0,
+			(size - ns->ns_nintf) * sizeof(struct intf_state));
+		ns->ns_nintf = size;
+	}
+
+	return &ns->ns_intf[intf->i_index];
+}
+
+static inline uint64_t
+counter_value(rate_t *r)
+{
+	return (uint64_t) r->r_overflows * OVERFLOW_LIMIT + r->r_total;
+}
+
+static size_t
+put_intf2(intf_t *intf, size_t off)
+{
+	struct intf_state *is = get_intf_state(intf);
+	b_cnt_t cur[__ATTR_MAX][2];
+	uint8_t flags[__ATTR_MAX];
+	uint64_t present = 0, changed = 0;
+	int i, base = 0, nattrs = 2;
+	uint8_t *p;
+
+	memset(flags, 0, sizeof(flags));
+
+	cur[BYTES][0] = counter_value(&intf->i_rx_bytes);
+	cur[BYTES][1] = counter_value(&intf->i_tx_bytes);
+	cur[PACKETS][0] = counter_value(&intf->i_rx_packets);
+	cur[PACKETS][1] = counter_value(&intf->i_tx_packets);
+	flags[BYTES] = flags[PACKETS] = ATTR_RX_PROVIDED | ATTR_TX_PROVIDED;
+	present = (1ULL << BYTES) | (1ULL << PACKETS);
+
 	for (i = 0; i < ATTR_HASH_MAX; i++) {
 		intf_attr_t *a;
 		for (a = intf->i_attrs[i]; a; a = a->a_next) {
-			if (worth_sending(a)) {
-				struct distr_msg_attr am = {
-					.a_type = a->a_type,
-					.a_rx = a->a_rx,
-					.a_tx = a->a_tx,
-					.a_flags = (a->a_rx_enabled ? ATTR_RX_PROVIDED : 0) |
-						(a->a_tx_enabled ? ATTR_TX_PROVIDED : 0),
-				};
-
-				COPY_TS(&a->a_last_distribution, &a->a_updated);
-				memcpy(buf + off, &am, sizeof(am));
-				off += sizeof(am);
-			}
+			if (a->a_type <= PACKETS || a->a_type >= __ATTR_MAX ||
+			    (!a->a_rx_enabled && !a->a_tx_enabled))
+				continue;
+
+			cur[a->a_type][0] = a->a_rx;
+			cur[a->a_type][1] = a->a_tx;
+			flags[a->a_type] = (a->a_rx_enabled ? ATTR_RX_PROVIDED : 0) |
+				(a->a_tx_enabled ? ATTR_TX_PROVIDED : 0) |
+				(a->a_hist ? ATTR_RATE_PROVIDED : 0);
+			present |= 1ULL << a->a_type;
+			nattrs++;
 		}
 	}
 
-	/* bytes & packets */
-	{
-		if (intf->i_rx_bytes.r_total ||
-			intf->i_tx_bytes.r_total ||
-			send_all_rem == 0) {
-		
-			struct distr_msg_attr ab = {
-				.a_type = BYTES,
-				.a_rx = intf->i_rx_bytes.r_total,
-				.a_tx = intf->i_tx_bytes.r_total,
-				.a_rx_overflows = intf->i_rx_bytes.r_overflows,
-				.a_tx_overflows = intf->i_tx_bytes.r_overflows,
-				.a_flags = ATTR_RX_PROVIDED | ATTR_TX_PROVIDED,
-			};
-			memcpy(buf + off, &ab, sizeof(ab));
-			off += sizeof(ab);
-		}
+	/* new interface in this slot, new attributes or time for a refresh */
+	if (!is->is_valid || send_all_rem == 0 ||
+	    strcmp(is->is_name, intf->i_name) ||
+	    is->is_handle != intf->i_handle ||
+	    is->is_parent != intf->i_parent ||
+	    (present & ~is->is_attrs)) {
+		is->is_valid = 1;
+		is->is_gen++;
+		strcpy(is->is_name, intf->i_name);
+		is->is_handle = intf->i_handle;
+		is->is_parent = intf->i_parent;
+		is->is_attrs = present;
+		base = 1;
+	}
+
+	for (i = 0; i < __ATTR_MAX; i++) {
+		if (!(present & (1ULL << i)))
+			continue;
 
-		if (intf->i_rx_packets.r_total ||
-			intf->i_tx_packets.r_total ||
-			send_all_rem == 0) {
-
-			struct distr_msg_attr ap = {
-				.a_type = PACKETS,
-				.a_rx = intf->i_rx_packets.r_total,
-				.a_tx = intf->i_tx_packets.r_total,
-				.a_rx_overflows = intf->i_rx_packets.r_overflows,
-				.a_tx_overflows = intf->i_tx_packets.r_overflows,
-				.a_flags = ATTR_RX_PROVIDED | ATTR_TX_PROVIDED,
-			};
-
-			memcpy(buf + off, &ap, sizeof(ap));
-			off += sizeof(ap);
+		if (base) {
+			is->is_base[i][0] = cur[i][0];
+			is->is_base[i][1] = cur[i][1];
+		} else if (cur[i][0] == is->is_last[i][0] &&
+			   cur[i][1] == is->is_last[i][1])
+			continue;
+
+		is->is_last[i][0] = cur[i][0];
+		is->is_last[i][1] = cur[i][1];
+		changed |= 1ULL << i;
+	}
+
+	p = msg_reserve(off, 4 * VARINT_MAX + 3 + IFNAME_MAX +
+		nattrs * (1 + 2 * VARINT_MAX));
+
+	p += varint_put(p, intf->i_index);
+	*p++ = (intf->i_is_child ? IF2_CHILD : 0) | (base ? IF2_BASE : 0);
+	*p++ = is->is_gen;
+
+	if (base) {
+		size_t namelen = strlen(intf->i_name);
+
+		*p++ = namelen;
+		memcpy(p, intf->i_name, namelen);
+		p += namelen;
+		p += varint_put(p, intf->i_handle);
+		p += varint_put(p, intf->i_parent);
+		p += varint_put(p, intf->i_link);
+		p += varint_put(p, intf->i_level);
+	}
+
+	p += varint_put(p, changed);
+
+	for (i = 0; i < __ATTR_MAX; i++) {
+		if (!(changed & (1ULL << i)))
+			continue;
+
+		if (base) {
+			*p++ = flags[i];
+			p += varint_put(p, cur[i][0]);
+			p += varint_put(p, cur[i][1]);
+		} else {
+			p += varint_put(p, zigzag_encode(cur[i][0] - is->is_base[i][0]));
+			p += varint_put(p, zigzag_encode(cur[i][1] - is->is_base[i][1]));
 		}
 	}
 
-	*size = msgsize;
-	return buf;
+	return p - send_buf;
 }
 
+/*
+ * The largest message fitting into a datagram without being
+ * fragmented on the way, capped to the default receive buffer size
+ * of collectors.
+ */
+static void
+update_mtu(void)
+{
+	int pmtu = 0, hdrlen = 28;
+	socklen_t len = sizeof(pmtu);
+
+	if (c_mtu) {
+		mtu = c_mtu;
+		return;
+	}
 
-static void *
-build_intf_group(node_t *node, size_t *size)
+#if defined IP_MTU && defined IPV6_MTU
+	if (AF_INET6 == send_family) {
+		getsockopt(send_fd, IPPROTO_IPV6, IPV6_MTU, &pmtu, &len);
+		hdrlen = 48;
+	} else
+		getsockopt(send_fd, IPPROTO_IP, IP_MTU, &pmtu, &len);
+#endif
+
+	if (pmtu <= hdrlen)
+		pmtu = 1500;
+
+	mtu = pmtu - hdrlen;
+	if (mtu > 8192)
+		mtu = 8192;
+
+	if (c_debug)
+		fprintf(stderr, "Using message size %d\n", mtu);
+}
+
+/*
+ * Header, node name and fragment option, identical for all fragments
+ * of a node except for the fields patched by send_frag(). Returns 0
+ * if the node name is too long for the 8 bit header offset.
+ */
+static size_t
+put_header(node_t *node)
 {
-	size_t grpsize = sizeof(struct distr_msg_grp);
-	struct distr_msg_grp *gp;
-	void *group;
-	int i;
+	size_t nodenamelen = (strlen(node->n_name) + 5) & ~3; /* 5 because of \0 */
+	struct distr_msg_hdropt *op;
+	struct distr_msg_hdr *hdr;
+	struct distr_msg_seq *seq;
+	size_t off = sizeof(*hdr) + nodenamelen;
+	timestamp_t *ts = &rtiming.rt_last_read;
+	int relay = c_relay && !strcmp(node->n_name, c_relay);
 
-	gp = group = xcalloc(1, grpsize);
-	
-	for (i = 0; i < node->n_nintf; i++) {
-		if (node->n_intf[i].i_name[0]) {
-			size_t size;
-			void *im = build_intf_msg(&node->n_intf[i], &size);
-			int goff = grpsize;
+	if (off + 2 * sizeof(*op) + sizeof(struct distr_msg_frag) +
+	    sizeof(*seq) + (relay ? sizeof(*op) : 0) > UINT8_MAX) {
+		if (c_debug)
+			fprintf(stderr, "Not sending node %s, name too long\n",
+				node->n_name);
+		return 0;
+	}
 
-			grpsize += size;
-			gp = group = xrealloc(group, grpsize);
-			memcpy(group + goff, im, size);
+	/* received nodes carry the time they were sampled at, in our clock */
+	if (node->n_sampled.tv_sec)
+		ts = &node->n_sampled;
 
-			xfree(im);
-		}
+	hdr = msg_reserve(0, off + 3 * sizeof(*op) +
+		sizeof(struct distr_msg_frag) + sizeof(*seq));
+	hdr->h_magic = BMON_MAGIC;
+	hdr->h_ver = c_version;
+	hdr->h_ts_sec = htonl(ts->tv_sec);
+	hdr->h_ts_usec = htonl(ts->tv_usec);
+	memcpy(send_buf + sizeof(*hdr), node->n_name, strlen(node->n_name));
+
+	op = (struct distr_msg_hdropt *) (send_buf + off);
+	op->ho_type = HDROPT_FRAG;
+	op->ho_len = sizeof(struct distr_msg_frag);
+	frag_off = off + sizeof(*op);
+	off += sizeof(*op) + sizeof(struct distr_msg_frag);
+
+	op = (struct distr_msg_hdropt *) (send_buf + off);
+	op->ho_type = HDROPT_SEQ;
+	op->ho_len = sizeof(*seq);
+	seq = (struct distr_msg_seq *) (op + 1);
+	seq->s_origin = htonl(node->n_origin);
+	seq->s_seq = htonl(node->n_seq);
+	seq->s_sender = htonl(get_local_origin());
+	off += sizeof(*op) + sizeof(*seq);
+
+	if (relay) {
+		op = (struct distr_msg_hdropt *) (send_buf + off);
+		op->ho_type = HDROPT_RELAY;
+		off += sizeof(*op);
 	}
 
-	gp->g_type = htons(BMON_GRP_IF);
-	gp->g_offset = htons(grpsize);
+	hdr->h_offset = off;
 
-	*size = grpsize;
-	return group;
+	return off;
 }
 
+static int
+queue_frame(size_t len)
+{
+	uint32_t flen = htonl(len);
+
+	if (queue_len + sizeof(flen) + len > queue_size) {
+		while (queue_len + sizeof(flen) + len > queue_size)
+			queue_size = queue_size ? queue_size * 2 : 65536;
+		queue_buf = xrealloc(queue_buf, queue_size);
+	}
+
+	memcpy(queue_buf + queue_len, &flen, sizeof(flen));
+	memcpy(queue_buf + queue_len + sizeof(flen), send_buf, len);
+	queue_len += sizeof(flen) + len;
+
+	return 0;
+}
 
 static void
-distribute_node(node_t *node, void *arg)
+stream_close(void)
 {
-	void *buf;
-	struct distr_msg_hdr *hdr;
-	size_t grpsize;
-	void *grp = build_intf_group(node, &grpsize);
-	size_t nodenamelen = (strlen(node->n_name) + 5) & ~3; /* 5 because of \0 */
-	size_t msgsize = sizeof(*hdr) + nodenamelen + grpsize;
+	if (c_debug && stream_up)
+		fprintf(stderr, "Connection to collector closed\n");
 
-	hdr = buf = xcalloc(1, msgsize);
+	close(send_fd);
+	send_fd = -1;
+	stream_up = 0;
+	queue_len = 0;
+}
+
+static void
+stream_connect(void)
+{
+	int fd, one = 1;
+
+	if ((fd = socket(stream_addr.ss_family, SOCK_STREAM, 0)) < 0)
+		return;
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	if (connect(fd, (struct sockaddr *) &stream_addr, stream_addrlen) < 0 &&
+	    EINPROGRESS != errno) {
+		if (c_debug)
+			fprintf(stderr, "connect() failed: %s\n", strerror(errno));
+		close(fd);
+		return;
+	}
+
+	/* frames of an interval are written at once, nothing to wait for */
+	if (AF_UNIX != stream_addr.ss_family)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	send_fd = fd;
+}
+
+static int
+stream_flush(void)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	while (off < queue_len) {
+		n = send(send_fd, queue_buf + off, queue_len - off, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (EINTR == errno)
+				continue;
+			if (EAGAIN == errno || EWOULDBLOCK == errno)
+				break;
+			return -1;
+		}
+		off += n;
+	}
+
+	memmove(queue_buf, queue_buf + off, queue_len - off);
+	queue_len -= off;
+
+	return 0;
+}
+
+static void
+reset_forwarded(node_t *node, void *arg)
+{
+	get_node_state(node)->ns_forwarded = 0;
+}
+
+/*
+ * Returns 1 if a sample may be queued. A new connection starts with
+ * everything sent in full, pure deltas follow. Samples are skipped as
+ * a whole while the collector is unreachable or does not keep up,
+ * attributes are only left out if the collector has seen them.
+ */
+static int
+stream_ready(void)
+{
+	if (send_fd < 0)
+		stream_connect();
+
+	if (send_fd < 0)
+		return 0;
+
+	if (!stream_up) {
+		struct pollfd p = { .fd = send_fd, .events = POLLOUT };
+		socklen_t len = sizeof(int);
+		int err = 0;
+
+		if (poll(&p, 1, 0) <= 0)
+			return 0;
+
+		if (getsockopt(send_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+			if (c_debug)
+				fprintf(stderr, "connect() failed: %s\n", strerror(err));
+			stream_close();
+			return 0;
+		}
+
+		if (c_debug)
+			fprintf(stderr, "Connected to collector\n");
+
+		stream_up = 1;
+		send_all_rem = 0;
+		foreach_node(reset_forwarded, NULL);
+	}
+
+	if (stream_flush() < 0) {
+		stream_close();
+		return 0;
+	}
+
+	return queue_len <= c_queue;
+}
+
+static int
+send_frag(size_t len, int index, int last)
+{
+	struct distr_msg_hdr *hdr = (struct distr_msg_hdr *) send_buf;
+	struct distr_msg_grp *gp;
+	struct distr_msg_frag *frag;
+
+	frag = (struct distr_msg_frag *) (send_buf + frag_off);
+	frag->f_seq = htonl(frag_seq);
+	frag->f_index = htons(index);
+	frag->f_flags = htons(last ? FRAG_LAST : 0);
+
+	gp = (struct distr_msg_grp *) (send_buf + hdr->h_offset);
+	gp->g_type = htons(BMON_GRP_IF);
+	gp->g_offset = htons(len - hdr->h_offset);
+
+	hdr->h_len = htons(len);
+
+	if (stream)
+		return queue_frame(len);
+
+	if (send(send_fd, send_buf, len, 0) < 0) {
+		/* path mtu has shrunk, retry with the new size */
+		if (EMSGSIZE == errno && !c_mtu)
+			return -EMSGSIZE;
 
-	hdr->h_magic = BMON_MAGIC;
-	hdr->h_ver = BMON_VERSION;
-	hdr->h_offset = sizeof(*hdr) + nodenamelen;
-	hdr->h_len = htons(msgsize);
-	hdr->h_ts_sec = htonl(rtiming.rt_last_read.tv_sec);
-	hdr->h_ts_usec = htonl(rtiming.rt_last_read.tv_usec);
-	memcpy(buf + sizeof(*hdr), node->n_name, strlen(node->n_name));
-	memcpy(buf + sizeof(*hdr) + nodenamelen, grp, grpsize);
-
-	if (send(send_fd, buf, msgsize, 0) < 0) {
 		if (!c_errignore)
 			quit("send() failed: %s\n", strerror(errno));
 		else if (c_debug)
 			fprintf(stderr, "Ignoring error %s\n", strerror(errno));
 	}
-	
-	xfree(grp);
-	xfree(buf);
+
+	return 0;
+}
+
+/* start of every interface in the fragment being built */
+static size_t *frag_intf;
+static int frag_nintf, frag_intf_size;
+
+static void
+note_frag_intf(size_t off)
+{
+	if (frag_nintf >= frag_intf_size) {
+		frag_intf_size = frag_intf_size ? frag_intf_size * 2 : 64;
+		frag_intf = xrealloc(frag_intf, frag_intf_size * sizeof(size_t));
+	}
+
+	frag_intf[frag_nintf++] = off;
+}
+
+/*
+ * Sends the interfaces in front of len. If the path mtu has shrunk,
+ * the interfaces already encoded are split into as many fragments as
+ * needed and numbering continues, so fragments sent before are not
+ * taken for duplicates and no interface state is lost.
+ */
+static void
+send_intfs(size_t first, size_t len, int *index, int last)
+{
+	for (;;) {
+		size_t end = len;
+		int i, n = frag_nintf;
+
+		/* as many interfaces as fit, a single one is sent as it is */
+		while (end > mtu && n > 1)
+			end = frag_intf[--n];
+
+		if (send_frag(end, *index, last && end == len) < 0) {
+			int old = mtu;
+
+			update_mtu();
+			if (mtu < old)
+				continue;
+
+			if (c_debug)
+				fprintf(stderr, "Dropping fragment exceeding path mtu\n");
+		}
+
+		(*index)++;
+
+		if (end == len)
+			break;
+
+		memmove(send_buf + first, send_buf + end, len - end);
+		len -= end - first;
+
+		for (i = n; i < frag_nintf; i++)
+			frag_intf[i - n] = frag_intf[i] - (end - first);
+		frag_nintf -= n;
+	}
+
+	frag_nintf = 0;
+}
+
+/*
+ * Interfaces are appended until a message would exceed the mtu, the
+ * message is sent without the last interface which is then moved to
+ * the start of the next fragment. Single interfaces exceeding the mtu
+ * are sent as they are.
+ */
+static void
+put_intf_group(node_t *node, size_t hdrlen)
+{
+	size_t first = hdrlen + sizeof(struct distr_msg_grp);
+	size_t off = first, start;
+	int i, index = 0;
+
+	msg_reserve(hdrlen, sizeof(struct distr_msg_grp));
+	frag_nintf = 0;
+
+	for (i = 0; i < node->n_nintf; i++) {
+		if (!node->n_intf[i].i_name[0])
+			continue;
+
+		start = off;
+		if (BMON_VERSION_1 == c_version)
+			off = put_intf(&node->n_intf[i], off);
+		else
+			off = put_intf2(&node->n_intf[i], off);
+
+		if (off > mtu && start > first) {
+			send_intfs(first, start, &index, 0);
+
+			memmove(send_buf + first, send_buf + start, off - start);
+			off = first + (off - start);
+			start = first;
+		}
+
+		note_frag_intf(start);
+	}
+
+	send_intfs(first, off, &index, 1);
+}
+
+/*
+ * Nodes sampled here, locally or by any input module other than the
+ * distribution collector, get a new sequence number on every read.
+ * Forwarded nodes keep origin and sequence and are only sent again
+ * once a newer sample has been received. Relays only send their
+ * own node and the aggregate, other nodes only if a collector has
+ * asked for them.
+ */
+static void
+distribute_node(node_t *node, void *arg)
+{
+	uint32_t self = get_local_origin();
+	size_t off;
+
+	if (0 == node->n_origin)
+		node->n_origin = self;
+
+	if (node->n_origin == self)
+		node->n_seq++;
+
+	if (c_relay && node != get_local_node() && strcmp(node->n_name, c_relay)) {
+		struct node_state *ns = get_node_state(node);
+
+		if (ns->ns_lease <= 0)
+			return;
+		ns->ns_lease--;
+	}
+
+	if (node->n_origin != self) {
+		struct node_state *ns = get_node_state(node);
+
+		if (ns->ns_forwarded && ns->ns_seq == node->n_seq)
+			return;
+
+		ns->ns_forwarded = 1;
+		ns->ns_seq = node->n_seq;
+	}
+
+	if (!(off = put_header(node)))
+		return;
+
+	frag_seq++;
+	put_intf_group(node, off);
+}
+
+/*
+ * The relay aggregate is a node of its own: the sum of the byte and
+ * packet counters of all top level interfaces collected and, as its
+ * children, the busiest of these interfaces with their own counters.
+ * The sum is built from per interval increases so nodes may come, go
+ * and restart without disturbing it.
+ */
+struct top_intf
+{
+	intf_t *	t_intf;
+	uint64_t	t_rate;
+};
+
+static struct top_intf *top;
+static int ntop;
+static b_cnt_t agg_total[2][2];
+
+static void
+aggregate_intf(intf_t *intf)
+{
+	struct intf_state *is = get_intf_state(intf);
+	b_cnt_t cur[2][2];
+	uint64_t rate;
+	int i, j;
+
+	cur[0][0] = counter_value(&intf->i_rx_bytes);
+	cur[0][1] = counter_value(&intf->i_tx_bytes);
+	cur[1][0] = counter_value(&intf->i_rx_packets);
+	cur[1][1] = counter_value(&intf->i_tx_packets);
+
+	/* counters of a new or reset interface only serve as base */
+	if (is->is_agg_valid && !strcmp(is->is_agg_name, intf->i_name))
+		for (i = 0; i < 2; i++)
+			for (j = 0; j < 2; j++)
+				if (cur[i][j] >= is->is_agg_last[i][j])
+					agg_total[i][j] += cur[i][j] - is->is_agg_last[i][j];
+
+	is->is_agg_valid = 1;
+	strcpy(is->is_agg_name, intf->i_name);
+	memcpy(is->is_agg_last, cur, sizeof(cur));
+
+	rate = (uint64_t) intf->i_rx_bytes.r_tps + intf->i_tx_bytes.r_tps;
+
+	/* interfaces selected before must be beaten clearly to avoid flapping */
+	if (is->is_agg_top)
+		rate += rate / 4;
+	is->is_agg_top = 0;
+
+	if (0 == rate || c_top <= 0 ||
+	    (ntop == c_top && top[ntop - 1].t_rate >= rate))
+		return;
+
+	i = ntop < c_top ? ntop++ : ntop - 1;
+	for (; i > 0 && top[i - 1].t_rate < rate; i--)
+		top[i] = top[i - 1];
+
+	top[i].t_intf = intf;
+	top[i].t_rate = rate;
+}
+
+static void
+aggregate_node(node_t *node, void *arg)
+{
+	int i;
+
+	if (node == arg || node == get_local_node())
+		return;
+
+	for (i = 0; i < node->n_nintf; i++)
+		if (node->n_intf[i].i_name[0] && !node->n_intf[i].i_is_child)
+			aggregate_intf(&node->n_intf[i]);
+}
+
+static inline void
+copy_counter(rate_t *dst, rate_t *src)
+{
+	dst->r_total = src->r_total;
+	dst->r_overflows = src->r_overflows;
+	dst->r_is64bit = src->r_is64bit;
+}
+
+/*
+ * Children of the aggregate are named node:interface, the node name
+ * is shortened to keep the interface name whole.
+ */
+static void
+top_name(intf_t *src, char *name)
+{
+	size_t ilen = strlen(src->i_name), nlen = strlen(src->i_node->n_name);
+
+	if (ilen > IFNAME_MAX - 2)
+		ilen = IFNAME_MAX - 2;
+	if (nlen > IFNAME_MAX - 2 - ilen)
+		nlen = IFNAME_MAX - 2 - ilen;
+
+	memcpy(name, src->i_node->n_name, nlen);
+	name[nlen] = ':';
+	memcpy(name + nlen + 1, src->i_name, ilen);
+	name[nlen + 1 + ilen] = '\0';
+}
+
+/* names may be shortened alike, the handle tells the sources apart */
+static uint32_t
+top_handle(intf_t *src)
+{
+	const char *p;
+	uint32_t h = 2166136261U;
+
+	for (p = src->i_node->n_name; *p; p++)
+		h = (h ^ (uint8_t) *p) * 16777619U;
+	h = (h ^ ':') * 16777619U;
+	for (p = src->i_name; *p; p++)
+		h = (h ^ (uint8_t) *p) * 16777619U;
+	h = (h ^ src->i_handle) * 16777619U;
+	h = (h ^ (uint32_t) src->i_parent) * 16777619U;
+
+	/* handle 1 is the total */
+	return h > 1 ? h : h + 2;
+}
+
+static void
+update_aggregate(void)
+{
+	node_t *agg = lookup_node(c_relay, 1);
+	intf_t *intf;
+	int i, parent;
+
+	ntop = 0;
+	foreach_node(aggregate_node, agg);
+
+	if (!(intf = lookup_intf(agg, "total", 1, 0)))
+		return;
+
+	intf->i_rx_bytes.r_total = agg_total[0][0];
+	intf->i_tx_bytes.r_total = agg_total[0][1];
+	intf->i_rx_packets.r_total = agg_total[1][0];
+	intf->i_tx_packets.r_total = agg_total[1][1];
+	intf->i_rx_bytes.r_is64bit = intf->i_tx_bytes.r_is64bit = 1;
+	intf->i_rx_packets.r_is64bit = intf->i_tx_packets.r_is64bit = 1;
+
+	notify_update(intf);
+	increase_lifetime(intf, 1);
+	parent = intf->i_index;
+
+	for (i = 0; i < ntop; i++) {
+		intf_t *src = top[i].t_intf;
+		char name[IFNAME_MAX];
+
+		get_intf_state(src)->is_agg_top = 1;
+		top_name(src, name);
+
+		if (!(intf = lookup_intf(agg, name, top_handle(src), parent)))
+			continue;
+
+		copy_counter(&intf->i_rx_bytes, &src->i_rx_bytes);
+		copy_counter(&intf->i_tx_bytes, &src->i_tx_bytes);
+		copy_counter(&intf->i_rx_packets, &src->i_rx_packets);
+		copy_counter(&intf->i_tx_packets, &src->i_tx_packets);
+
+		intf->i_is_child = 1;
+		intf->i_link = parent;
+		intf->i_level = 1;
+
+		notify_update(intf);
+		/* removed by the next read unless selected again */
+		intf->i_lifetime = 2;
+	}
+}
+
+static void
+grant_lease(node_t *node)
+{
+	struct node_state *ns = get_node_state(node);
+
+	if (c_debug)
+		fprintf(stderr, "Drill-down request for %s\n", node->n_name);
+
+	/* the collector has no state of this node, start with a base */
+	if (ns->ns_lease <= 0) {
+		int i;
+
+		for (i = 0; i < ns->ns_nintf; i++)
+			ns->ns_intf[i].is_valid = 0;
+		ns->ns_forwarded = 0;
+	}
+
+	ns->ns_lease = c_lease;
+}
+
+/*
+ * Drill-down requests are sent back by the collector and arrive on
+ * the connected socket.
+ */
+static void
+process_requests(void)
+{
+	char buf[512];
+	ssize_t len;
+
+	while ((len = recv(send_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		struct distr_msg_hdr *hdr = (struct distr_msg_hdr *) buf;
+		struct distr_msg_hdropt *op;
+		char *name = buf + sizeof(*hdr);
+		size_t off;
+		node_t *node;
+
+		if (len < sizeof(*hdr) + 4 || hdr->h_magic != BMON_MAGIC ||
+		    hdr->h_ver != BMON_VERSION || hdr->h_offset > len ||
+		    hdr->h_offset < sizeof(*hdr) + 4 ||
+		    !memchr(name, '\0', hdr->h_offset - sizeof(*hdr)))
+			continue;
+
+		off = sizeof(*hdr) + ((strlen(name) + 5) & ~3);
+
+		for (; off + sizeof(*op) <= hdr->h_offset; off += sizeof(*op) + op->ho_len) {
+			op = (struct distr_msg_hdropt *) (buf + off);
+			if (HDROPT_DRILL == op->ho_type)
+				break;
+		}
+
+		if (off + sizeof(*op) > hdr->h_offset)
+			continue;
+
+		if ((node = lookup_node(name, 0)))
+			grant_lease(node);
+	}
 }
 
 static void
 distribute_nodes(void)
 {
-	send_all_rem--;
-	
-	if (c_forward)
+	if (!stream)
+		send_all_rem--;
+	else if (!stream_ready())
+		return;
+
+	if (c_relay) {
+		if (!stream)
+			process_requests();
+		update_aggregate();
+		foreach_node(distribute_node, NULL);
+	} else if (c_forward)
 		foreach_node(distribute_node, NULL);
 	else
 		distribute_node(get_local_node(), NULL);
 
+	/* on a stream, everything is sent in full once per connection */
 	if (send_all_rem <= 0)
-		send_all_rem = c_send_all;
+		send_all_rem = stream ? 1 : c_send_all;
+
+	if (stream && stream_flush() < 0)
+		stream_close();
 }
 
 static void
@@ -324,9 +1102,18 @@ print_module_help(void)
 		"  gone down for a while (f.e. due to a reboot).\n" \
 		"\n" \
 		"  Remotely collected statistics can be distributed in forwarding\n" \
-		"  mode. However, you must make sure to not create loops as there\n" \
-		"  is no duplicate check on the receiving side and thus would\n" \
-		"  result in statistic corruption.\n" \
+		"  mode. Every node carries the instance it was sampled by and a\n" \
+		"  sequence number, receivers discard late and duplicated samples\n" \
+		"  as well as samples looping back to their origin.\n" \
+		"\n" \
+		"  In relay mode, nodes collected here are not forwarded but\n" \
+		"  summed up into a single node with a total and the busiest\n" \
+		"  interfaces. Collectors may ask for the full detail of a node\n" \
+		"  (distribution input option drilldown), unicast only.\n" \
+		"\n" \
+		"  Over a stream (tcp, unix), messages are never lost: the\n" \
+		"  connection starts with all attributes, only changes follow.\n" \
+		"  Lost connections are reestablished automatically.\n" \
 		"\n"
 		"  Author: Thomas Graf <tgraf@suug.ch>\n" \
 		"\n" \
@@ -338,6 +1125,14 @@ print_module_help(void)
 		"    errignore        Ignore ICMP error messages while sending\n" \
 		"    debug            Verbose output for debugging\n" \
 		"    sendall          Send interval of complete attribute list (default: 15)\n" \
+		"    mtu=NUM          Max. message size (default: path mtu, at most 8192)\n" \
+		"    version=NUM      Protocol version, 1 for old collectors (default: 2)\n" \
+		"    relay[=NAME]     Relay mode, name of aggregate (default: <node>-site)\n" \
+		"    top=NUM          Busiest interfaces in aggregate (default: 5)\n" \
+		"    lease=NUM        Intervals a node is sent on request (default: 10)\n" \
+		"    tcp              Connect to ip and port using TCP\n" \
+		"    unix=PATH        Connect to the unix domain socket PATH\n" \
+		"    queue=NUM        Max. bytes queued for a stream (default: 1048576)\n" \
 		"    help             Print this help text\n");
 }
 
@@ -362,7 +1157,23 @@ distribution_set_opts(tv_t *attrs)
 				c_send_all = strtol(attrs->value, NULL, 0);
 			else
 				c_send_all = 1;
-		} else if (!strcasecmp(attrs->type, "help")) {
+		} else if (!strcasecmp(attrs->type, "version") && attrs->value)
+			c_version = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "mtu") && attrs->value)
+			c_mtu = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "relay"))
+			c_relay = attrs->value ? attrs->value : "";
+		else if (!strcasecmp(attrs->type, "top") && attrs->value)
+			c_top = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "lease") && attrs->value)
+			c_lease = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "tcp"))
+			c_tcp = 1;
+		else if (!strcasecmp(attrs->type, "unix") && attrs->value)
+			c_unix = attrs->value;
+		else if (!strcasecmp(attrs->type, "queue") && attrs->value)
+			c_queue = strtol(attrs->value, NULL, 0);
+		else if (!strcasecmp(attrs->type, "help")) {
 			print_module_help();
 			exit(0);
 		}
@@ -382,6 +1193,38 @@ distribution_probe(void)
 	};
 	char s[INET6_ADDRSTRLEN];
 
+	if (c_version != BMON_VERSION_1 && c_version != BMON_VERSION)
+		quit("Unsupported protocol version %d\n", c_version);
+
+	if (c_relay) {
+		if (!*c_relay) {
+			const char *local = get_local_node()->n_name;
+
+			c_relay = xcalloc(1, strlen(local) + 6);
+			sprintf(c_relay, "%s-site", local);
+		}
+
+		top = xcalloc(c_top > 0 ? c_top : 1, sizeof(*top));
+	}
+
+	if (c_unix) {
+		struct sockaddr_un *sun = (struct sockaddr_un *) &stream_addr;
+
+		if (strlen(c_unix) >= sizeof(sun->sun_path))
+			quit("Path of unix socket too long: %s\n", c_unix);
+
+		sun->sun_family = AF_UNIX;
+		strcpy(sun->sun_path, c_unix);
+		stream_addrlen = sizeof(*sun);
+		goto stream;
+	}
+
+	if (c_tcp) {
+		if (!strcmp(c_ip, "224.0.0.1"))
+			quit("A collector address (ip=) is required for tcp\n");
+		hints.ai_socktype = SOCK_STREAM;
+	}
+
 	if (c_ipv6 && !strcmp(c_ip, "224.0.0.1"))
 		c_ip = "ff01::1";
 	
@@ -389,6 +1232,13 @@ distribution_probe(void)
 		quit("getaddrinfo failed: %s\n", gai_strerror(err));
 	
 	
+	if (c_tcp) {
+		memcpy(&stream_addr, res->ai_addr, res->ai_addrlen);
+		stream_addrlen = res->ai_addrlen;
+		freeaddrinfo(res);
+		goto stream;
+	}
+
 	for (t = res; t; t = t->ai_next) {
 		if (c_debug) {
 			const char *x = xinet_ntop(t->ai_addr, s, sizeof(s));
@@ -410,6 +1260,25 @@ distribution_probe(void)
 
 		if (c_debug)
 			fprintf(stderr, "OK\n");
+
+#if defined IP_MTU_DISCOVER && defined IPV6_MTU_DISCOVER
+		{
+			int pmtudisc;
+
+			/* never let the kernel fragment, we do it ourselves */
+			if (AF_INET6 == t->ai_family) {
+				pmtudisc = IPV6_PMTUDISC_DO;
+				setsockopt(send_fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER,
+					&pmtudisc, sizeof(pmtudisc));
+			} else {
+				pmtudisc = IP_PMTUDISC_DO;
+				setsockopt(send_fd, IPPROTO_IP, IP_MTU_DISCOVER,
+					&pmtudisc, sizeof(pmtudisc));
+			}
+		}
+#endif
+		send_family = t->ai_family;
+		update_mtu();
 		return 1;
 	}
 
@@ -423,6 +1292,14 @@ distribution_probe(void)
 
 	quit("Last error message was: %s\n", strerror(errno));
 	return 0;
+
+stream:
+	/* the collector may not be up yet, connecting is retried on every draw */
+	stream = 1;
+	send_fd = -1;
+	mtu = c_mtu && c_mtu < STREAM_MTU ? c_mtu : STREAM_MTU;
+	stream_connect();
+	return 1;
 }
 
 static struct output_module distribution_ops = {
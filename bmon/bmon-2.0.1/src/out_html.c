@@ -374,13 +374,24 @@ print_attr_detail(intf_attr_t *a, void *arg)
 {
 	FILE *fd = (FILE *) arg;
 
-	fprintf(fd,
-		"<tr id=\"tr_details\">\n" \
-		"<td id=\"td_details_name\">%s</td>\n" \
-		"<td id=\"td_details_rx\">%llu</td>\n" \
-		"<td id=\"td_details_tx\">%llu</td>\n" \
-		"</tr>\n",
-		type2name(a->a_type), a->a_rx, a->a_tx);
+	if (a->a_hist)
+		fprintf(fd,
+			"<tr id=\"tr_details\">\n" \
+			"<td id=\"td_details_name\">%s</td>\n" \
+			"<td id=\"td_details_rx\">%llu (%u/s)</td>\n" \
+			"<td id=\"td_details_tx\">%llu (%u/s)</td>\n" \
+			"</tr>\n",
+			type2name(a->a_type), (unsigned long long) a->a_rx,
+			a->a_rx_rate.r_tps, (unsigned long long) a->a_tx,
+			a->a_tx_rate.r_tps);
+	else
+		fprintf(fd,
+			"<tr id=\"tr_details\">\n" \
+			"<td id=\"td_details_name\">%s</td>\n" \
+			"<td id=\"td_details_rx\">%llu</td>\n" \
+			"<td id=\"td_details_tx\">%llu</td>\n" \
+			"</tr>\n",
+			type2name(a->a_type), a->a_rx, a->a_tx);
 }
 
 static void
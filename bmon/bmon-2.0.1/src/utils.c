@@ -28,6 +28,8 @@
 #include <bmon/conf.h>
 #include <bmon/utils.h>
 
+#include <fcntl.h>
+
 void *
 xcalloc(size_t n, size_t s)
 {
@@ -203,3 +205,63 @@ xinet_ntop(struct sockaddr *src, char *dst, socklen_t cnt)
 
 	return inet_ntop(family, s, dst, cnt);
 }
+
+char *
+stat_file_read(stat_file_t *sf)
+{
+	ssize_t n;
+
+	if (sf->sf_fd < 0) {
+		if ((sf->sf_fd = open(sf->sf_path, O_RDONLY)) < 0)
+			return NULL;
+	}
+
+	if (NULL == sf->sf_buf) {
+		sf->sf_size = 4096;
+		sf->sf_buf = xcalloc(1, sf->sf_size);
+	}
+
+	sf->sf_len = 0;
+
+	/*
+	 * pread from offset 0 rewinds seq_file based proc files without
+	 * having to reopen them.
+	 */
+	for (;;) {
+		if (sf->sf_len >= sf->sf_size - 1) {
+			sf->sf_size *= 2;
+			sf->sf_buf = xrealloc(sf->sf_buf, sf->sf_size);
+		}
+
+		n = pread(sf->sf_fd, sf->sf_buf + sf->sf_len,
+			sf->sf_size - sf->sf_len - 1, sf->sf_len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return NULL;
+		}
+
+		if (0 == n)
+			break;
+
+		sf->sf_len += n;
+	}
+
+	sf->sf_buf[sf->sf_len] = '\0';
+
+	return sf->sf_buf;
+}
+
+void
+stat_file_close(stat_file_t *sf)
+{
+	if (sf->sf_fd >= 0) {
+		close(sf->sf_fd);
+		sf->sf_fd = -1;
+	}
+
+	xfree(sf->sf_buf);
+	sf->sf_buf = NULL;
+	sf->sf_size = sf->sf_len = 0;
+}